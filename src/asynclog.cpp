@@ -0,0 +1,273 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "asynclog.h"
+#include "eventqueue.h"
+#include "libcec.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
+#include <sstream>
+#include <string>
+
+#include <log4cplus/loggingmacros.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+// any thread produces, the formatting thread alone consumes
+static mpsc_queue<AsyncLogRecord, ALOG_RING_SIZE> ring;
+
+static std::atomic<bool> running(false);
+static std::atomic<bool> stopping(false);
+static std::atomic<bool> sleeping(false);
+static int wakefd = -1;
+static pthread_t thread;
+
+static unsigned alogText(AsyncLogRecord &record, const char *text, size_t len) {
+	unsigned offset = record.textUsed;
+
+	if (len > ALOG_TEXT_MAX - 1 - offset)
+		len = ALOG_TEXT_MAX - 1 - offset;
+	memcpy(record.text + offset, text, len);
+	record.text[offset + len] = 0;
+	record.textUsed += len + 1;
+
+	return offset;
+}
+
+void alogArg(AsyncLogRecord &record, const char *str) {
+	if (record.count == ALOG_ARGS)
+		return;
+	record.args[record.count].type = ALOG_STR;
+	record.args[record.count].str = str;
+	record.count++;
+}
+
+void alogArg(AsyncLogRecord &record, cec_user_control_code keycode) {
+	if (record.count == ALOG_ARGS)
+		return;
+	record.args[record.count].type = ALOG_KEYCODE;
+	record.args[record.count].u = keycode;
+	record.count++;
+}
+
+void alogArg(AsyncLogRecord &record, const cec_keypress &key) {
+	if (record.count == ALOG_ARGS)
+		return;
+	record.args[record.count].type = ALOG_KEYPRESS;
+	record.args[record.count].u = (uint64_t)(key.keycode & 0xff) << 32 | key.duration;
+	record.count++;
+}
+
+void alogArg(AsyncLogRecord &record, const cec_command &command) {
+	char frame[3 * (2 + 64)];
+	int len = 0;
+
+	if (record.count == ALOG_ARGS || record.textUsed >= ALOG_TEXT_MAX)
+		return;
+
+	// as libcec logs traffic, 0f:44:01
+	len = snprintf(frame, sizeof frame, "%x%x", command.initiator & 0xf, command.destination & 0xf);
+	if (command.opcode_set)
+		len += snprintf(frame + len, sizeof frame - len, ":%02x", command.opcode & 0xff);
+	for (unsigned i = 0; i < command.parameters.size && i < 64; i++)
+		len += snprintf(frame + len, sizeof frame - len, ":%02x", command.parameters[i]);
+
+	record.args[record.count].type = ALOG_COMMAND;
+	record.args[record.count].text = alogText(record, frame, len);
+	record.count++;
+}
+
+void alogArg(AsyncLogRecord &record, const cec_log_message &message) {
+	if (record.count == ALOG_ARGS || record.textUsed >= ALOG_TEXT_MAX)
+		return;
+
+	record.args[record.count].type = ALOG_CEC_LOG;
+	record.args[record.count].u = (uint64_t)message.time << 8 | (message.level & 0xff);
+	record.args[record.count].text = alogText(record, message.message, strlen(message.message));
+	record.count++;
+}
+
+/*
+ * The line, on the formatting thread
+ */
+static void format(const AsyncLogRecord &record) {
+	std::ostringstream out;
+
+	for (unsigned i = 0; i < record.count; i++) {
+		switch (record.args[i].type) {
+			case ALOG_STR:
+				out << record.args[i].str;
+				break;
+			case ALOG_INT:
+				out << record.args[i].i;
+				break;
+			case ALOG_UINT:
+				out << record.args[i].u;
+				break;
+			case ALOG_KEYCODE:
+				out << (cec_user_control_code)record.args[i].u;
+				break;
+			case ALOG_KEYPRESS: {
+				cec_keypress key;
+				key.keycode = (cec_user_control_code)(record.args[i].u >> 32);
+				key.duration = (uint32_t)record.args[i].u;
+				out << key;
+				break;
+			}
+			case ALOG_COMMAND:
+				out << "Command " << record.text + record.args[i].text;
+				break;
+			case ALOG_CEC_LOG:
+				out << (int64_t)(record.args[i].u >> 8) << " [" << (cec_log_level)(record.args[i].u & 0xff) << "]"
+					<< record.text + record.args[i].text;
+				break;
+		}
+	}
+
+	Logger &logger = *record.logger;
+	std::string line = out.str();
+
+	switch (record.level) {
+		case TRACE_LOG_LEVEL: LOG4CPLUS_TRACE(logger, line); break;
+		case DEBUG_LOG_LEVEL: LOG4CPLUS_DEBUG(logger, line); break;
+		case INFO_LOG_LEVEL:  LOG4CPLUS_INFO(logger, line); break;
+		case WARN_LOG_LEVEL:  LOG4CPLUS_WARN(logger, line); break;
+		default:              LOG4CPLUS_ERROR(logger, line); break;
+	}
+}
+
+void asyncLogPost(const AsyncLogRecord &record) {
+	if (!running.load(std::memory_order_acquire)) {
+		format(record);
+		return;
+	}
+
+	// only the used part, the text is mostly empty
+	bool queued = ring.emplace([&record](AsyncLogRecord &slot) {
+		memcpy(&slot, &record, offsetof(AsyncLogRecord, text) + record.textUsed);
+	});
+
+	if (!queued) {
+		metricsAdd(METRIC_LOG_DROPPED);
+		return;
+	}
+
+	// a write only when the thread went to sleep, not per record
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false)) {
+		uint64_t one = 1;
+		if (write(wakefd, &one, sizeof one) < 0) {}
+	}
+}
+
+static bool drain() {
+	bool any = false;
+
+	while (ring.consume(format))
+		any = true;
+
+	return any;
+}
+
+static void *formatter(void *) {
+	while (!stopping.load()) {
+		if (drain())
+			continue;
+
+		sleeping.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		// a record may have come in before the flag was seen
+		if (drain()) {
+			sleeping.store(false);
+			continue;
+		}
+
+		uint64_t count;
+		if (read(wakefd, &count, sizeof count) < 0 && errno != EINTR)
+			break;
+	}
+
+	drain();
+	return NULL;
+}
+
+void asyncLogStart() {
+	if (running.load())
+		return;
+
+	wakefd = eventfd(0, EFD_CLOEXEC);
+	if (wakefd < 0) {
+		fprintf(stderr, "Unable to create log eventfd: %s\n", strerror(errno));
+		return;
+	}
+
+	// signals are the main loop's, which only blocks them once set up
+	sigset_t mask, saved;
+	sigfillset(&mask);
+	sigdelset(&mask, SIGSEGV);
+	sigdelset(&mask, SIGBUS);
+	sigdelset(&mask, SIGILL);
+	sigdelset(&mask, SIGFPE);
+	sigdelset(&mask, SIGABRT);
+	pthread_sigmask(SIG_BLOCK, &mask, &saved);
+
+	stopping = false;
+	int err = pthread_create(&thread, NULL, formatter, NULL);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Unable to start log thread, logging synchronously\n");
+		close(wakefd);
+		wakefd = -1;
+		return;
+	}
+
+	running.store(true, std::memory_order_release);
+}
+
+void asyncLogStop() {
+	if (!running.load())
+		return;
+
+	// late records are formatted in place from here on
+	running.store(false, std::memory_order_release);
+	stopping = true;
+
+	uint64_t one = 1;
+	if (write(wakefd, &one, sizeof one) < 0) {}
+	pthread_join(thread, NULL);
+
+	// a producer that saw running just before it went may have queued
+	// after the thread's last drain
+	drain();
+
+	close(wakefd);
+	wakefd = -1;
+}
@@ -0,0 +1,143 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <libcec/cectypes.h>
+
+#include <stdint.h>
+#include <type_traits>
+
+#include <log4cplus/logger.h>
+
+#define ALOG_RING_SIZE	1024	// records, a power of two
+#define ALOG_ARGS	8	// arguments per record, more are left out
+#define ALOG_TEXT_MAX	240	// bytes of copied text per record
+
+/*
+ * Levels below this are compiled out. It follows log4cplus's own switches,
+ * so make LOG_STRIP="-DLOG4CPLUS_DISABLE_TRACE -DLOG4CPLUS_DISABLE_DEBUG"
+ * strips LOG4CPLUS_DEBUG and ALOG_DEBUG alike.
+ */
+#if defined(LOG4CPLUS_DISABLE_INFO)
+#define ALOG_MIN_LEVEL	log4cplus::WARN_LOG_LEVEL
+#elif defined(LOG4CPLUS_DISABLE_DEBUG)
+#define ALOG_MIN_LEVEL	log4cplus::INFO_LOG_LEVEL
+#elif defined(LOG4CPLUS_DISABLE_TRACE)
+#define ALOG_MIN_LEVEL	log4cplus::DEBUG_LOG_LEVEL
+#else
+#define ALOG_MIN_LEVEL	log4cplus::TRACE_LOG_LEVEL
+#endif
+
+/**
+ * Logs from the key path without formatting there. The arguments are
+ * recorded as they are into a lock-free ring and a background thread turns
+ * them into a line and hands it to log4cplus:
+ *
+ *   ALOG_DEBUG(logger, "Main::onCecKeyPress(", key, ")");
+ *
+ * Strings must be literals, only their address is kept. Integers, key
+ * codes, key presses, commands and libcec log messages are copied. Lines
+ * may come out after synchronous LOG4CPLUS lines logged later, and are
+ * dropped and counted when the ring is full.
+ */
+#define ALOG(logger, level, ...) \
+	do { \
+		if ((level) >= ALOG_MIN_LEVEL && (logger).isEnabledFor(level)) \
+			asyncLog(logger, level, __VA_ARGS__); \
+	} while (0)
+
+#define ALOG_TRACE(logger, ...)	ALOG(logger, log4cplus::TRACE_LOG_LEVEL, __VA_ARGS__)
+#define ALOG_DEBUG(logger, ...)	ALOG(logger, log4cplus::DEBUG_LOG_LEVEL, __VA_ARGS__)
+
+typedef enum {
+	ALOG_STR,
+	ALOG_INT,
+	ALOG_UINT,
+	ALOG_KEYCODE,
+	ALOG_KEYPRESS,		// keycode << 32 | duration
+	ALOG_COMMAND,		// text holds the frame
+	ALOG_CEC_LOG,		// time << 8 | level, text holds the message
+} alog_arg_t;
+
+struct AsyncLogRecord {
+	log4cplus::Logger *logger;
+	log4cplus::LogLevel level;
+	unsigned count;
+	unsigned textUsed;
+	struct {
+		uint8_t type;		// alog_arg_t
+		uint16_t text;		// offset into text
+		union {
+			const char *str;
+			int64_t i;
+			uint64_t u;
+		};
+	} args[ALOG_ARGS];
+	char text[ALOG_TEXT_MAX];
+};
+
+void alogArg(AsyncLogRecord &record, const char *str);
+void alogArg(AsyncLogRecord &record, CEC::cec_user_control_code keycode);
+void alogArg(AsyncLogRecord &record, const CEC::cec_keypress &key);
+void alogArg(AsyncLogRecord &record, const CEC::cec_command &command);
+void alogArg(AsyncLogRecord &record, const CEC::cec_log_message &message);
+
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value>::type alogArg(AsyncLogRecord &record, T value) {
+	if (record.count == ALOG_ARGS)
+		return;
+	record.args[record.count].type = std::is_signed<T>::value ? ALOG_INT : ALOG_UINT;
+	if (std::is_signed<T>::value)
+		record.args[record.count].i = value;
+	else
+		record.args[record.count].u = value;
+	record.count++;
+}
+
+/**
+ * Queues one record, or formats it right away while no thread runs
+ */
+void asyncLogPost(const AsyncLogRecord &record);
+
+template<typename... Args>
+void asyncLog(log4cplus::Logger &logger, log4cplus::LogLevel level, const Args &... args) {
+	AsyncLogRecord record;
+
+	record.logger = &logger;
+	record.level = level;
+	record.count = 0;
+	record.textUsed = 0;
+
+	int expand[] = { 0, (alogArg(record, args), 0)... };
+	(void)expand;
+
+	asyncLogPost(record);
+}
+
+/**
+ * Starts the thread that formats records, after daemon()
+ */
+void asyncLogStart();
+
+/**
+ * Formats what is left and stops the thread
+ */
+void asyncLogStop();
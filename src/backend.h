@@ -0,0 +1,62 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <libcec/cec.h>
+
+/**
+ * What Cec needs from an adapter. The default is libcec, see libcec.cpp,
+ * FakeBackend in fakecec.h runs without hardware.
+ *
+ * A backend calls the callbacks in the configuration given to init(),
+ * from threads of its own, between open() and close().
+ */
+class CecBackend {
+	public:
+		virtual ~CecBackend() {}
+
+		/**
+		 * Called before anything else, may be called again
+		 */
+		virtual bool init(CEC::libcec_configuration &config) = 0;
+
+		/**
+		 * Undoes init() after close(), the next init() starts from scratch
+		 */
+		virtual void release() = 0;
+
+		virtual int8_t findAdapters(CEC::cec_adapter *devices, uint8_t size) = 0;
+		virtual bool open(const char *port) = 0;
+		virtual void close() = 0;
+		virtual bool ping() = 0;
+
+		virtual bool setActiveSource(CEC::cec_device_type type) = 0;
+		virtual bool setInactiveView() = 0;
+
+		virtual CEC::cec_logical_addresses getActiveDevices() = 0;
+		virtual uint16_t getDevicePhysicalAddress(CEC::cec_logical_address address) = 0;
+		virtual CEC::cec_osd_name getDeviceOSDName(CEC::cec_logical_address address) = 0;
+		virtual uint64_t getDeviceVendorId(CEC::cec_logical_address address) = 0;
+
+		virtual const char *toString(CEC::cec_logical_address address) = 0;
+		virtual const char *toString(CEC::cec_opcode opcode) = 0;
+		virtual const char *toString(CEC::cec_vendor_id vendor) = 0;
+};
@@ -0,0 +1,472 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * Benchmark of the key path: calls Main::onCecKeyPress and
+ * Main::onCecCommand the way libcec would and has a child process read
+ * the LIRC lines with N clients, over the UNIX socket or loopback TCP. No
+ * adapter is opened, so this runs on any Linux host. Prints one JSON
+ * object per client count.
+ *
+ * With -z it doubles as a check: once warm, the key path must not allocate,
+ * see make check.
+ */
+
+#include "main.h"
+#include "latency.h"
+#include "metrics.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+
+#include <atomic>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/configurator.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::string;
+using std::vector;
+
+/*
+ * Syscalls and allocations are counted by wrapping the libc functions the
+ * key path uses. The counters only matter in the parent.
+ */
+enum { COUNT_WRITE, COUNT_READ, COUNT_SENDMSG, COUNT_EPOLL_WAIT, COUNT_MALLOC, COUNT_MAX };
+
+static const char *countNames[COUNT_MAX] = { "write", "read", "sendmsg", "epoll_wait", "malloc" };
+static std::atomic<unsigned long> counts[COUNT_MAX];
+
+extern "C" {
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+	counts[COUNT_MALLOC].fetch_add(1, std::memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+	counts[COUNT_MALLOC].fetch_add(1, std::memory_order_relaxed);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	counts[COUNT_MALLOC].fetch_add(1, std::memory_order_relaxed);
+	return __libc_realloc(ptr, size);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+	static ssize_t (*next)(int, const void *, size_t) = (ssize_t (*)(int, const void *, size_t))dlsym(RTLD_NEXT, "write");
+	counts[COUNT_WRITE].fetch_add(1, std::memory_order_relaxed);
+	return next(fd, buf, count);
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+	static ssize_t (*next)(int, void *, size_t) = (ssize_t (*)(int, void *, size_t))dlsym(RTLD_NEXT, "read");
+	counts[COUNT_READ].fetch_add(1, std::memory_order_relaxed);
+	return next(fd, buf, count);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+	static ssize_t (*next)(int, const struct msghdr *, int) = (ssize_t (*)(int, const struct msghdr *, int))dlsym(RTLD_NEXT, "sendmsg");
+	counts[COUNT_SENDMSG].fetch_add(1, std::memory_order_relaxed);
+	return next(fd, msg, flags);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+	static int (*next)(int, struct epoll_event *, int, int) = (int (*)(int, struct epoll_event *, int, int))dlsym(RTLD_NEXT, "epoll_wait");
+	counts[COUNT_EPOLL_WAIT].fetch_add(1, std::memory_order_relaxed);
+	return next(epfd, events, maxevents, timeout);
+}
+
+}
+
+struct result_t {
+	unsigned long lines;
+	unsigned long bytes;
+};
+
+/*
+ * The child: per run, reads a client count, connects that many clients,
+ * acks, reads until ceclircd closes them all and reports what came in.
+ * With a port the clients connect to it on loopback, else to path.
+ */
+static void reader(const string &path, unsigned port, int in, int out) {
+	unsigned n;
+
+	while (read(in, &n, sizeof n) == sizeof n && n) {
+		struct sockaddr_un sa = {0};
+		struct sockaddr_in sin = {0};
+		result_t result = {0, 0};
+		int epollfd = epoll_create1(0);
+
+		sa.sun_family = AF_UNIX;
+		strncpy(sa.sun_path, path.c_str(), sizeof sa.sun_path - 1);
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(port);
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		for (unsigned i = 0; i < n; i++) {
+			// blocking, a TCP connect would only be in progress otherwise
+			int fd = socket(port ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+			struct epoll_event ev = {0};
+
+			if (port ? connect(fd, (struct sockaddr *)&sin, sizeof sin) < 0 : connect(fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+				fprintf(stderr, "Unable to connect to %s: %s\n", port ? "loopback" : path.c_str(), strerror(errno));
+				exit(1);
+			}
+			ev.events = EPOLLIN;
+			ev.data.fd = fd;
+			epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+		}
+
+		write(out, &n, sizeof n);
+
+		for (unsigned open = n; open; ) {
+			struct epoll_event events[64];
+			char buf[65536];
+
+			int ready = epoll_wait(epollfd, events, 64, -1);
+			for (int i = 0; i < ready; i++) {
+				ssize_t len = read(events[i].data.fd, buf, sizeof buf);
+
+				if (len <= 0) {
+					close(events[i].data.fd);
+					open--;
+					continue;
+				}
+
+				result.bytes += len;
+				for (ssize_t j = 0; j < len; j++)
+					result.lines += buf[j] == '\n';
+			}
+		}
+
+		close(epollfd);
+		write(out, &result, sizeof result);
+	}
+
+	exit(0);
+}
+
+class Bench {
+
+	private:
+
+		string path;
+		unsigned port;
+		int toReader;
+		int fromReader;
+		pid_t child;
+
+		static uint64_t cpuUs() {
+			struct rusage usage;
+
+			getrusage(RUSAGE_SELF, &usage);
+			return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+				+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+		}
+
+		/*
+		 * One callback, stamped like the trampolines in libcec.cpp do
+		 */
+		static void event(Main &main, unsigned i) {
+			cec_command command;
+			cec_keypress key;
+
+			latencyStart = latencyNow();
+
+			// a press, button ups that keep it held, the release. The repeats
+			// come from the main loop's timer, which doesn't run here.
+			switch (i % 6) {
+				case 0:
+					command.Clear();
+					command.initiator = CECDEVICE_TV;
+					command.opcode = CEC_OPCODE_USER_CONTROL_PRESSED;
+					command.parameters.PushBack(CEC_USER_CONTROL_CODE_SELECT);
+					main.onCecCommand(command);
+					break;
+				case 1:
+					key.keycode = CEC_USER_CONTROL_CODE_SELECT;
+					key.duration = 0;
+					main.onCecKeyPress(key);
+					break;
+				case 5:
+					key.keycode = CEC_USER_CONTROL_CODE_SELECT;
+					key.duration = 100;
+					main.onCecKeyPress(key);
+					break;
+				default:
+					command.Clear();
+					command.initiator = CECDEVICE_TV;
+					command.opcode = CEC_OPCODE_VENDOR_REMOTE_BUTTON_UP;
+					main.onCecCommand(command);
+					break;
+			}
+
+			latencyStart = 0;
+		}
+
+	public:
+
+		Bench(const string &path, unsigned port) : path(path), port(port) {
+			int down[2], up[2];
+
+			if (pipe(down) < 0 || pipe(up) < 0)
+				throw std::runtime_error("Unable to create pipes: " + string(strerror(errno)));
+
+			// before any thread exists
+			child = fork();
+			if (child < 0)
+				throw std::runtime_error("Unable to fork: " + string(strerror(errno)));
+			if (child == 0) {
+				close(down[1]);
+				close(up[0]);
+				reader(path, port, down[0], up[1]);
+			}
+
+			close(down[0]);
+			close(up[1]);
+			toReader = down[1];
+			fromReader = up[0];
+		}
+
+		~Bench() {
+			unsigned zero = 0;
+
+			write(toReader, &zero, sizeof zero);
+			close(toReader);
+			close(fromReader);
+			waitpid(child, NULL, 0);
+		}
+
+		/**
+		 * Returns the allocations during the measured callbacks, the warm
+		 * ones before them fill the frame free list and the like
+		 */
+		unsigned long run(unsigned clients, unsigned events, unsigned rate, unsigned warm) {
+			Main &main = Main::instance();
+			unsigned long before[COUNT_MAX];
+			struct timespec start, end, next;
+			result_t result;
+			unsigned ack;
+
+			main.setLircPath(path);
+			if (port)
+				main.setLircTcp("127.0.0.1", port, LIRC_TCP_SNDBUF);
+			// the same press thousands of times a second, all of them count
+			main.setDedupeWindow(0);
+			if (!main.mylirc.Open())
+				throw std::runtime_error("Unable to open " + path);
+
+			uint64_t connected = metricsValue(METRIC_CLIENTS_CONNECTED);
+			write(toReader, &clients, sizeof clients);
+			read(fromReader, &ack, sizeof ack);
+			while (metricsValue(METRIC_CLIENTS_CONNECTED) - connected < clients)
+				usleep(1000);
+
+			for (unsigned i = 0; i < warm; i++)
+				event(main, i);
+
+			uint64_t dropped = metricsValue(METRIC_EVENTS_DROPPED);
+			uint64_t shortWrites = metricsValue(METRIC_SHORT_WRITES);
+			for (unsigned i = 0; i < LATENCY_STAGES; i++)
+				latency[i].reset();
+			for (unsigned i = 0; i < COUNT_MAX; i++)
+				before[i] = counts[i].load();
+			uint64_t cpu = cpuUs();
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			next = start;
+
+			for (unsigned i = 0; i < events; i++) {
+				event(main, warm + i);
+
+				// pace in steps of 64 events, sleeping per event costs more than it measures
+				if (rate && (i & 63) == 63) {
+					uint64_t ns = 64 * 1000000000ull / rate;
+					next.tv_sec += (next.tv_nsec + ns) / 1000000000;
+					next.tv_nsec = (next.tv_nsec + ns) % 1000000000;
+					clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+				}
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			// let the lirc thread finish what is queued
+			uint64_t written;
+			do {
+				written = metricsValue(METRIC_BYTES_WRITTEN);
+				usleep(20000);
+			} while (written != metricsValue(METRIC_BYTES_WRITTEN));
+
+			cpu = cpuUs() - cpu;
+			unsigned long after[COUNT_MAX];
+			for (unsigned i = 0; i < COUNT_MAX; i++)
+				after[i] = counts[i].load();
+
+			main.mylirc.Close();
+			read(fromReader, &result, sizeof result);
+
+			double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+			unsigned long syscalls = 0;
+
+			printf("{\"transport\": \"%s\", \"clients\": %u, \"events\": %u, \"rate\": %u, \"seconds\": %.6f, \"events_per_sec\": %.1f, \"cpu_us_per_event\": %.3f",
+				port ? "tcp" : "unix", clients, events, rate, seconds, events / seconds, (double)cpu / events);
+			printf(", \"per_event\": {");
+			for (unsigned i = 0; i < COUNT_MAX; i++) {
+				if (i != COUNT_MALLOC)
+					syscalls += after[i] - before[i];
+				printf("%s\"%s\": %.3f", i ? ", " : "", countNames[i], (double)(after[i] - before[i]) / events);
+			}
+			printf(", \"syscalls\": %.3f}", (double)syscalls / events);
+			printf(", \"events_dropped\": %llu, \"short_writes\": %llu, \"lines_received\": %lu, \"bytes_received\": %lu",
+				(unsigned long long)(metricsValue(METRIC_EVENTS_DROPPED) - dropped),
+				(unsigned long long)(metricsValue(METRIC_SHORT_WRITES) - shortWrites),
+				result.lines, result.bytes);
+			printf(", \"latency_us\": {\"queued_p50\": %llu, \"queued_p99\": %llu, \"written_p50\": %llu, \"written_p99\": %llu, \"written_p999\": %llu}}\n",
+				(unsigned long long)latency[LATENCY_QUEUED].percentile(0.5),
+				(unsigned long long)latency[LATENCY_QUEUED].percentile(0.99),
+				(unsigned long long)latency[LATENCY_WRITTEN].percentile(0.5),
+				(unsigned long long)latency[LATENCY_WRITTEN].percentile(0.99),
+				(unsigned long long)latency[LATENCY_WRITTEN].percentile(0.999));
+			fflush(stdout);
+
+			return after[COUNT_MALLOC] - before[COUNT_MALLOC];
+		}
+};
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [options]\n\n", name);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "\t-c <list> Comma separated client counts. The default is 1,10,100,1000.\n");
+	fprintf(stderr, "\t-n <num> Callbacks per run. The default is 100000.\n");
+	fprintf(stderr, "\t-r <num> Callbacks per second, 0 for as fast as possible (default).\n");
+	fprintf(stderr, "\t-d <socket> UNIX socket to use. The default is /tmp/ceclircd-bench.<pid>.\n");
+	fprintf(stderr, "\t-p <port> Connect the clients over TCP on loopback, to <port>, instead.\n");
+	fprintf(stderr, "\t-w <num> Callbacks to warm up with before measuring. The default is 0.\n");
+	fprintf(stderr, "\t-z Fail if a measured callback allocates.\n");
+}
+
+int main(int argc, char *argv[]) {
+	string list = "1,10,100,1000";
+	unsigned events = 100000;
+	unsigned rate = 0;
+	unsigned port = 0;
+	unsigned warm = 0;
+	bool zeroAlloc = false;
+	vector<unsigned> clients;
+	std::stringstream path;
+	int opt;
+
+	path << "/tmp/ceclircd-bench." << getpid();
+
+	while ((opt = getopt(argc, argv, "hc:n:r:d:p:w:z")) != -1) {
+		switch (opt) {
+			case 'c':
+				list = optarg;
+				break;
+			case 'n':
+				events = atoi(optarg);
+				break;
+			case 'r':
+				rate = atoi(optarg);
+				break;
+			case 'd':
+				path.str(optarg);
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'w':
+				warm = atoi(optarg);
+				break;
+			case 'z':
+				zeroAlloc = true;
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : -1;
+		}
+	}
+
+	std::stringstream items(list);
+	string item;
+	while (std::getline(items, item, ','))
+		if (atoi(item.c_str()) > 0)
+			clients.push_back(atoi(item.c_str()));
+
+	if (clients.empty() || events == 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	// 1000 clients need both ends of 1000 sockets
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	BasicConfigurator config;
+	config.configure();
+	Logger::getRoot().setLogLevel(FATAL_LOG_LEVEL);
+
+	try {
+		Bench bench(path.str(), port);
+
+		for (size_t i = 0; i < clients.size(); i++) {
+			unsigned long allocs = bench.run(clients[i], events, rate, warm);
+
+			if (zeroAlloc && allocs) {
+				fprintf(stderr, "%lu allocations in %u callbacks with %u clients, expected none\n", allocs, events, clients[i]);
+				unlink(path.str().c_str());
+				return 1;
+			}
+		}
+	} catch (std::exception & e) {
+		fprintf(stderr, "%s\n", e.what());
+		return -1;
+	}
+
+	unlink(path.str().c_str());
+	return 0;
+}
@@ -0,0 +1,355 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "capture.h"
+#include "latency.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <atomic>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::string;
+
+static Logger logger = Logger::getInstance("capture");
+
+// -1 unless capturing, the callbacks come from several libcec threads
+static std::atomic<int> captureFd(-1);
+
+// payload length per capture_type_t
+static const uint32_t payloadLen[] = {
+	0,
+	sizeof(capture_keypress_t),
+	sizeof(capture_command_t),
+	sizeof(capture_alert_t),
+	sizeof(capture_source_t),
+	sizeof(capture_configuration_t),
+};
+
+bool captureOpen(const string &path) {
+	capture_header_t header;
+	struct stat st;
+
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "Unable to open %s: %s\n", path.c_str(), strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+
+	// a capture is appended to, across restarts of ceclircd too
+	if (st.st_size == 0) {
+		memcpy(header.magic, CAPTURE_MAGIC, sizeof header.magic);
+		if (write(fd, &header, sizeof header) != sizeof header) {
+			fprintf(stderr, "Unable to write %s: %s\n", path.c_str(), strerror(errno));
+			close(fd);
+			return false;
+		}
+	} else if (pread(fd, &header, sizeof header, 0) != sizeof header || memcmp(header.magic, CAPTURE_MAGIC, sizeof header.magic) != 0) {
+		fprintf(stderr, "%s is not a capture\n", path.c_str());
+		close(fd);
+		return false;
+	}
+
+	captureFd.store(fd, std::memory_order_relaxed);
+	return true;
+}
+
+/*
+ * One record in one write, O_APPEND keeps records of concurrent callbacks apart
+ */
+static void captureWrite(capture_type_t type, const void *payload, uint32_t len) {
+	static const char padding[8] = { 0 };
+	capture_record_t record;
+	struct iovec iov[3];
+
+	int fd = captureFd.load(std::memory_order_relaxed);
+	if (fd < 0)
+		return;
+
+	record.len = len;
+	record.type = type;
+	record.reserved = 0;
+	record.stamp = latencyNow();
+
+	iov[0].iov_base = &record;
+	iov[0].iov_len = sizeof record;
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len = len;
+	iov[2].iov_base = (void *)padding;
+	iov[2].iov_len = CAPTURE_ALIGN(len) - len;
+
+	if (writev(fd, iov, 3) != (ssize_t)(sizeof record + CAPTURE_ALIGN(len))) {
+		// left open, another callback may be writing to it right now
+		if (captureFd.exchange(-1) == fd)
+			LOG4CPLUS_ERROR(logger, "Capture stopped: " << strerror(errno));
+	}
+}
+
+void captureKeyPress(const cec_keypress &key) {
+	capture_keypress_t payload;
+
+	memset(&payload, 0, sizeof payload);
+	payload.keycode = key.keycode;
+	payload.duration = key.duration;
+	captureWrite(CAPTURE_KEYPRESS, &payload, sizeof payload);
+}
+
+void captureCommand(const cec_command &command) {
+	capture_command_t payload;
+
+	memset(&payload, 0, sizeof payload);
+	payload.initiator = command.initiator;
+	payload.destination = command.destination;
+	payload.ack = command.ack;
+	payload.eom = command.eom;
+	payload.opcode = command.opcode;
+	payload.opcode_set = command.opcode_set;
+	payload.size = command.parameters.size;
+	payload.transmit_timeout = command.transmit_timeout;
+	memcpy(payload.parameters, command.parameters.data, sizeof payload.parameters);
+	captureWrite(CAPTURE_COMMAND, &payload, sizeof payload);
+}
+
+void captureAlert(const libcec_alert alert, const libcec_parameter &param) {
+	capture_alert_t payload;
+
+	payload.alert = alert;
+	payload.param_type = param.paramType;
+	captureWrite(CAPTURE_ALERT, &payload, sizeof payload);
+}
+
+void captureSourceActivated(const cec_logical_address address, uint8_t activated) {
+	capture_source_t payload;
+
+	memset(&payload, 0, sizeof payload);
+	payload.address = address;
+	payload.activated = activated;
+	captureWrite(CAPTURE_SOURCE_ACTIVATED, &payload, sizeof payload);
+}
+
+void captureConfigurationChanged(const libcec_configuration &configuration) {
+	capture_configuration_t payload;
+
+	memset(&payload, 0, sizeof payload);
+	for (unsigned i = 0; i < 16; i++) {
+		if (configuration.logicalAddresses.addresses[i])
+			payload.addresses |= 1 << i;
+	}
+	payload.physical_address = configuration.iPhysicalAddress;
+	payload.primary = configuration.logicalAddresses.primary;
+	captureWrite(CAPTURE_CONFIGURATION_CHANGED, &payload, sizeof payload);
+}
+
+ReplayBackend::ReplayBackend() : data(NULL), size(0), limit(0), speed(1), replayed(0), replayStart(0) {
+}
+
+ReplayBackend::~ReplayBackend() {
+	// the player reads the mapping
+	close();
+	if (data)
+		munmap((void *)data, size);
+}
+
+bool ReplayBackend::load(const string &path, double speed) {
+	struct stat st;
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "Unable to open %s: %s\n", path.c_str(), strerror(errno));
+		if (fd >= 0)
+			::close(fd);
+		return false;
+	}
+
+	if ((size_t)st.st_size < sizeof(capture_header_t)) {
+		fprintf(stderr, "%s is not a capture\n", path.c_str());
+		::close(fd);
+		return false;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	data = (const char *)map;
+	size = st.st_size;
+
+	if (memcmp(((const capture_header_t *)data)->magic, CAPTURE_MAGIC, sizeof(capture_header_t)) != 0) {
+		fprintf(stderr, "%s is not a capture\n", path.c_str());
+		return false;
+	}
+
+	// play() trusts every record before size
+	size_t offset = sizeof(capture_header_t);
+	unsigned count = 0;
+	while (offset < size) {
+		const capture_record_t *record = (const capture_record_t *)(data + offset);
+
+		if (size - offset < sizeof *record
+			|| size - offset - sizeof *record < CAPTURE_ALIGN(record->len)
+			|| (record->type < sizeof payloadLen / sizeof payloadLen[0] && record->len != payloadLen[record->type])) {
+			fprintf(stderr, "%s: Damaged record at offset %zu, replaying the %u before it\n", path.c_str(), offset, count);
+			break;
+		}
+
+		offset += sizeof *record + CAPTURE_ALIGN(record->len);
+		count++;
+	}
+
+	// the mapping keeps its length, see ~ReplayBackend()
+	limit = offset;
+	script = path;
+	position = sizeof(capture_header_t);
+	this->speed = speed;
+	return true;
+}
+
+void ReplayBackend::dispatch(const capture_record_t *record) {
+	ICECCallbacks *callbacks = config->callbacks;
+	void *param = config->callbackParam;
+	const void *payload = record + 1;
+
+	switch (record->type) {
+		case CAPTURE_KEYPRESS: {
+			const capture_keypress_t *p = (const capture_keypress_t *)payload;
+			cec_keypress key;
+
+			key.keycode = (cec_user_control_code)p->keycode;
+			key.duration = p->duration;
+			callbacks->CBCecKeyPress(param, key);
+			break;
+		}
+		case CAPTURE_COMMAND: {
+			const capture_command_t *p = (const capture_command_t *)payload;
+			cec_command command;
+
+			command.Clear();
+			command.initiator = (cec_logical_address)p->initiator;
+			command.destination = (cec_logical_address)p->destination;
+			command.ack = p->ack;
+			command.eom = p->eom;
+			command.opcode = (cec_opcode)p->opcode;
+			command.opcode_set = p->opcode_set;
+			command.transmit_timeout = p->transmit_timeout;
+			for (unsigned i = 0; i < p->size && i < sizeof p->parameters; i++)
+				command.parameters.PushBack(p->parameters[i]);
+			sendCommand(command);
+			break;
+		}
+		case CAPTURE_ALERT: {
+			const capture_alert_t *p = (const capture_alert_t *)payload;
+			libcec_parameter none;
+
+			none.paramType = (libcec_parameter_type)p->param_type;
+			none.paramData = NULL;
+			callbacks->CBCecAlert(param, (libcec_alert)p->alert, none);
+			break;
+		}
+		case CAPTURE_SOURCE_ACTIVATED: {
+			const capture_source_t *p = (const capture_source_t *)payload;
+
+			callbacks->CBCecSourceActivated(param, (cec_logical_address)p->address, p->activated);
+			break;
+		}
+		case CAPTURE_CONFIGURATION_CHANGED: {
+			const capture_configuration_t *p = (const capture_configuration_t *)payload;
+
+			config->logicalAddresses.primary = (cec_logical_address)p->primary;
+			for (unsigned i = 0; i < 16; i++)
+				config->logicalAddresses.addresses[i] = (p->addresses >> i) & 1;
+			config->iPhysicalAddress = p->physical_address;
+			if (callbacks->CBCecConfigurationChanged)
+				callbacks->CBCecConfigurationChanged(param, *config);
+			break;
+		}
+		default:
+			// written by a later ceclircd
+			break;
+	}
+}
+
+void ReplayBackend::play() {
+	// the clock restarts with the first record after open()
+	uint64_t base = 0;
+	uint64_t first = 0;
+
+	pthread_mutex_lock(&lock);
+
+	if (!replayStart)
+		replayStart = latencyNow();
+
+	while (playing) {
+		if (position >= limit) {
+			uint64_t us = latencyNow() - replayStart;
+			LOG4CPLUS_INFO(logger, "Replay of " << script << " done, " << replayed << " callbacks in "
+				<< us / 1000 << " ms, " << (us ? replayed * 1000000 / us : replayed) << " per second");
+			while (playing)
+				pthread_cond_wait(&wake, &lock);
+			break;
+		}
+
+		const capture_record_t *record = (const capture_record_t *)(data + position);
+
+		if (speed > 0) {
+			uint64_t now = latencyNow();
+
+			if (!base) {
+				base = now;
+				first = record->stamp;
+			} else if (record->stamp > first) {
+				uint64_t due = base + (uint64_t)((record->stamp - first) / speed);
+
+				// pause() takes an unsigned, a capture may have hours of silence
+				while (playing && due > now) {
+					pause(due - now < 1000000 ? due - now : 1000000);
+					now = latencyNow();
+				}
+				if (!playing)
+					break;
+			}
+		}
+
+		pthread_mutex_unlock(&lock);
+		dispatch(record);
+		pthread_mutex_lock(&lock);
+
+		// only once dispatched, a restart picks up the record it was waiting for
+		position += sizeof *record + CAPTURE_ALIGN(record->len);
+		replayed++;
+	}
+
+	pthread_mutex_unlock(&lock);
+}
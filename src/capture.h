@@ -0,0 +1,133 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include "fakecec.h"
+
+#include <stdint.h>
+
+#include <string>
+
+/*
+ * A capture is a header followed by records, each padded to 8 bytes so the
+ * file can be walked in place once mapped. Fields are fixed width and in
+ * host byte order, little endian on everything ceclircd runs on.
+ */
+#define CAPTURE_MAGIC		"CECCAP01"
+#define CAPTURE_ALIGN(len)	(((len) + 7) & ~(size_t)7)
+
+typedef enum {
+	CAPTURE_KEYPRESS = 1,
+	CAPTURE_COMMAND,
+	CAPTURE_ALERT,
+	CAPTURE_SOURCE_ACTIVATED,
+	CAPTURE_CONFIGURATION_CHANGED,
+} capture_type_t;
+
+typedef struct capture_header {
+	char magic[8];
+} capture_header_t;
+
+typedef struct capture_record {
+	uint32_t len;		// of the payload, without padding
+	uint16_t type;		// capture_type_t
+	uint16_t reserved;
+	uint64_t stamp;		// CLOCK_MONOTONIC, us
+} capture_record_t;
+
+typedef struct capture_keypress {
+	uint32_t duration;
+	uint8_t keycode;
+	uint8_t reserved[3];
+} capture_keypress_t;
+
+typedef struct capture_command {
+	uint8_t initiator;
+	uint8_t destination;
+	uint8_t ack;
+	uint8_t eom;
+	uint8_t opcode;
+	uint8_t opcode_set;
+	uint8_t size;
+	uint8_t reserved;
+	int32_t transmit_timeout;
+	uint8_t parameters[64];
+} capture_command_t;
+
+typedef struct capture_alert {
+	uint32_t alert;
+	uint32_t param_type;	// the parameter itself is a pointer, not kept
+} capture_alert_t;
+
+typedef struct capture_source {
+	uint8_t address;
+	uint8_t activated;
+	uint8_t reserved[2];
+} capture_source_t;
+
+typedef struct capture_configuration {
+	uint16_t addresses;	// bit per logical address
+	uint16_t physical_address;
+	uint8_t primary;
+	uint8_t reserved[3];
+} capture_configuration_t;
+
+/**
+ * Appends every libcec callback to path from now on, false on error
+ */
+bool captureOpen(const std::string &path);
+
+void captureKeyPress(const CEC::cec_keypress &key);
+void captureCommand(const CEC::cec_command &command);
+void captureAlert(const CEC::libcec_alert alert, const CEC::libcec_parameter &param);
+void captureSourceActivated(const CEC::cec_logical_address address, uint8_t activated);
+void captureConfigurationChanged(const CEC::libcec_configuration &configuration);
+
+/**
+ * Plays a capture back through the callbacks, as the fake adapter plays a
+ * script. speed 1 keeps the captured pauses, 2 halves them and 0 drops them
+ * to play as fast as possible. Logs the rate once done.
+ */
+class ReplayBackend : public FakeBackend {
+
+	private:
+
+		const char *data;
+		size_t size;
+		size_t limit;		// end of the last whole record
+		double speed;
+
+		uint64_t replayed;
+		uint64_t replayStart;
+
+		void play();
+		void dispatch(const capture_record_t *record);
+
+	public:
+
+		ReplayBackend();
+		virtual ~ReplayBackend();
+
+		/**
+		 * Maps the capture and checks every record
+		 */
+		bool load(const std::string &path, double speed);
+};
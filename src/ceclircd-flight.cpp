@@ -0,0 +1,179 @@
+/*
+    ceclircd-flight -- prints ceclircd flight recorder dumps
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * One line per record, oldest first, with the time before the dump:
+ *
+ *   -1234.567ms #10234 COMMAND 04:44 00 size 1 queued 0 clients 2
+ */
+
+#include "flight.h"
+#include "keycodes.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace CEC;
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::string;
+using std::vector;
+
+static const char *typeName(unsigned type) {
+	static const char *names[FLIGHT_TYPES] = {
+		"?", "KEYPRESS", "COMMAND", "ALERT", "SOURCE", "CONFIG", "KEY_EVENT", "POSTED", "SIGNAL", "RECOVER",
+	};
+
+	return type < FLIGHT_TYPES ? names[type] : "?";
+}
+
+static string keyName(unsigned keycode) {
+	if (cecKeys[keycode].name)
+		return cecKeys[keycode].name;
+
+	std::ostringstream out;
+	out << "0x" << std::hex << keycode;
+	return out.str();
+}
+
+static string signalName(unsigned sig) {
+	const char *name = strsignal(sig);
+	return name ? name : "?";
+}
+
+static void print(const flight_record_t &record, uint64_t dumped) {
+	static const char *events[] = { "press", "long", "release" };
+	static const char *actions[] = { "none", "ping", "reopen", "reinit" };
+	std::ostringstream details;
+
+	switch (record.type) {
+		case FLIGHT_KEYPRESS:
+			details << keyName(record.keycode) << " duration " << record.value << "ms";
+			break;
+		case FLIGHT_COMMAND:
+			details << std::hex << std::setfill('0') << std::setw(2) << (unsigned)record.addresses
+				<< ":" << std::setw(2) << (unsigned)record.opcode;
+			if (record.param)
+				details << ":" << std::setw(2) << record.value;
+			details << std::dec << " size " << record.param;
+			break;
+		case FLIGHT_ALERT:
+			details << "alert " << record.value;
+			break;
+		case FLIGHT_SOURCE:
+			details << "address " << (record.addresses >> 4) << (record.value ? " activated" : " deactivated");
+			break;
+		case FLIGHT_CONFIGURATION:
+			details << "primary " << (record.addresses >> 4);
+			break;
+		case FLIGHT_KEY_EVENT:
+			details << keyName(record.keycode) << " " << (record.value < 3 ? events[record.value] : "?") << " count " << record.param;
+			break;
+		case FLIGHT_POSTED:
+			details << keyName(record.keycode) << " repeat " << record.value << (record.param ? " dropped" : "");
+			break;
+		case FLIGHT_SIGNAL:
+			details << signalName(record.value);
+			break;
+		case FLIGHT_RECOVER:
+			details << (record.value < 4 ? actions[record.value] : "?") << " attempt " << record.param;
+			break;
+	}
+
+	cout << std::fixed << std::setprecision(3) << std::setw(12) << -((double)(dumped - record.stamp) / 1000) << "ms"
+		<< " #" << record.sequence - 1 << " " << typeName(record.type) << " " << details.str()
+		<< " queued " << record.queued << " clients " << record.clients << endl;
+}
+
+static bool bySequence(const flight_record_t &a, const flight_record_t &b) {
+	return a.sequence < b.sequence;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned last = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hn:")) != -1) {
+		switch (opt) {
+			case 'n':
+				last = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				cout << "Usage: " << argv[0] << " [options] <dump>" << endl << endl;
+				cout << "Prints a flight recorder dump written by ceclircd on SIGUSR1 or a crash." << endl << endl;
+				cout << "Options:" << endl;
+				cout << "\t-n <count> Only the last <count> records." << endl;
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		cerr << "Usage: " << argv[0] << " [options] <dump>" << endl;
+		return 1;
+	}
+
+	ifstream in(argv[optind], std::ios::binary);
+	if (!in) {
+		cerr << "Unable to open " << argv[optind] << ": " << strerror(errno) << endl;
+		return 1;
+	}
+
+	flight_header_t header;
+	if (!in.read((char *)&header, sizeof header) || memcmp(header.magic, FLIGHT_MAGIC, sizeof header.magic) != 0
+			|| header.recordSize != sizeof(flight_record_t) || header.records == 0 || header.records > (1u << 24)) {
+		cerr << argv[optind] << " is not a flight recorder dump" << endl;
+		return 1;
+	}
+
+	vector<flight_record_t> records(header.records);
+	if (!in.read((char *)&records[0], records.size() * sizeof records[0])) {
+		cerr << argv[optind] << " is truncated" << endl;
+		return 1;
+	}
+
+	// slots never written, or overwritten while the dump was written
+	vector<flight_record_t> live;
+	for (size_t i = 0; i < records.size(); i++) {
+		const flight_record_t &record = records[i];
+		if (record.sequence && record.sequence <= header.next && record.sequence + header.records > header.next
+				&& record.stamp <= header.stamp)
+			live.push_back(record);
+	}
+	std::sort(live.begin(), live.end(), bySequence);
+
+	size_t first = last && live.size() > last ? live.size() - last : 0;
+	cout << "# " << header.next << " records, " << live.size() << " kept, dumped on " << signalName(header.reason) << endl;
+	for (size_t i = first; i < live.size(); i++)
+		print(live[i], header.stamp);
+
+	return 0;
+}
@@ -0,0 +1,283 @@
+/*
+    ceclircd-keymap -- compiles ceclircd translation tables
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * Text format, one CEC key per line:
+ *
+ *   # comment
+ *   <cec key> <lirc name> [<lirc name>]
+ *   long <cec key> <lirc name> [<lirc name>]
+ *
+ * <cec key> is a user control code name as listed in keycodes.h, e.g.
+ * SELECT or RIGHT_UP, or its number, e.g. 0x05. Keys that are not listed
+ * are not sent at all.
+ *
+ * A long line gives the names sent instead when the key is held past the
+ * daemon's long press threshold, e.g. "long EXIT KEY_HOME". Such a key is
+ * no longer repeated while held.
+ */
+
+#include "keymap.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace CEC;
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::istringstream;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+struct Entry {
+	uint32_t keycode;
+	vector<string> names;
+};
+
+static bool parseKeycode(const string &token, uint32_t &keycode) {
+	string name = token;
+
+	if (name.compare(0, 22, "CEC_USER_CONTROL_CODE_") == 0)
+		name.erase(0, 22);
+
+	for (unsigned i = 0; i < 256; i++) {
+		if (cecKeys[i].name && name == cecKeys[i].name && i <= CEC_USER_CONTROL_CODE_MAX) {
+			keycode = i;
+			return true;
+		}
+	}
+
+	char *end;
+	unsigned long value = strtoul(token.c_str(), &end, 0);
+	if (*end || end == token.c_str() || value > CEC_USER_CONTROL_CODE_MAX)
+		return false;
+
+	keycode = value;
+	return true;
+}
+
+static bool parse(std::istream &in, const string &file, vector<Entry> &entries) {
+	string line;
+	bool seen[2][CEC_USER_CONTROL_CODE_MAX + 1] = { { false } };
+
+	for (int lineno = 1; getline(in, line); lineno++) {
+		size_t comment = line.find('#');
+		if (comment != string::npos)
+			line.erase(comment);
+
+		istringstream tokens(line);
+		string token;
+		Entry entry;
+
+		if (!(tokens >> token))
+			continue;
+
+		bool isLong = token == "long";
+		if (isLong && !(tokens >> token)) {
+			cerr << file << ":" << lineno << ": no CEC key after long" << endl;
+			return false;
+		}
+
+		if (!parseKeycode(token, entry.keycode)) {
+			cerr << file << ":" << lineno << ": unknown CEC key " << token << endl;
+			return false;
+		}
+
+		if (seen[isLong][entry.keycode]) {
+			cerr << file << ":" << lineno << ": " << token << " is mapped twice" << endl;
+			return false;
+		}
+		seen[isLong][entry.keycode] = true;
+
+		if (isLong)
+			entry.keycode |= KEYMAP_LONG;
+
+		while (tokens >> token) {
+			if (entry.names.size() == LIRC_KEY_LINES) {
+				cerr << file << ":" << lineno << ": at most " << LIRC_KEY_LINES << " LIRC names per key" << endl;
+				return false;
+			}
+			if (token.size() > LIRC_LINE_MAX / 2) {
+				cerr << file << ":" << lineno << ": " << token << " is too long" << endl;
+				return false;
+			}
+			entry.names.push_back(token);
+		}
+
+		if (entry.names.empty()) {
+			cerr << file << ":" << lineno << ": no LIRC name for " << token << endl;
+			return false;
+		}
+
+		entries.push_back(entry);
+	}
+
+	return true;
+}
+
+/*
+ * Finds table size and seed so that no two keycodes share a slot
+ */
+static bool findSeed(const vector<Entry> &entries, uint32_t &bits, uint32_t &seed) {
+	for (bits = 1; ((size_t)1 << bits) < entries.size(); bits++)
+		;
+
+	for (; bits <= KEYMAP_MAX_BITS; bits++) {
+		vector<bool> used((size_t)1 << bits);
+
+		for (seed = 0; seed < 100000; seed++) {
+			size_t i;
+
+			used.assign(used.size(), false);
+			for (i = 0; i < entries.size(); i++) {
+				uint32_t slot = keymap_hash(entries[i].keycode, seed, bits);
+				if (used[slot])
+					break;
+				used[slot] = true;
+			}
+
+			if (i == entries.size())
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static bool compile(const vector<Entry> &entries, const string &file) {
+	keymap_header header;
+	uint32_t bits, seed;
+
+	if (!findSeed(entries, bits, seed)) {
+		cerr << "Unable to find a perfect hash for " << entries.size() << " keys" << endl;
+		return false;
+	}
+
+	vector<keymap_slot> slots((size_t)1 << bits);
+	string strings;
+
+	for (size_t i = 0; i < slots.size(); i++) {
+		memset(&slots[i], 0, sizeof slots[i]);
+		slots[i].key = KEYMAP_EMPTY;
+	}
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		keymap_slot &slot = slots[keymap_hash(entries[i].keycode, seed, bits)];
+
+		slot.key = entries[i].keycode;
+		slot.count = entries[i].names.size();
+		for (size_t j = 0; j < entries[i].names.size(); j++) {
+			// names are shared between keys, e.g. KEY_UP
+			size_t offset = strings.find(entries[i].names[j] + '\0');
+			if (offset == string::npos) {
+				offset = strings.size();
+				strings.append(entries[i].names[j]);
+				strings.push_back('\0');
+			}
+			slot.names[j] = offset;
+		}
+	}
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, KEYMAP_MAGIC, sizeof header.magic);
+	header.seed = seed;
+	header.bits = bits;
+	header.count = entries.size();
+	header.strings = sizeof header + slots.size() * sizeof(keymap_slot);
+	header.length = header.strings + strings.size();
+
+	// write next to the target and rename, so a watching daemon never sees half a file
+	string tmp = file + ".tmp";
+	ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+
+	out.write((const char *)&header, sizeof header);
+	out.write((const char *)&slots[0], slots.size() * sizeof(keymap_slot));
+	out.write(strings.data(), strings.size());
+	out.close();
+
+	if (!out || rename(tmp.c_str(), file.c_str()) < 0) {
+		cerr << "Unable to write " << file << ": " << strerror(errno) << endl;
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Prints the built-in table in the text format, as a starting point
+ */
+static void dump() {
+	cout << "# ceclircd built-in translation table" << endl;
+	for (unsigned keycode = 0; keycode <= CEC_USER_CONTROL_CODE_MAX; keycode++) {
+		if (!cecKeys[keycode].count)
+			continue;
+		cout << cecKeys[keycode].name;
+		for (unsigned i = 0; i < cecKeys[keycode].count; i++)
+			cout << " " << cecKeys[keycode].lirc[i];
+		cout << endl;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hd")) != -1) {
+		switch (opt) {
+			case 'd':
+				dump();
+				return 0;
+			case 'h':
+			default:
+				cout << "Usage: " << argv[0] << " [options] <keymap> <output>" << endl << endl;
+				cout << "Compiles a text translation table for ceclircd -t." << endl << endl;
+				cout << "Options:" << endl;
+				cout << "\t-d Print the built-in translation table." << endl;
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (argc - optind != 2) {
+		cerr << "Usage: " << argv[0] << " [options] <keymap> <output>" << endl;
+		return 1;
+	}
+
+	ifstream in(argv[optind]);
+	if (!in) {
+		cerr << "Unable to open " << argv[optind] << ": " << strerror(errno) << endl;
+		return 1;
+	}
+
+	vector<Entry> entries;
+	if (!parse(in, argv[optind], entries))
+		return 1;
+
+	if (!compile(entries, argv[optind + 1]))
+		return 1;
+
+	cout << "Compiled " << entries.size() << " keys into " << argv[optind + 1] << endl;
+	return 0;
+}
@@ -0,0 +1,236 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * Captures: callbacks written with capture*() come back from ReplayBackend
+ * as they went in, also across a reopen and from a file cut off mid-record
+ */
+
+#include "check.h"
+#include "capture.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/configurator.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::ostringstream;
+using std::string;
+using std::vector;
+
+static string dir;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<string> replayed;
+
+static void add(const ostringstream &line) {
+	pthread_mutex_lock(&lock);
+	replayed.push_back(line.str());
+	pthread_mutex_unlock(&lock);
+}
+
+static int onKeyPress(void *, const cec_keypress key) {
+	ostringstream line;
+	line << "key " << key.keycode << " " << key.duration;
+	add(line);
+	return 1;
+}
+
+static int onCommand(void *, const cec_command command) {
+	ostringstream line;
+	line << "command " << command.initiator << " " << command.destination << " " << command.opcode
+		<< " " << (int)command.opcode_set << " " << command.transmit_timeout << " " << (int)command.parameters.size;
+	for (unsigned i = 0; i < command.parameters.size; i++)
+		line << " " << (int)command.parameters[i];
+	add(line);
+	return 1;
+}
+
+static int onAlert(void *, const libcec_alert alert, const libcec_parameter param) {
+	ostringstream line;
+	line << "alert " << alert << " " << param.paramType;
+	add(line);
+	return 1;
+}
+
+static void onSourceActivated(void *, const cec_logical_address address, const uint8_t activated) {
+	ostringstream line;
+	line << "source " << address << " " << (int)activated;
+	add(line);
+}
+
+static int onConfigurationChanged(void *, const libcec_configuration configuration) {
+	ostringstream line;
+	line << "configuration " << configuration.logicalAddresses.primary << " " << configuration.iPhysicalAddress;
+	for (unsigned i = 0; i < 16; i++)
+		line << (int)configuration.logicalAddresses.addresses[i];
+	add(line);
+	return 1;
+}
+
+static string line(const char *what, int a, int b) {
+	ostringstream line;
+	line << what << " " << a << " " << b;
+	return line.str();
+}
+
+/*
+ * Plays path as fast as possible and returns what the callbacks got
+ */
+static vector<string> replay(const string &path, size_t expected) {
+	ReplayBackend backend;
+	libcec_configuration config;
+	ICECCallbacks callbacks;
+
+	config.Clear();
+	callbacks.Clear();
+	callbacks.CBCecKeyPress = &onKeyPress;
+	callbacks.CBCecCommand = &onCommand;
+	callbacks.CBCecAlert = &onAlert;
+	callbacks.CBCecSourceActivated = &onSourceActivated;
+	callbacks.CBCecConfigurationChanged = &onConfigurationChanged;
+	config.callbacks = &callbacks;
+	config.callbackParam = NULL;
+
+	replayed.clear();
+	if (!backend.load(path, 0) || !backend.init(config) || !backend.open("check"))
+		return replayed;
+
+	for (int i = 0; i < 200; i++) {
+		pthread_mutex_lock(&lock);
+		size_t count = replayed.size();
+		pthread_mutex_unlock(&lock);
+		if (count >= expected)
+			break;
+		usleep(5000);
+	}
+	// nothing more than expected either
+	usleep(20000);
+	backend.close();
+
+	return replayed;
+}
+
+static void roundTrip() {
+	string path = dir + "/capture";
+	vector<string> expected;
+
+	CHECK(captureOpen(path));
+
+	cec_keypress key;
+	key.keycode = CEC_USER_CONTROL_CODE_SELECT;
+	key.duration = 0;
+	captureKeyPress(key);
+	key.duration = 480;
+	captureKeyPress(key);
+	expected.push_back(line("key", CEC_USER_CONTROL_CODE_SELECT, 0));
+	expected.push_back(line("key", CEC_USER_CONTROL_CODE_SELECT, 480));
+
+	cec_command command;
+	command.Clear();
+	command.initiator = CECDEVICE_TV;
+	command.destination = CECDEVICE_AUDIOSYSTEM;
+	command.opcode = CEC_OPCODE_USER_CONTROL_PRESSED;
+	command.opcode_set = 1;
+	command.transmit_timeout = 1000;
+	command.parameters.PushBack(0x44);
+	command.parameters.PushBack(0x01);
+	captureCommand(command);
+	expected.push_back(line("command", CECDEVICE_TV, CECDEVICE_AUDIOSYSTEM) + " 68 1 1000 2 68 1");
+
+	libcec_parameter param;
+	param.paramType = CEC_PARAMETER_TYPE_STRING;
+	param.paramData = NULL;
+	captureAlert(CEC_ALERT_CONNECTION_LOST, param);
+	expected.push_back(line("alert", CEC_ALERT_CONNECTION_LOST, CEC_PARAMETER_TYPE_STRING));
+
+	captureSourceActivated(CECDEVICE_AUDIOSYSTEM, 1);
+	expected.push_back(line("source", CECDEVICE_AUDIOSYSTEM, 1));
+
+	libcec_configuration configuration;
+	configuration.Clear();
+	memset(&configuration.logicalAddresses, 0, sizeof configuration.logicalAddresses);
+	configuration.logicalAddresses.primary = CECDEVICE_AUDIOSYSTEM;
+	configuration.logicalAddresses.addresses[CECDEVICE_AUDIOSYSTEM] = 1;
+	configuration.iPhysicalAddress = 0x1000;
+	captureConfigurationChanged(configuration);
+	expected.push_back(line("configuration", CECDEVICE_AUDIOSYSTEM, 0x1000) + "0000010000000000");
+
+	CHECK(replay(path, expected.size()) == expected);
+
+	// reopening appends to what is there
+	CHECK(captureOpen(path));
+	key.keycode = CEC_USER_CONTROL_CODE_EXIT;
+	key.duration = 0;
+	captureKeyPress(key);
+	expected.push_back(line("key", CEC_USER_CONTROL_CODE_EXIT, 0));
+
+	CHECK(replay(path, expected.size()) == expected);
+
+	// a capture cut off mid-record replays every whole record before it,
+	// one with another header nothing
+	string cut = dir + "/cut";
+	string other = dir + "/other";
+	CHECK_EQ(system(("head -c -5 " + path + " > " + cut).c_str()), 0);
+	CHECK_EQ(system(("(printf CECCAP99; tail -c +9 " + path + ") > " + other).c_str()), 0);
+	expected.pop_back();
+
+	int saved = dup(2);
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, 2);
+	vector<string> got = replay(cut, expected.size());
+	ReplayBackend broken;
+	bool loaded = broken.load(other, 0);
+	dup2(saved, 2);
+	close(saved);
+	close(null);
+
+	CHECK(got == expected);
+	CHECK(!loaded);
+}
+
+int main() {
+	char tmpl[] = "/tmp/check-capture.XXXXXX";
+
+	BasicConfigurator config;
+	config.configure();
+	Logger::getRoot().setLogLevel(FATAL_LOG_LEVEL);
+
+	if (!mkdtemp(tmpl)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	dir = tmpl;
+
+	roundTrip();
+
+	CHECK_EQ(system(("rm -r " + dir).c_str()), 0);
+	return checkResult("check-capture");
+}
@@ -0,0 +1,69 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * Deduper: the same key from the same device within the window is a
+ * duplicate, and only accepted keys open a window
+ */
+
+#include "check.h"
+#include "dedupe.h"
+
+#include <unistd.h>
+
+using namespace CEC;
+
+#define WINDOW	200	// ms, short, sleeps are measured in it
+
+int main() {
+	Deduper deduper;
+	deduper.window = WINDOW;
+
+	CHECK(!deduper.duplicate(CEC_USER_CONTROL_CODE_PLAY, CECDEVICE_TV));
+	CHECK(deduper.duplicate(CEC_USER_CONTROL_CODE_PLAY, CECDEVICE_TV));
+
+	// another device or another key is not a copy
+	CHECK(!deduper.duplicate(CEC_USER_CONTROL_CODE_PLAY, CECDEVICE_AUDIOSYSTEM));
+	CHECK(!deduper.duplicate(CEC_USER_CONTROL_CODE_PAUSE, CECDEVICE_TV));
+	CHECK(deduper.duplicate(CEC_USER_CONTROL_CODE_PAUSE, CECDEVICE_TV));
+
+	// copies inside the window don't stretch it
+	usleep(WINDOW * 600);
+	CHECK(deduper.duplicate(CEC_USER_CONTROL_CODE_PLAY, CECDEVICE_TV));
+	usleep(WINDOW * 600);
+	CHECK(!deduper.duplicate(CEC_USER_CONTROL_CODE_PLAY, CECDEVICE_TV));
+
+	// ... but the key accepted just now opened a new one
+	CHECK(deduper.duplicate(CEC_USER_CONTROL_CODE_PLAY, CECDEVICE_TV));
+
+	// only the last DEDUPE_SLOTS keys are remembered
+	usleep(WINDOW * 1200);
+	for (unsigned i = 0; i <= DEDUPE_SLOTS; i++)
+		CHECK(!deduper.duplicate((cec_user_control_code)(CEC_USER_CONTROL_CODE_NUMBER0 + i), CECDEVICE_TV));
+	CHECK(!deduper.duplicate(CEC_USER_CONTROL_CODE_NUMBER0, CECDEVICE_TV));
+	CHECK(deduper.duplicate((cec_user_control_code)(CEC_USER_CONTROL_CODE_NUMBER0 + DEDUPE_SLOTS), CECDEVICE_TV));
+
+	// a window of 0 keeps every key
+	deduper.window = 0;
+	CHECK(!deduper.duplicate(CEC_USER_CONTROL_CODE_STOP, CECDEVICE_TV));
+	CHECK(!deduper.duplicate(CEC_USER_CONTROL_CODE_STOP, CECDEVICE_TV));
+
+	return checkResult("check-dedupe");
+}
@@ -0,0 +1,219 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * Keymap: a text table compiled by ceclircd-keymap loads back into the
+ * same LIRC lines, broken files are refused, and readers never see a
+ * table that a concurrent reload freed
+ */
+
+#include "check.h"
+#include "keymap.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <new>
+#include <string>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/configurator.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::ofstream;
+using std::string;
+
+#define READERS		3
+#define RELOADS		2000
+
+static string dir;
+static std::atomic<bool> reloading;
+
+/*
+ * Freed memory is overwritten so a reader holding a freed table sees garbage
+ * instead of the old contents
+ */
+void operator delete(void *p) throw() {
+	if (p)
+		memset(p, 0xa5, malloc_usable_size(p));
+	free(p);
+}
+
+static string compile(const string &name, const string &text) {
+	string source = dir + "/" + name + ".txt";
+	string compiled = dir + "/" + name + ".map";
+	ofstream(source.c_str()) << text;
+
+	string command = "./ceclircd-keymap " + source + " " + compiled + " > /dev/null";
+	CHECK_EQ(system(command.c_str()), 0);
+	return compiled;
+}
+
+static string line(const LircKey &key, unsigned i) {
+	return string(key.lines[i].text, key.lines[i].len);
+}
+
+static void roundTrip() {
+	Keymap keymap;
+	Keymap builtin;
+
+	// the built-in table as printed by ceclircd-keymap -d comes back unchanged
+	string dump = dir + "/builtin.txt";
+	CHECK_EQ(system(("./ceclircd-keymap -d > " + dump).c_str()), 0);
+	CHECK_EQ(system(("./ceclircd-keymap " + dump + " " + dir + "/builtin.map > /dev/null").c_str()), 0);
+	CHECK(keymap.load(dir + "/builtin.map"));
+	{
+		Keymap::Reader loaded(keymap);
+		Keymap::Reader original(builtin);
+		for (unsigned keycode = 0; keycode <= CEC_USER_CONTROL_CODE_MAX; keycode++) {
+			CHECK_EQ(loaded[keycode].count, original[keycode].count);
+			for (unsigned i = 0; i < loaded[keycode].count && i < original[keycode].count; i++)
+				CHECK(line(loaded[keycode], i) == line(original[keycode], i));
+		}
+	}
+
+	// names, numbers, two lines per key and long presses
+	CHECK(keymap.load(compile("custom",
+		"# comment\n"
+		"SELECT KEY_ENTER\n"
+		"0x01 KEY_NORTH   # UP\n"
+		"F1_BLUE KEY_BLUE KEY_F1\n"
+		"long EXIT KEY_HOME\n")));
+	{
+		Keymap::Reader reader(keymap);
+		CHECK_EQ(reader[CEC_USER_CONTROL_CODE_SELECT].count, 1);
+		CHECK(line(reader[CEC_USER_CONTROL_CODE_SELECT], 0) == "0 00 KEY_ENTER RPICEC\n");
+		CHECK_EQ(reader[CEC_USER_CONTROL_CODE_SELECT].lines[0].repeatPos, 2);
+		CHECK(line(reader[CEC_USER_CONTROL_CODE_UP], 0) == "1 00 KEY_NORTH RPICEC\n");
+		CHECK_EQ(reader[CEC_USER_CONTROL_CODE_F1_BLUE].count, 2);
+		CHECK(line(reader[CEC_USER_CONTROL_CODE_F1_BLUE], 0) == "71 00 KEY_BLUE RPICEC\n");
+		CHECK(line(reader[CEC_USER_CONTROL_CODE_F1_BLUE], 1) == "71 00 KEY_F1 RPICEC\n");
+		CHECK_EQ(reader.longPress(CEC_USER_CONTROL_CODE_EXIT).count, 1);
+		CHECK(line(reader.longPress(CEC_USER_CONTROL_CODE_EXIT), 0) == "d 00 KEY_HOME RPICEC\n");
+
+		// unlisted keys are not sent at all, and there is no long EXIT without a long line
+		CHECK_EQ(reader[CEC_USER_CONTROL_CODE_DOWN].count, 0);
+		CHECK_EQ(reader[CEC_USER_CONTROL_CODE_EXIT].count, 0);
+		CHECK_EQ(reader.longPress(CEC_USER_CONTROL_CODE_SELECT).count, 0);
+	}
+
+	// broken files are refused and leave the live table alone
+	ofstream((dir + "/short.map").c_str()) << "CECKMAP1";
+	CHECK(!keymap.load(dir + "/short.map"));
+	CHECK(!keymap.load(dir + "/missing.map"));
+	static const uint32_t badBits[] = {0, KEYMAP_MAX_BITS + 1, 64, 200};
+	for (unsigned i = 0; i < sizeof badBits / sizeof *badBits; i++) {
+		keymap_header header;
+		memset(&header, 0, sizeof header);
+		memcpy(header.magic, KEYMAP_MAGIC, sizeof header.magic);
+		header.bits = badBits[i];
+		header.strings = header.length = sizeof header;
+		ofstream((dir + "/bits.map").c_str()).write((const char *)&header, sizeof header);
+		CHECK(!keymap.load(dir + "/bits.map"));
+	}
+	{
+		Keymap::Reader reader(keymap);
+		CHECK(line(reader[CEC_USER_CONTROL_CODE_SELECT], 0) == "0 00 KEY_ENTER RPICEC\n");
+	}
+
+	// the compiler rejects what the daemon could not send
+	CHECK(system(("echo 'NO_SUCH_KEY KEY_A' > " + dir + "/bad.txt").c_str()) == 0);
+	CHECK(system(("./ceclircd-keymap " + dir + "/bad.txt " + dir + "/bad.map 2> /dev/null").c_str()) != 0);
+}
+
+static void *read(void *arg) {
+	Keymap & keymap = *(Keymap *)arg;
+
+	while (reloading) {
+		Keymap::Reader reader(keymap);
+		string first = line(reader[CEC_USER_CONTROL_CODE_SELECT], 0);
+
+		CHECK(first == "0 00 KEY_A RPICEC\n" || first == "0 00 KEY_BB RPICEC\n");
+		for (int i = 0; i < 100; i++)
+			sched_yield();
+		CHECK(line(reader[CEC_USER_CONTROL_CODE_SELECT], 0) == first);
+	}
+	return NULL;
+}
+
+static void reload() {
+	string a = compile("a", "SELECT KEY_A\n");
+	string b = compile("b", "SELECT KEY_BB\n");
+	pthread_t threads[READERS];
+	Keymap keymap;
+
+	CHECK(keymap.load(a));
+	reloading = true;
+	for (int i = 0; i < READERS; i++)
+		pthread_create(&threads[i], NULL, read, &keymap);
+
+	for (int i = 0; i < RELOADS && checkFailures == 0; i++)
+		CHECK(keymap.load(i & 1 ? a : b));
+
+	reloading = false;
+	for (int i = 0; i < READERS; i++)
+		pthread_join(threads[i], NULL);
+}
+
+static void relative() {
+	string map = compile("relative", "SELECT KEY_R\n");
+	char *cwd = getcwd(NULL, 0);
+	Keymap keymap;
+
+	// loaded relative to where it was started, reloaded after daemon() moved to /
+	CHECK_EQ(chdir(dir.c_str()), 0);
+	CHECK(keymap.load("relative.map"));
+	CHECK_EQ(chdir("/"), 0);
+	CHECK(keymap.reload());
+	{
+		Keymap::Reader reader(keymap);
+		CHECK(line(reader[CEC_USER_CONTROL_CODE_SELECT], 0) == "0 00 KEY_R RPICEC\n");
+	}
+
+	CHECK_EQ(chdir(cwd), 0);
+	free(cwd);
+}
+
+int main() {
+	char tmpl[] = "/tmp/check-keymap.XXXXXX";
+
+	BasicConfigurator config;
+	config.configure();
+	Logger::getRoot().setLogLevel(FATAL_LOG_LEVEL);
+
+	if (!mkdtemp(tmpl)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	dir = tmpl;
+
+	roundTrip();
+	reload();
+	relative();
+
+	CHECK_EQ(system(("rm -r " + dir).c_str()), 0);
+	return checkResult("check-keymap");
+}
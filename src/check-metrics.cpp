@@ -0,0 +1,59 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * Metrics: what a thread counted survives its exit, and a counter read
+ * while threads exit never goes down
+ */
+
+#include "check.h"
+#include "metrics.h"
+
+#include <pthread.h>
+
+#define THREADS		200	// more than there are shards, so they are reused
+#define PER_THREAD	1000
+
+static void *count(void *) {
+	for (unsigned i = 0; i < PER_THREAD; i++)
+		metricsAdd(METRIC_SEQUENCES);
+	return NULL;
+}
+
+int main() {
+	uint64_t last = 0;
+
+	for (unsigned i = 0; i < THREADS; i++) {
+		pthread_t thread;
+		pthread_create(&thread, NULL, count, NULL);
+
+		// read while the thread counts and folds its shard on exit
+		for (bool done = false; !done; ) {
+			done = pthread_tryjoin_np(thread, NULL) == 0;
+			uint64_t value = metricsValue(METRIC_SEQUENCES);
+			CHECK(value >= last);
+			last = value;
+		}
+	}
+
+	CHECK_EQ(metricsValue(METRIC_SEQUENCES), (uint64_t)THREADS * PER_THREAD);
+
+	return checkResult("check-metrics");
+}
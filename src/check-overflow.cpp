@@ -0,0 +1,183 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * lirc overflow policies: a client that stops reading while thousands of
+ * numbered lines go out, what it finds once it reads again
+ */
+
+#include "check.h"
+#include "lirc.h"
+
+#include <poll.h>
+
+#include <string>
+#include <vector>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/configurator.h>
+
+using namespace log4cplus;
+
+using std::string;
+using std::vector;
+
+#define LINES		4000	// of LINE_LEN bytes, far more than a socket buffer holds
+#define LINE_LEN	200
+#define QUEUE_LEN	4
+
+static string dir;
+
+struct Received {
+	vector<unsigned> lines;
+	bool closed;
+};
+
+/*
+ * Sends LINES lines to one stalled client, those that repeat() says are
+ * repeats flagged as such, then reads what arrives until it stops
+ */
+static Received run(overflow_policy_t overflow, bool (*repeat)(unsigned)) {
+	Received received;
+	lirc out;
+
+	received.closed = false;
+	out.device = dir + "/lircd";
+	out.queue_len = QUEUE_LEN;
+	out.overflow = overflow;
+	CHECK(out.Open());
+
+	struct sockaddr_un sa = {0};
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, out.device.c_str(), sizeof sa.sun_path - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	CHECK(connect(fd, (struct sockaddr *)&sa, sizeof sa) == 0);
+	usleep(100000);
+
+	for (unsigned i = 0; i < LINES; i++) {
+		char line[LINE_LEN + 1];
+		snprintf(line, sizeof line, "%05u %0*d\n", i, LINE_LEN - 7, 0);
+
+		while (!out.post(line, LINE_LEN, repeat && repeat(i)))
+			usleep(1000);
+	}
+	usleep(300000);
+
+	string buf;
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	while (poll(&pfd, 1, 300) > 0) {
+		char chunk[65536];
+		ssize_t len = read(fd, chunk, sizeof chunk);
+		if (len <= 0) {
+			received.closed = len == 0;
+			break;
+		}
+		buf.append(chunk, len);
+	}
+	close(fd);
+
+	// a line cut off by a disconnect is left out
+	for (size_t pos = 0; pos + LINE_LEN <= buf.size(); pos += LINE_LEN) {
+		CHECK(buf[pos + LINE_LEN - 1] == '\n');
+		received.lines.push_back(strtoul(buf.c_str() + pos, NULL, 10));
+	}
+
+	for (size_t i = 1; i < received.lines.size(); i++)
+		CHECK(received.lines[i] > received.lines[i - 1]);
+
+	return received;
+}
+
+// the first line, one long after the client stalled and the last two are
+// presses, the others repeats
+static bool mostlyRepeats(unsigned i) {
+	return i != 0 && i != LINES / 2 && i < LINES - 2;
+}
+
+static bool noRepeats(unsigned) {
+	return false;
+}
+
+static void dropOldest() {
+	Received r = run(OVERFLOW_DROP_OLDEST, NULL);
+
+	// the client stays, gets what the kernel buffered and then the newest lines
+	CHECK(!r.closed);
+	CHECK(r.lines.size() > QUEUE_LEN && r.lines.size() < LINES);
+	if (r.lines.size() > QUEUE_LEN) {
+		CHECK_EQ(r.lines.front(), 0);
+		for (unsigned i = 0; i < QUEUE_LEN; i++)
+			CHECK_EQ(r.lines[r.lines.size() - QUEUE_LEN + i], LINES - QUEUE_LEN + i);
+	}
+}
+
+static void dropRepeats() {
+	Received r = run(OVERFLOW_DROP_REPEATS, mostlyRepeats);
+	vector<unsigned> presses;
+
+	// repeats make room, every press arrives, even one that dropping the
+	// oldest would have lost
+	CHECK(!r.closed);
+	CHECK(r.lines.size() < LINES);
+	for (size_t i = 0; i < r.lines.size(); i++) {
+		if (!mostlyRepeats(r.lines[i]))
+			presses.push_back(r.lines[i]);
+	}
+	CHECK_EQ(presses.size(), 4);
+	CHECK(!r.lines.empty() && r.lines.back() == LINES - 1);
+
+	// with nothing but presses queued there is no room to make
+	r = run(OVERFLOW_DROP_REPEATS, noRepeats);
+	CHECK(r.closed);
+	CHECK(r.lines.size() < LINES);
+}
+
+static void disconnect() {
+	Received r = run(OVERFLOW_DISCONNECT, NULL);
+
+	// whatever arrived is complete up to the disconnect
+	CHECK(r.closed);
+	CHECK(!r.lines.empty() && r.lines.size() < LINES);
+	for (size_t i = 0; i < r.lines.size(); i++)
+		CHECK_EQ(r.lines[i], i);
+}
+
+int main() {
+	char tmpl[] = "/tmp/check-overflow.XXXXXX";
+
+	BasicConfigurator config;
+	config.configure();
+	Logger::getRoot().setLogLevel(FATAL_LOG_LEVEL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!mkdtemp(tmpl)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	dir = tmpl;
+
+	dropOldest();
+	dropRepeats();
+	disconnect();
+
+	CHECK_EQ(system(("rm -r " + dir).c_str()), 0);
+	return checkResult("check-overflow");
+}
@@ -0,0 +1,119 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * mpsc_queue: FIFO order, refusing pushes when full, and every element of
+ * several producers arriving once, in each producer's order
+ */
+
+#include "check.h"
+#include "eventqueue.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define PRODUCERS	4
+#define PER_PRODUCER	200000
+
+struct item {
+	unsigned producer;
+	unsigned value;
+};
+
+static mpsc_queue<item, 64> shared;
+
+static void *produce(void *arg) {
+	item it = { (unsigned)(size_t)arg, 0 };
+
+	for (it.value = 0; it.value < PER_PRODUCER; it.value++)
+		// let the consumer in, there may be one CPU
+		while (!shared.push(it))
+			sched_yield();
+	return NULL;
+}
+
+static void single() {
+	mpsc_queue<unsigned, 8> queue;
+	unsigned value;
+	uint64_t seq = 0;
+
+	CHECK(!queue.pop(value));
+	CHECK_EQ(queue.size(), 0);
+
+	for (unsigned i = 0; i < 8; i++)
+		CHECK(queue.push(i));
+	CHECK(!queue.push(8));
+	CHECK_EQ(queue.size(), 8);
+
+	for (unsigned i = 0; i < 8; i++) {
+		CHECK(queue.pop(value, &seq));
+		CHECK_EQ(value, i);
+		CHECK_EQ(seq, i);
+	}
+	CHECK(!queue.pop(value));
+
+	// wraps around, sequence numbers keep counting
+	for (unsigned i = 0; i < 20; i++) {
+		CHECK(queue.push(100 + i));
+		CHECK(queue.pop(value, &seq));
+		CHECK_EQ(value, 100 + i);
+		CHECK_EQ(seq, 8 + i);
+	}
+}
+
+static void concurrent() {
+	pthread_t threads[PRODUCERS];
+	unsigned next[PRODUCERS] = { 0 };
+	uint64_t expected = 0;
+	uint64_t seq;
+	item it;
+
+	for (size_t i = 0; i < PRODUCERS; i++)
+		pthread_create(&threads[i], NULL, produce, (void *)i);
+
+	for (unsigned received = 0; received < PRODUCERS * PER_PRODUCER; ) {
+		if (!shared.pop(it, &seq)) {
+			sched_yield();
+			continue;
+		}
+
+		CHECK_EQ(seq, expected);
+		CHECK(it.producer < PRODUCERS);
+		if (it.producer < PRODUCERS) {
+			CHECK_EQ(it.value, next[it.producer]);
+			next[it.producer] = it.value + 1;
+		}
+		expected = seq + 1;
+		received++;
+	}
+
+	for (size_t i = 0; i < PRODUCERS; i++)
+		pthread_join(threads[i], NULL);
+
+	CHECK(!shared.pop(it));
+	for (size_t i = 0; i < PRODUCERS; i++)
+		CHECK_EQ(next[i], PER_PRODUCER);
+}
+
+int main() {
+	single();
+	concurrent();
+	return checkResult("check-queue");
+}
@@ -0,0 +1,142 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * Repeater: a key the TV keeps pressing is one held key
+ */
+
+#include "check.h"
+#include "repeat.h"
+#include "latency.h"
+
+#include <poll.h>
+
+#include <vector>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/configurator.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+struct Event {
+	key_event_t event;
+	cec_user_control_code keycode;
+	unsigned count;
+};
+
+static std::vector<Event> events;
+
+/*
+ * Runs the timer for ms
+ */
+static void pump(Repeater &repeater, unsigned ms) {
+	uint64_t end = latencyNow() + ms * 1000ull;
+
+	for (uint64_t now = latencyNow(); now < end; now = latencyNow()) {
+		struct pollfd pfd = {repeater.fd(), POLLIN, 0};
+		if (poll(&pfd, 1, (end - now) / 1000 + 1) > 0)
+			repeater.onTimer();
+	}
+}
+
+int main() {
+	BasicConfigurator config;
+	config.configure();
+	Logger::getRoot().setLogLevel(FATAL_LOG_LEVEL);
+
+	Repeater repeater;
+	repeater.setup();
+	repeater.emit = [](key_event_t event, cec_user_control_code keycode, unsigned count) {
+		Event e = {event, keycode, count};
+		events.push_back(e);
+	};
+
+	// libcec passes the TV's repeated presses on as new key presses
+	for (int i = 0; i < 5; i++) {
+		repeater.press(CEC_USER_CONTROL_CODE_UP, false);
+		pump(repeater, 300);
+	}
+	pump(repeater, REPEAT_HOLD_TIMEOUT + 100);
+
+	CHECK(events.size() > 3);
+	CHECK_EQ(events.front().event, KEY_EVENT_PRESS);
+	CHECK_EQ(events.front().count, 0u);
+	CHECK_EQ(events.back().event, KEY_EVENT_RELEASE);
+	unsigned presses = 0, releases = 0, last = 0;
+	for (size_t i = 0; i < events.size(); i++) {
+		CHECK_EQ(events[i].keycode, CEC_USER_CONTROL_CODE_UP);
+		if (events[i].event == KEY_EVENT_RELEASE) {
+			releases++;
+		} else if (events[i].count == 0) {
+			presses++;
+		} else {
+			CHECK_EQ(events[i].count, last + 1);
+			last = events[i].count;
+		}
+	}
+	CHECK_EQ(presses, 1u);
+	CHECK_EQ(releases, 1u);
+	// 1500ms held, the first repeat after REPEAT_DELAY
+	CHECK(last >= 5);
+
+	// another key still ends the one held
+	events.clear();
+	repeater.press(CEC_USER_CONTROL_CODE_UP, false);
+	repeater.press(CEC_USER_CONTROL_CODE_DOWN, false);
+	repeater.release();
+	CHECK_EQ(events.size(), 4u);
+	if (events.size() == 4) {
+		CHECK_EQ(events[1].event, KEY_EVENT_RELEASE);
+		CHECK_EQ(events[1].keycode, CEC_USER_CONTROL_CODE_UP);
+		CHECK_EQ(events[2].event, KEY_EVENT_PRESS);
+		CHECK_EQ(events[2].keycode, CEC_USER_CONTROL_CODE_DOWN);
+	}
+
+	// a key with a long press mapping held past longPress, pressed again and again
+	events.clear();
+	repeater.longPress = 1000;
+	for (int i = 0; i < 5; i++) {
+		repeater.press(CEC_USER_CONTROL_CODE_AN_RETURN, true);
+		pump(repeater, 300);
+	}
+	repeater.release();
+	CHECK_EQ(events.size(), 2u);
+	if (events.size() == 2) {
+		CHECK_EQ(events[0].event, KEY_EVENT_LONG);
+		CHECK_EQ(events[1].event, KEY_EVENT_RELEASE);
+		CHECK_EQ(events[1].count, 1u);
+	}
+
+	// ... and released before it
+	events.clear();
+	repeater.press(CEC_USER_CONTROL_CODE_AN_RETURN, true);
+	pump(repeater, 300);
+	repeater.press(CEC_USER_CONTROL_CODE_AN_RETURN, true);
+	repeater.release(CEC_USER_CONTROL_CODE_AN_RETURN, 400);
+	CHECK_EQ(events.size(), 2u);
+	if (events.size() == 2) {
+		CHECK_EQ(events[0].event, KEY_EVENT_PRESS);
+		CHECK_EQ(events[1].event, KEY_EVENT_RELEASE);
+		CHECK_EQ(events[1].count, 0u);
+	}
+
+	return checkResult("check-repeat");
+}
@@ -0,0 +1,178 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * Sequencer: what goes out for a run of key presses, as a string of
+ * p<key> for a key passed on, r<key> for a held back key sent late and
+ * the LIRC name of a completed sequence
+ */
+
+#include "check.h"
+#include "sequence.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/configurator.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::ostringstream;
+using std::string;
+
+static string dir;
+
+/*
+ * Loads text and presses the keys, NUMBER0 to NUMBER9 as 0 to 9 in both, - to end
+ * the sequence in progress like a long press does, t to let it time out
+ */
+static string run(const string &text, const char *keys) {
+	string path = dir + "/sequences";
+	ostringstream out;
+	Sequencer sequencer;
+
+	std::ofstream file(path.c_str());
+	file << "timeout 1\n";
+	for (size_t i = 0; i < text.size(); i++) {
+		if (isdigit(text[i]) && text[i - 1] == ' ')
+			file << "NUMBER";
+		file << text[i];
+	}
+	file.close();
+
+	sequencer.pass = [&out](cec_user_control_code keycode) { out << "p" << keycode - CEC_USER_CONTROL_CODE_NUMBER0 << " "; };
+	sequencer.replay = [&out](cec_user_control_code keycode) { out << "r" << keycode - CEC_USER_CONTROL_CODE_NUMBER0 << " "; };
+	sequencer.match = [&out](const LircKey &lircKey) {
+		string line(lircKey.lines[0].text, lircKey.lines[0].len);
+		out << line.substr(line.find(' ', line.find(' ') + 1) + 1, line.find(" RPICEC") - line.find(' ', line.find(' ') + 1) - 1) << " ";
+	};
+
+	if (!sequencer.load(path))
+		return "error";
+	sequencer.setup();
+
+	for (const char *key = keys; *key; key++) {
+		if (*key == '-') {
+			sequencer.interrupt();
+		} else if (*key == 't') {
+			usleep(5000);
+			sequencer.onTimer();
+		} else {
+			sequencer.press((cec_user_control_code)(CEC_USER_CONTROL_CODE_NUMBER0 + *key - '0'));
+		}
+	}
+
+	string result = out.str();
+	return result.empty() ? result : result.substr(0, result.size() - 1);
+}
+
+#define CHECK_RUN(text, keys, expected) do { \
+		string result = run(text, keys); \
+		if (result != expected) { \
+			fprintf(stderr, "%s:%d: %s gave \"%s\", expected \"%s\"\n", __FILE__, __LINE__, keys, result.c_str(), expected); \
+			checkFailures++; \
+		} \
+	} while (0)
+
+int main() {
+	char tmpl[] = "/tmp/check-sequence.XXXXXX";
+
+	BasicConfigurator config;
+	config.configure();
+	Logger::getRoot().setLogLevel(FATAL_LOG_LEVEL);
+
+	if (!mkdtemp(tmpl)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	dir = tmpl;
+
+	// keys go out as usual, the name follows
+	CHECK_RUN("sequence S 1 2 3\n", "123", "p1 p2 p3 S");
+	CHECK_RUN("sequence S 1 2 3\n", "1243", "p1 p2 p4 p3");
+	CHECK_RUN("sequence S 1 2 3\n", "12t3", "p1 p2 p3");
+
+	// a mismatch falls back to the longest tail that still starts a sequence
+	CHECK_RUN("sequence S 1 1 2\n", "1112", "p1 p1 p1 p2 S");
+	CHECK_RUN("sequence S 1 2 1 3\n", "121213", "p1 p2 p1 p2 p1 p3 S");
+	CHECK_RUN("sequence S 1 2 3\n", "1123", "p1 p1 p2 p3 S");
+
+	// held back keys go out late unless they become the sequence
+	CHECK_RUN("sequence S 1 2 3 suppress\n", "123", "S");
+	CHECK_RUN("sequence S 1 2 3 suppress\n", "124", "r1 r2 p4");
+	CHECK_RUN("sequence S 1 2 3 suppress\n", "12t", "r1 r2");
+	CHECK_RUN("sequence S 1 1 2 suppress\n", "1112", "r1 S");
+	CHECK_RUN("sequence S 1 2 1 3 suppress\n", "121213", "r1 r2 S");
+	CHECK_RUN("sequence S 1 2 3 suppress\n", "1212123", "r1 r2 r1 r2 S");
+
+	// a sequence that can continue completes when it doesn't
+	CHECK_RUN("sequence A 1 2\nsequence B 1 2 3\n", "123", "p1 p2 p3 B");
+	CHECK_RUN("sequence A 1 2\nsequence B 1 2 3\n", "124", "p1 p2 A p4");
+	CHECK_RUN("sequence A 1 2\nsequence B 1 2 3\n", "12-", "p1 p2 A");
+	CHECK_RUN("sequence A 1 2\nsequence B 1 2 3\n", "12t", "p1 p2 A");
+	CHECK_RUN("sequence A 1 2\nsequence B 1 2 3\n", "1212t", "p1 p2 A p1 p2 A");
+
+	// a sequence at the end of a longer one that went nowhere
+	CHECK_RUN("sequence L 1 2 3 4\nsequence T 2 3\n", "123-", "p1 p2 p3 T");
+	CHECK_RUN("sequence L 1 2 3 4\nsequence T 2 3\n", "1235", "p1 p2 p3 T p5");
+	CHECK_RUN("sequence L 1 2 3 4\nsequence T 2 3\n", "1234", "p1 p2 p3 p4 L");
+	CHECK_RUN("sequence L 1 2 3 4 suppress\nsequence T 2 3 suppress\n", "1235", "r1 T p5");
+
+	// ... unless the fallback carries it on
+	CHECK_RUN("sequence L 1 2 3 4\nsequence T 2 3\nsequence U 2 3 5 6\n", "12356", "p1 p2 p3 p5 p6 U");
+
+	// a chord in either order, the key that starts the next one still does
+	CHECK_RUN("chord C 1 2\n", "12", "p1 p2 C");
+	CHECK_RUN("chord C 1 2\n", "21", "p2 p1 C");
+	CHECK_RUN("chord C 1 2 suppress\n", "1121t", "r1 C r1");
+	CHECK_RUN("chord C 1 2 suppress\nsequence S 3 4\n", "134", "r1 p3 p4 S");
+
+	// keys in no sequence pass straight through
+	CHECK_RUN("sequence S 1 2\n", "9", "p9");
+
+	// broken files, the messages are expected
+	int saved = dup(2);
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, 2);
+	string tooShort = run("sequence S 1\n", "");
+	string chord = run("chord C 1 2 3\n", "");
+	string twice = run("sequence S 1 2\nchord C 2 1\n", "");
+	string unknown = run("sequence S 1 X\n", "");
+	dup2(saved, 2);
+	close(saved);
+	close(null);
+
+	CHECK(tooShort == "error");
+	CHECK(chord == "error");
+	CHECK(twice == "error");
+	CHECK(unknown == "error");
+
+	CHECK_EQ(system(("rm -r " + dir).c_str()), 0);
+	return checkResult("check-sequence");
+}
@@ -0,0 +1,183 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+/**
+ * EvdevSink with -O pipe: the input_event records a press, a repeat and a
+ * release turn into, written to a file and to a FIFO
+ */
+
+#include "check.h"
+#include "sink.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/configurator.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::string;
+using std::vector;
+
+static string dir;
+
+static vector<input_event> readRecords(int fd, size_t expected) {
+	vector<input_event> records(expected + 1);
+	size_t got = 0;
+
+	for (int i = 0; i < 200 && got < expected * sizeof(input_event); i++) {
+		ssize_t n = pread(fd, (char *)&records[0] + got, (expected + 1) * sizeof(input_event) - got, got);
+		if (n > 0)
+			got += n;
+		else
+			usleep(5000);
+	}
+
+	CHECK_EQ(got, expected * sizeof(input_event));
+	records.resize(got / sizeof(input_event));
+	return records;
+}
+
+static bool is(const input_event &record, unsigned type, unsigned code, int value) {
+	return record.type == type && record.code == code && record.value == value;
+}
+
+static void names() {
+	CHECK_EQ(EvdevSink::code("KEY_OK", 6), KEY_OK);
+	CHECK_EQ(EvdevSink::code("KEY_OK RPICEC", 6), KEY_OK);
+	CHECK_EQ(EvdevSink::code("KEY_O", 5), KEY_O);
+	CHECK_EQ(EvdevSink::code("KEY_OKAY", 8), 0);
+	CHECK_EQ(EvdevSink::code("BTN_LEFT", 8), 0);
+}
+
+static void file() {
+	string path = dir + "/events";
+	EvdevSink sink;
+	LircKey select, blue, unknown;
+
+	memset(&select, 0, sizeof select);
+	memset(&blue, 0, sizeof blue);
+	memset(&unknown, 0, sizeof unknown);
+	Keymap::addLine(select, CEC_USER_CONTROL_CODE_SELECT, "KEY_OK");
+	Keymap::addLine(blue, CEC_USER_CONTROL_CODE_F1_BLUE, "KEY_BLUE");
+	Keymap::addLine(blue, CEC_USER_CONTROL_CODE_F1_BLUE, "KEY_F1");
+	Keymap::addLine(unknown, CEC_USER_CONTROL_CODE_EXIT, "NOT_A_KEY");
+
+	sink.path = path;
+	sink.uinput = false;
+	CHECK(sink.start());
+
+	sink.key(CEC_USER_CONTROL_CODE_SELECT, select, 0, false);
+	sink.key(CEC_USER_CONTROL_CODE_SELECT, select, 1, false);
+	sink.key(CEC_USER_CONTROL_CODE_SELECT, select, 1, true);
+	// names the kernel doesn't know are left out, a key without any as well
+	sink.key(CEC_USER_CONTROL_CODE_EXIT, unknown, 0, false);
+	sink.key(CEC_USER_CONTROL_CODE_F1_BLUE, blue, 0, false);
+
+	// the sink thread creates it
+	int fd = -1;
+	for (int i = 0; i < 200 && fd < 0; i++) {
+		fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			usleep(5000);
+	}
+	CHECK(fd >= 0);
+	vector<input_event> r = readRecords(fd, 9);
+	close(fd);
+	sink.stop();
+
+	if (r.size() == 9) {
+		CHECK(is(r[0], EV_KEY, KEY_OK, 1));
+		CHECK(is(r[1], EV_SYN, SYN_REPORT, 0));
+		CHECK(is(r[2], EV_KEY, KEY_OK, 2));
+		CHECK(is(r[3], EV_SYN, SYN_REPORT, 0));
+		CHECK(is(r[4], EV_KEY, KEY_OK, 0));
+		CHECK(is(r[5], EV_SYN, SYN_REPORT, 0));
+		CHECK(is(r[6], EV_KEY, KEY_BLUE, 1));
+		CHECK(is(r[7], EV_KEY, KEY_F1, 1));
+		CHECK(is(r[8], EV_SYN, SYN_REPORT, 0));
+	}
+}
+
+static void fifo() {
+	string path = dir + "/fifo";
+	EvdevSink sink;
+	LircKey up;
+
+	CHECK_EQ(mkfifo(path.c_str(), 0600), 0);
+	int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+	CHECK(fd >= 0);
+
+	memset(&up, 0, sizeof up);
+	Keymap::addLine(up, CEC_USER_CONTROL_CODE_UP, "KEY_UP");
+
+	sink.path = path;
+	sink.uinput = false;
+	CHECK(sink.start());
+	usleep(50000);
+	sink.key(CEC_USER_CONTROL_CODE_UP, up, 0, false);
+
+	// a FIFO can't pread, the two records come in one write
+	input_event r[3];
+	ssize_t n = -1;
+	for (int i = 0; i < 200 && n < 0; i++) {
+		n = read(fd, r, sizeof r);
+		if (n < 0)
+			usleep(5000);
+	}
+	CHECK_EQ(n, 2 * sizeof(input_event));
+	if (n == 2 * sizeof(input_event)) {
+		CHECK(is(r[0], EV_KEY, KEY_UP, 1));
+		CHECK(is(r[1], EV_SYN, SYN_REPORT, 0));
+	}
+
+	sink.stop();
+	close(fd);
+}
+
+int main() {
+	char tmpl[] = "/tmp/check-sink.XXXXXX";
+
+	BasicConfigurator config;
+	config.configure();
+	Logger::getRoot().setLogLevel(FATAL_LOG_LEVEL);
+
+	if (!mkdtemp(tmpl)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	dir = tmpl;
+
+	names();
+	file();
+	fifo();
+
+	CHECK_EQ(system(("rm -r " + dir).c_str()), 0);
+	return checkResult("check-sink");
+}
@@ -0,0 +1,63 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "dedupe.h"
+#include "latency.h"
+
+#include <string.h>
+
+using namespace CEC;
+
+Deduper::Deduper() : next(0), window(DEDUPE_WINDOW) {
+	pthread_mutex_init(&lock, NULL);
+	memset(seen, 0, sizeof seen);
+}
+
+Deduper::~Deduper() {
+	pthread_mutex_destroy(&lock);
+}
+
+bool Deduper::duplicate(cec_user_control_code keycode, cec_logical_address initiator) {
+	if (!window)
+		return false;
+
+	uint64_t now = latencyNow();
+	uint64_t since = now - window * 1000ull;
+	bool found = false;
+
+	pthread_mutex_lock(&lock);
+
+	for (unsigned i = 0; i < DEDUPE_SLOTS && !found; i++) {
+		found = seen[i].stamp && seen[i].stamp >= since
+			&& seen[i].keycode == (uint8_t)keycode && seen[i].initiator == (uint8_t)initiator;
+	}
+
+	// only accepted keys open a window, a burst of copies can't stretch it
+	if (!found) {
+		seen[next].stamp = now;
+		seen[next].keycode = keycode;
+		seen[next].initiator = initiator;
+		next = (next + 1) % DEDUPE_SLOTS;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return found;
+}
@@ -0,0 +1,65 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <libcec/cectypes.h>
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define DEDUPE_WINDOW	100	// ms in which the same key from the same device counts as one
+#define DEDUPE_SLOTS	8	// recent keys remembered
+
+/**
+ * Drops a key that was already seen from the same device a moment ago.
+ * One press can reach Main twice, as a key press and as a Play or Deck
+ * Control command, and some TVs send a frame again after a NACK.
+ *
+ * A small ring of the last keys accepted, so a lookup is a handful of
+ * compares. Called from libcec threads and the main loop.
+ */
+class Deduper {
+
+	private:
+
+		struct Seen {
+			uint64_t stamp;		// us, latencyNow()
+			uint8_t keycode;
+			uint8_t initiator;
+		};
+
+		pthread_mutex_t lock;
+		Seen seen[DEDUPE_SLOTS];
+		unsigned next;
+
+	public:
+
+		unsigned window;	// ms, 0 keeps every key
+
+		Deduper();
+		virtual ~Deduper();
+
+		/**
+		 * True if keycode came from initiator within the window, else
+		 * remembers it and returns false
+		 */
+		bool duplicate(CEC::cec_user_control_code keycode, CEC::cec_logical_address initiator);
+};
@@ -0,0 +1,138 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bounded lock-free multi-producer/single-consumer queue of fixed-size
+ * elements (after Dmitry Vyukov's bounded MPMC queue).
+ *
+ * Every element gets the position it was enqueued at as its sequence
+ * number. The consumer always sees elements in strictly increasing
+ * sequence order, even if producers finish their writes out of order.
+ */
+template <typename T, size_t N>
+class mpsc_queue {
+
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "mpsc_queue size must be a power of two");
+
+	private:
+
+		struct cell {
+			std::atomic<uint64_t> sequence;
+			T data;
+		};
+
+		cell cells[N];
+
+		// producers and the consumer each get their own cache line
+		alignas(64) std::atomic<uint64_t> enqueue_pos;
+		alignas(64) std::atomic<uint64_t> dequeue_pos;
+
+		// Not implemented, the cells are not copyable
+		mpsc_queue(mpsc_queue const&);
+		void operator=(mpsc_queue const&);
+
+	public:
+
+		mpsc_queue() : enqueue_pos(0), dequeue_pos(0) {
+			for (size_t i = 0; i < N; i++)
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Can be called from any thread. Returns false if the queue is full.
+		 */
+		bool push(const T &value) {
+			return emplace([&value](T &data) { data = value; });
+		}
+
+		/**
+		 * Like push(), but fill(T &) writes the element in place, e.g. only
+		 * the part of a large element that is in use
+		 */
+		template <typename F>
+		bool emplace(F fill) {
+			cell *c;
+			uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+			for (;;) {
+				c = &cells[pos & (N - 1)];
+				uint64_t seq = c->sequence.load(std::memory_order_acquire);
+				int64_t dif = (int64_t)seq - (int64_t)pos;
+
+				if (dif == 0) {
+					if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				} else if (dif < 0) {
+					return false;
+				} else {
+					pos = enqueue_pos.load(std::memory_order_relaxed);
+				}
+			}
+
+			fill(c->data);
+			c->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * Must only be called from the consumer thread. Returns false if
+		 * the next element in sequence is not available yet.
+		 */
+		bool pop(T &value, uint64_t *seq = NULL) {
+			return consume([&value](const T &data) { value = data; }, seq);
+		}
+
+		/**
+		 * Like pop(), but use(const T &) reads the element in place, it
+		 * stays in the queue until use returns
+		 */
+		template <typename F>
+		bool consume(F use, uint64_t *seq = NULL) {
+			uint64_t pos = dequeue_pos.load(std::memory_order_relaxed);
+			cell *c = &cells[pos & (N - 1)];
+			uint64_t s = c->sequence.load(std::memory_order_acquire);
+
+			if ((int64_t)(s - (pos + 1)) < 0)
+				return false;
+
+			use(c->data);
+			if (seq)
+				*seq = pos;
+
+			c->sequence.store(pos + N, std::memory_order_release);
+			dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		/**
+		 * Approximate number of queued elements, for statistics only.
+		 */
+		size_t size() const {
+			uint64_t head = dequeue_pos.load(std::memory_order_relaxed);
+			uint64_t tail = enqueue_pos.load(std::memory_order_relaxed);
+			return tail > head ? tail - head : 0;
+		}
+};
@@ -0,0 +1,450 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "fakecec.h"
+#include "keycodes.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <sstream>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::string;
+
+static Logger logger = Logger::getInstance("fakecec");
+
+static const char *addressNames[16] = {
+	"TV", "Recorder 1", "Recorder 2", "Tuner 1", "Playback 1", "Audio", "Tuner 2", "Tuner 3",
+	"Playback 2", "Recorder 3", "Tuner 4", "Playback 3", "Reserved 1", "Reserved 2", "Free use", "Broadcast"
+};
+
+static char opcodeNames[256][8];
+
+static void addUs(struct timespec &ts, unsigned long us) {
+	ts.tv_sec += us / 1000000;
+	ts.tv_nsec += (us % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+}
+
+FakeBackend::FakeBackend() : loops(1), config(NULL), playing(false), started(false),
+	position(0), played(0), rate(0), record(NULL) {
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wake, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&lock, NULL);
+
+	for (unsigned i = 0; i < 256; i++)
+		snprintf(opcodeNames[i], sizeof opcodeNames[i], "0x%02x", i);
+}
+
+FakeBackend::~FakeBackend() {
+	close();
+	if (record)
+		fclose(record);
+	pthread_cond_destroy(&wake);
+	pthread_mutex_destroy(&lock);
+}
+
+/*
+ * One script line into a step, false on a syntax error
+ */
+bool FakeBackend::parse(const string &line, Step &step) {
+	std::istringstream in(line);
+	string op, arg;
+
+	in >> op;
+	memset(&step, 0, sizeof step);
+
+	if (op == "key") {
+		if (!(in >> arg))
+			return false;
+
+		step.op = FAKE_KEY;
+		step.key.keycode = CEC_USER_CONTROL_CODE_UNKNOWN;
+		for (unsigned code = 0; code < 256; code++) {
+			if (cecKeys[code].name && arg == cecKeys[code].name)
+				step.key.keycode = (cec_user_control_code)code;
+		}
+		if (step.key.keycode == CEC_USER_CONTROL_CODE_UNKNOWN) {
+			char *end;
+			unsigned long code = strtoul(arg.c_str(), &end, 16);
+			if (*end || code > 0xff)
+				return false;
+			step.key.keycode = (cec_user_control_code)code;
+		}
+
+		unsigned duration = 0;
+		if (in >> duration)
+			step.key.duration = duration;
+		return !in.bad();
+	}
+
+	if (op == "command") {
+		unsigned byte[1 + 64];
+		unsigned count = 0;
+
+		if (!(in >> arg))
+			return false;
+
+		std::istringstream frame(arg);
+		string hex;
+		while (count < sizeof byte / sizeof byte[0] && std::getline(frame, hex, ':')) {
+			char *end;
+			byte[count] = strtoul(hex.c_str(), &end, 16);
+			if (*end || hex.empty() || byte[count] > 0xff)
+				return false;
+			count++;
+		}
+		if (count == 0)
+			return false;
+
+		step.op = FAKE_COMMAND;
+		step.command.initiator = (cec_logical_address)(byte[0] >> 4);
+		step.command.destination = (cec_logical_address)(byte[0] & 0xf);
+		step.command.ack = 1;
+		step.command.eom = 1;
+		step.command.opcode = count > 1 ? (cec_opcode)byte[1] : CEC_OPCODE_NONE;
+		step.command.opcode_set = count > 1;
+		for (unsigned i = 2; i < count; i++)
+			step.command.parameters.PushBack(byte[i]);
+		return true;
+	}
+
+	if (op == "alert") {
+		step.op = FAKE_ALERT;
+		return (bool)(in >> step.value);
+	}
+
+	if (op == "source") {
+		step.op = FAKE_SOURCE;
+		return (bool)(in >> step.address >> step.value) && step.address < 16;
+	}
+
+	if (op == "sleep") {
+		step.op = FAKE_SLEEP;
+		return (bool)(in >> step.value);
+	}
+
+	if (op == "rate") {
+		step.op = FAKE_RATE;
+		return (bool)(in >> step.value);
+	}
+
+	return false;
+}
+
+bool FakeBackend::load(const string &path, const string &recordPath) {
+	std::ifstream in(path.c_str());
+	string line;
+	unsigned number = 0;
+
+	if (!in) {
+		fprintf(stderr, "Unable to open %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	while (std::getline(in, line)) {
+		Step step;
+
+		number++;
+		line = line.substr(0, line.find('#'));
+		if (line.find_first_not_of(" \t\r") == string::npos)
+			continue;
+
+		std::istringstream words(line);
+		string op;
+		words >> op;
+		if (op == "loop") {
+			if (!(words >> loops)) {
+				fprintf(stderr, "%s:%u: Expected a count\n", path.c_str(), number);
+				return false;
+			}
+			continue;
+		}
+
+		if (!parse(line, step)) {
+			fprintf(stderr, "%s:%u: Unable to parse \"%s\"\n", path.c_str(), number, line.c_str());
+			return false;
+		}
+		steps.push_back(step);
+	}
+
+	script = path;
+	return setRecord(recordPath);
+}
+
+bool FakeBackend::setRecord(const string &path) {
+	if (path.empty())
+		return true;
+
+	record = fopen(path.c_str(), "w");
+	if (!record) {
+		fprintf(stderr, "Unable to open %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+int64_t FakeBackend::elapsedMs() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - opened.tv_sec) * 1000 + (now.tv_nsec - opened.tv_nsec) / 1000000;
+}
+
+/*
+ * Appends what ceclircd sent to the record file
+ */
+void FakeBackend::log(const char *format, ...) {
+	va_list args;
+
+	if (!record)
+		return;
+
+	va_start(args, format);
+	fprintf(record, "%lld ", (long long)elapsedMs());
+	vfprintf(record, format, args);
+	fputc('\n', record);
+	fflush(record);
+	va_end(args);
+}
+
+/*
+ * Waits until the deadline or close(), false for the latter. Lock held.
+ */
+bool FakeBackend::pause(unsigned us) {
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	addUs(deadline, us);
+
+	while (playing && pthread_cond_timedwait(&wake, &lock, &deadline) != ETIMEDOUT)
+		;
+
+	return playing;
+}
+
+/*
+ * Logs the frame the way libcec does, see onBusTraffic() in libcec.cpp,
+ * then hands it to the command callback
+ */
+void FakeBackend::sendCommand(const cec_command &command) {
+	ICECCallbacks *callbacks = config->callbacks;
+	cec_log_message message;
+
+	int len = snprintf(message.message, sizeof message.message, ">> %x%x", command.initiator, command.destination);
+	if (command.opcode_set)
+		len += snprintf(message.message + len, sizeof message.message - len, ":%02x", command.opcode);
+	for (unsigned i = 0; i < command.parameters.size; i++)
+		len += snprintf(message.message + len, sizeof message.message - len, ":%02x", command.parameters[i]);
+	message.level = CEC_LOG_TRAFFIC;
+	message.time = elapsedMs();
+	if (callbacks->CBCecLogMessage)
+		callbacks->CBCecLogMessage(config->callbackParam, message);
+
+	callbacks->CBCecCommand(config->callbackParam, command);
+}
+
+void *FakeBackend::run(void *self) {
+	((FakeBackend *)self)->play();
+	return NULL;
+}
+
+void FakeBackend::play() {
+	void *param = config->callbackParam;
+	ICECCallbacks *callbacks = config->callbacks;
+
+	// libcec tells the client its address once it is open
+	config->logicalAddresses.primary = CECDEVICE_RECORDINGDEVICE1;
+	if (callbacks->CBCecConfigurationChanged)
+		callbacks->CBCecConfigurationChanged(param, *config);
+
+	pthread_mutex_lock(&lock);
+
+	while (playing) {
+		if (position == steps.size()) {
+			// stays at the end once done, also across a restart
+			if (steps.empty() || (loops && played + 1 >= loops)) {
+				LOG4CPLUS_INFO(logger, "Script " << script << " done");
+				while (playing)
+					pthread_cond_wait(&wake, &lock);
+				break;
+			}
+			position = 0;
+			played++;
+		}
+
+		Step step = steps[position++];
+
+		pthread_mutex_unlock(&lock);
+
+		switch (step.op) {
+			case FAKE_KEY:
+				callbacks->CBCecKeyPress(param, step.key);
+				break;
+			case FAKE_COMMAND:
+				sendCommand(step.command);
+				break;
+			case FAKE_ALERT: {
+				libcec_parameter none;
+				none.paramType = CEC_PARAMETER_TYPE_UNKOWN;
+				none.paramData = NULL;
+				callbacks->CBCecAlert(param, (libcec_alert)step.value, none);
+				break;
+			}
+			case FAKE_SOURCE:
+				callbacks->CBCecSourceActivated(param, (cec_logical_address)step.address, step.value);
+				break;
+			default:
+				break;
+		}
+
+		pthread_mutex_lock(&lock);
+
+		if (step.op == FAKE_SLEEP)
+			pause(step.value * 1000);
+		else if (step.op == FAKE_RATE)
+			rate = step.value;
+		else if (rate)
+			pause(1000000 / rate);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+bool FakeBackend::init(libcec_configuration &config) {
+	this->config = &config;
+	return true;
+}
+
+void FakeBackend::release() {
+	// nothing to unload, the script carries on where it was
+}
+
+int8_t FakeBackend::findAdapters(cec_adapter *devices, uint8_t size) {
+	if (size == 0)
+		return 0;
+
+	memset(&devices[0], 0, sizeof devices[0]);
+	strncpy(devices[0].path, script.c_str(), sizeof devices[0].path - 1);
+	strncpy(devices[0].comm, "fake", sizeof devices[0].comm - 1);
+	return 1;
+}
+
+bool FakeBackend::open(const char *port) {
+	if (started)
+		return true;
+
+	clock_gettime(CLOCK_MONOTONIC, &opened);
+	log("open %s", port);
+
+	playing = true;
+	if (pthread_create(&thread, NULL, &run, this)) {
+		LOG4CPLUS_ERROR(logger, "Can't create fake adapter thread");
+		playing = false;
+		return false;
+	}
+
+	started = true;
+	return true;
+}
+
+void FakeBackend::close() {
+	if (!started)
+		return;
+
+	pthread_mutex_lock(&lock);
+	playing = false;
+	pthread_cond_broadcast(&wake);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(thread, NULL);
+	started = false;
+	log("close");
+}
+
+bool FakeBackend::ping() {
+	log("ping");
+	return started;
+}
+
+bool FakeBackend::setActiveSource(cec_device_type type) {
+	log("active_source %d", type);
+	return true;
+}
+
+bool FakeBackend::setInactiveView() {
+	log("inactive_view");
+	return true;
+}
+
+cec_logical_addresses FakeBackend::getActiveDevices() {
+	cec_logical_addresses addresses;
+
+	memset(&addresses, 0, sizeof addresses);
+	addresses.primary = CECDEVICE_TV;
+	addresses.addresses[CECDEVICE_TV] = 1;
+	return addresses;
+}
+
+uint16_t FakeBackend::getDevicePhysicalAddress(cec_logical_address address) {
+	return address == CECDEVICE_TV ? 0x0000 : 0xffff;
+}
+
+cec_osd_name FakeBackend::getDeviceOSDName(cec_logical_address address) {
+	cec_osd_name name;
+
+	memset(&name, 0, sizeof name);
+	strncpy(name.name, "Fake", sizeof name.name - 1);
+	name.device = address;
+	return name;
+}
+
+uint64_t FakeBackend::getDeviceVendorId(cec_logical_address address) {
+	return CEC_VENDOR_UNKNOWN;
+}
+
+const char *FakeBackend::toString(cec_logical_address address) {
+	return address >= 0 && address < 16 ? addressNames[address] : "Unknown";
+}
+
+const char *FakeBackend::toString(cec_opcode opcode) {
+	return opcodeNames[opcode & 0xff];
+}
+
+const char *FakeBackend::toString(cec_vendor_id vendor) {
+	return "Unknown";
+}
@@ -0,0 +1,126 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include "backend.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * An adapter without hardware. It plays a script of callbacks from its own
+ * thread and records what ceclircd sends. One directive per line:
+ *
+ *   key <name|code> [<duration>]     cec_keypress, code in hex
+ *   command <frame>                  cec_command, as libcec logs it: 0f:44:01
+ *   alert <number>                   libcec_alert
+ *   source <address> <0|1>           source (de)activated
+ *   sleep <ms>
+ *   rate <per second>                pace the following callbacks, 0 is no pause
+ *   loop <count>                     play the script count times, 0 forever
+ *
+ * Where the script stopped survives close(), so an alert that makes ceclircd
+ * restart continues with the next line.
+ */
+class FakeBackend : public CecBackend {
+
+	private:
+
+		typedef enum { FAKE_KEY, FAKE_COMMAND, FAKE_ALERT, FAKE_SOURCE, FAKE_SLEEP, FAKE_RATE } fake_op_t;
+
+		struct Step {
+			fake_op_t op;
+			CEC::cec_keypress key;
+			CEC::cec_command command;
+			unsigned value;
+			unsigned address;
+		};
+
+		std::vector<Step> steps;
+		unsigned loops;
+
+		bool parse(const std::string &line, Step &step);
+
+	protected:
+
+		std::string script;
+
+		CEC::libcec_configuration *config;
+
+		// the player
+		pthread_t thread;
+		pthread_mutex_t lock;
+		pthread_cond_t wake;
+		bool playing;
+		bool started;
+		size_t position;
+		unsigned played;
+		unsigned rate;
+		struct timespec opened;
+
+		FILE *record;
+
+		static void *run(void *self);
+		virtual void play();
+		bool pause(unsigned us);
+		void log(const char *format, ...);
+		int64_t elapsedMs();
+
+		void sendCommand(const CEC::cec_command &command);
+
+	public:
+
+		FakeBackend();
+		virtual ~FakeBackend();
+
+		/**
+		 * Reads the script, records to recordPath unless empty
+		 */
+		bool load(const std::string &path, const std::string &recordPath);
+
+		/**
+		 * Records to path unless empty, what load() does after the script
+		 */
+		bool setRecord(const std::string &path);
+
+		bool init(CEC::libcec_configuration &config);
+		void release();
+
+		int8_t findAdapters(CEC::cec_adapter *devices, uint8_t size);
+		bool open(const char *port);
+		void close();
+		bool ping();
+
+		bool setActiveSource(CEC::cec_device_type type);
+		bool setInactiveView();
+
+		CEC::cec_logical_addresses getActiveDevices();
+		uint16_t getDevicePhysicalAddress(CEC::cec_logical_address address);
+		CEC::cec_osd_name getDeviceOSDName(CEC::cec_logical_address address);
+		uint64_t getDeviceVendorId(CEC::cec_logical_address address);
+
+		const char *toString(CEC::cec_logical_address address);
+		const char *toString(CEC::cec_opcode opcode);
+		const char *toString(CEC::cec_vendor_id vendor);
+};
@@ -0,0 +1,115 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "flight.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+flight_record_t flightRing[FLIGHT_RECORDS];
+std::atomic<uint64_t> flightNext(0);
+
+std::atomic<uint16_t> flightQueued(0);
+std::atomic<uint16_t> flightClients(0);
+
+static char flightPath[PATH_MAX];
+
+// a crash from a blown main thread stack still gets to dump
+static char altStack[64 * 1024];
+
+static bool writeAll(int fd, const void *data, size_t len) {
+	const char *p = (const char *)data;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool flightDump(int reason) {
+	flight_header_t header;
+
+	if (!flightPath[0])
+		return false;
+
+	int fd = open(flightPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, FLIGHT_MAGIC, sizeof header.magic);
+	header.records = FLIGHT_RECORDS;
+	header.recordSize = sizeof(flight_record_t);
+	header.next = flightNext.load(std::memory_order_relaxed);
+	header.stamp = latencyNow();
+	header.reason = reason;
+
+	bool ok = writeAll(fd, &header, sizeof header) && writeAll(fd, flightRing, sizeof flightRing);
+	close(fd);
+
+	return ok;
+}
+
+static void onFatalSignal(int sig) {
+	int saved = errno;
+
+	flightRecord(FLIGHT_SIGNAL, 0, 0, 0, sig);
+	flightDump(sig);
+
+	// the handler is reset by now, so this kills us the way sig would have
+	errno = saved;
+	raise(sig);
+}
+
+void flightSetup(const std::string &path) {
+	static const int fatal[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+	struct sigaction action;
+	stack_t stack;
+
+	if (path.size() >= sizeof flightPath) {
+		fprintf(stderr, "Flight recorder path %s too long\n", path.c_str());
+		return;
+	}
+	strcpy(flightPath, path.c_str());
+
+	stack.ss_sp = altStack;
+	stack.ss_size = sizeof altStack;
+	stack.ss_flags = 0;
+	sigaltstack(&stack, NULL);
+
+	memset(&action, 0, sizeof action);
+	action.sa_handler = onFatalSignal;
+	action.sa_flags = SA_RESETHAND | SA_NODEFER | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+
+	for (size_t i = 0; i < sizeof fatal / sizeof fatal[0]; i++)
+		sigaction(fatal[i], &action, NULL);
+}
@@ -0,0 +1,112 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include "latency.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+/*
+ * The flight recorder: the last FLIGHT_RECORDS things that happened, always
+ * recorded, written out on SIGUSR1 or a fatal signal and read back with
+ * ceclircd-flight. A dump is a header followed by the ring as it is in
+ * memory, in host byte order.
+ */
+#define FLIGHT_MAGIC		"CECFLT01"
+#define FLIGHT_RECORDS		8192	// a power of two
+
+typedef enum {
+	FLIGHT_KEYPRESS = 1,	// keycode, value duration
+	FLIGHT_COMMAND,		// addresses, opcode, value first parameter, param size
+	FLIGHT_ALERT,		// value libcec_alert
+	FLIGHT_SOURCE,		// addresses initiator, value activated
+	FLIGHT_CONFIGURATION,	// addresses primary
+	FLIGHT_KEY_EVENT,	// keycode, value key_event_t, param count
+	FLIGHT_POSTED,		// keycode, value repeat, param 1 if dropped
+	FLIGHT_SIGNAL,		// value signal
+	FLIGHT_RECOVER,		// value recover_action_t, param attempt
+	FLIGHT_TYPES
+} flight_type_t;
+
+typedef struct flight_record {
+	uint64_t sequence;	// 1 + index of the record, 0 for a slot never written
+	uint64_t stamp;		// CLOCK_MONOTONIC, us
+	uint8_t type;		// flight_type_t
+	uint8_t keycode;
+	uint8_t opcode;
+	uint8_t addresses;	// initiator << 4 | destination
+	uint16_t queued;	// events waiting for the LIRC thread
+	uint16_t clients;	// LIRC clients connected
+	uint32_t value;
+	uint32_t param;
+} flight_record_t;
+
+typedef struct flight_header {
+	char magic[8];
+	uint32_t records;	// slots in the ring
+	uint32_t recordSize;
+	uint64_t next;		// index the next record would have had
+	uint64_t stamp;		// when it was dumped, same clock as the records
+	uint32_t reason;	// the signal that made the dump
+	uint32_t reserved;
+} flight_header_t;
+
+extern flight_record_t flightRing[FLIGHT_RECORDS];
+extern std::atomic<uint64_t> flightNext;
+
+// the LIRC side of each record, see Main
+extern std::atomic<uint16_t> flightQueued;
+extern std::atomic<uint16_t> flightClients;
+
+/**
+ * Records one event, from any thread. A plain store per field: a record
+ * overwritten while it is written just reads back torn.
+ */
+inline void flightRecord(flight_type_t type, uint8_t keycode, uint8_t opcode, uint8_t addresses, uint32_t value, uint32_t param = 0) {
+	uint64_t index = flightNext.fetch_add(1, std::memory_order_relaxed);
+	flight_record_t &record = flightRing[index & (FLIGHT_RECORDS - 1)];
+
+	record.stamp = latencyNow();
+	record.type = type;
+	record.keycode = keycode;
+	record.opcode = opcode;
+	record.addresses = addresses;
+	record.queued = flightQueued.load(std::memory_order_relaxed);
+	record.clients = flightClients.load(std::memory_order_relaxed);
+	record.value = value;
+	record.param = param;
+	record.sequence = index + 1;
+}
+
+/**
+ * Where dumps go, and dumps the ring on SIGSEGV, SIGBUS, SIGILL, SIGFPE
+ * and SIGABRT before dying of them
+ */
+void flightSetup(const std::string &path);
+
+/**
+ * Writes the ring to the path given to flightSetup(). Only uses calls that
+ * are safe in a signal handler.
+ */
+bool flightDump(int reason);
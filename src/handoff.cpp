@@ -0,0 +1,261 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "handoff.h"
+#include "lirc.h"
+
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace log4cplus;
+
+static Logger logger = Logger::getInstance("handoff");
+
+#define HANDOFF_MAGIC	0x43454348	// "CECH"
+#define HANDOFF_BATCH	32		// fds per message, far below SCM_MAX_FD
+#define HANDOFF_TIMEOUT	2		// s, either side waiting for the other
+
+/*
+ * One SOCK_SEQPACKET message, the pending bytes of each fd follow in order
+ */
+typedef struct handoff_msg {
+	uint32_t magic;
+	uint16_t count;
+	uint16_t last;
+	uint16_t len[HANDOFF_BATCH];
+} handoff_msg_t;
+
+#define HANDOFF_MSG_MAX	(sizeof(handoff_msg_t) + HANDOFF_BATCH * LIRC_EVENT_MAX)
+
+static void setTimeout(int fd) {
+	struct timeval tv = { HANDOFF_TIMEOUT, 0 };
+
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+}
+
+int handoffListen(const string &path) {
+	struct sockaddr_un sa = {0};
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if(fd < 0) {
+		fprintf(stderr, "Unable to create an AF_UNIX socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, path.c_str(), sizeof sa.sun_path - 1);
+
+	unlink(path.c_str());
+
+	// created 0600, there is no moment in which others could connect
+	mode_t mask = umask(0177);
+	int bound = bind(fd, (struct sockaddr *)&sa, sizeof sa);
+	umask(mask);
+
+	if(bound < 0) {
+		fprintf(stderr, "Unable to bind AF_UNIX socket to %s: %s\n", path.c_str(), strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if(listen(fd, 1) < 0) {
+		fprintf(stderr, "Unable to listen on AF_UNIX socket: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int handoffAccept(int fd) {
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+
+	int peer = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+	if(peer < 0)
+		return -1;
+
+	if(getsockopt(peer, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+		LOG4CPLUS_ERROR(logger, "Unable to identify handoff peer: " << strerror(errno));
+		close(peer);
+		return -1;
+	}
+
+	// the mode of the socket file is the first check, this one holds even if it got loosened
+	if(cred.uid != geteuid() && cred.uid != 0) {
+		LOG4CPLUS_WARN(logger, "Refused handoff to pid " << cred.pid << " of uid " << cred.uid);
+		close(peer);
+		return -1;
+	}
+
+	return peer;
+}
+
+bool handoffSend(int fd, const Handoff &handoff) {
+	char buf[HANDOFF_MSG_MAX];
+	char control[CMSG_SPACE(HANDOFF_BATCH * sizeof(int))];
+	size_t sent = 0;
+	char ack;
+
+	setTimeout(fd);
+
+	do {
+		handoff_msg_t *header = (handoff_msg_t *)buf;
+		size_t len = sizeof *header;
+		unsigned count = 0;
+
+		memset(header, 0, sizeof *header);
+		while(count < HANDOFF_BATCH && sent + count < handoff.fds.size()) {
+			const string &pending = handoff.pending[sent + count];
+			header->len[count] = pending.size();
+			memcpy(buf + len, pending.data(), pending.size());
+			len += pending.size();
+			count++;
+		}
+
+		header->magic = HANDOFF_MAGIC;
+		header->count = count;
+		header->last = sent + count == handoff.fds.size();
+
+		struct iovec iov = { buf, len };
+		struct msghdr msg = {0};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		if(count) {
+			msg.msg_control = control;
+			msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &handoff.fds[sent], count * sizeof(int));
+		}
+
+		if(sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)len) {
+			LOG4CPLUS_ERROR(logger, "Unable to pass fds: " << strerror(errno));
+			return false;
+		}
+
+		sent += count;
+	} while(sent < handoff.fds.size());
+
+	// until then both processes hold the fds, and this one still owns them
+	if(recv(fd, &ack, 1, 0) != 1) {
+		LOG4CPLUS_ERROR(logger, "New ceclircd did not confirm the handoff");
+		return false;
+	}
+
+	LOG4CPLUS_INFO(logger, "Passed the LIRC socket and " << handoff.fds.size() - 1 << " clients");
+	return true;
+}
+
+bool handoffReceive(const string &path, Handoff &handoff) {
+	struct sockaddr_un sa = {0};
+	char buf[HANDOFF_MSG_MAX];
+	char control[CMSG_SPACE(HANDOFF_BATCH * sizeof(int))];
+	bool last = false;
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		fprintf(stderr, "Unable to create an AF_UNIX socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, path.c_str(), sizeof sa.sun_path - 1);
+
+	if(connect(fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+		fprintf(stderr, "Unable to connect to %s: %s\n", path.c_str(), strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	setTimeout(fd);
+
+	while(!last) {
+		struct iovec iov = { buf, sizeof buf };
+		struct msghdr msg = {0};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+
+		ssize_t len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+		if(len < 0) {
+			fprintf(stderr, "Unable to receive from %s: %s\n", path.c_str(), strerror(errno));
+			break;
+		}
+
+		// fds first, so they are closed below whatever else is wrong
+		unsigned count = 0;
+		for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			int *fds = (int *)CMSG_DATA(cmsg);
+			handoff.fds.insert(handoff.fds.end(), fds, fds + count);
+		}
+
+		handoff_msg_t *header = (handoff_msg_t *)buf;
+		if((size_t)len < sizeof *header || header->magic != HANDOFF_MAGIC || header->count != count || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+			fprintf(stderr, "Unexpected message from %s\n", path.c_str());
+			break;
+		}
+
+		size_t offset = sizeof *header;
+		for(unsigned i = 0; i < count; i++) {
+			if(header->len[i] > LIRC_EVENT_MAX || offset + header->len[i] > (size_t)len)
+				break;
+			handoff.pending.push_back(string(buf + offset, header->len[i]));
+			offset += header->len[i];
+		}
+		if(handoff.pending.size() != handoff.fds.size()) {
+			fprintf(stderr, "Unexpected message from %s\n", path.c_str());
+			break;
+		}
+
+		last = header->last;
+	}
+
+	if(last && !handoff.fds.empty() && send(fd, "", 1, MSG_NOSIGNAL) == 1) {
+		close(fd);
+		return true;
+	}
+
+	close(fd);
+	handoffRelease(handoff);
+	return false;
+}
+
+void handoffRelease(Handoff &handoff) {
+	// close() only, a shutdown() would hang up on the new process' clients too
+	for(size_t i = 0; i < handoff.fds.size(); i++)
+		close(handoff.fds[i]);
+
+	handoff.fds.clear();
+	handoff.pending.clear();
+}
@@ -0,0 +1,63 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * What a running ceclircd passes to the one replacing it: the LIRC listener
+ * first, then every client with the rest of a line it only got part of, so
+ * clients never see a torn line.
+ */
+struct Handoff {
+	std::vector<int> fds;
+	std::vector<std::string> pending;
+};
+
+/**
+ * Creates the non-blocking socket a new ceclircd connects to, -1 on error.
+ * Only the owner may connect, taking over the clients is taking over the
+ * daemon.
+ */
+int handoffListen(const std::string &path);
+
+/**
+ * Accepts a connection on the handoff socket, -1 on error or if the peer
+ * is neither the daemon's own user nor root
+ */
+int handoffAccept(int fd);
+
+/**
+ * Passes the fds over a connection accepted on the handoff socket, true
+ * once the other side confirmed it has them all
+ */
+bool handoffSend(int fd, const Handoff &handoff);
+
+/**
+ * Connects to a running ceclircd and takes its fds, false on error
+ */
+bool handoffReceive(const std::string &path, Handoff &handoff);
+
+/**
+ * Closes every fd of the handoff, after it went to the new process
+ */
+void handoffRelease(Handoff &handoff);
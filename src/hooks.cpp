@@ -0,0 +1,332 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "hooks.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#include <stdexcept>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace log4cplus;
+
+using std::string;
+
+extern char **environ;
+
+static Logger logger = Logger::getInstance("hooks");
+
+static void addMs(struct timespec &ts, unsigned ms) {
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+}
+
+static bool before(const struct timespec &a, const struct timespec &b) {
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+HookRunner::HookRunner() : timerfd(-1), helperPid(-1), helperfd(-1),
+	maxRunning(HOOK_MAX_RUNNING), timeout(HOOK_TIMEOUT) {
+}
+
+HookRunner::~HookRunner() {
+	if (timerfd >= 0)
+		close(timerfd);
+	// the helper sees EOF and is expected to exit
+	if (helperfd >= 0)
+		close(helperfd);
+}
+
+void HookRunner::setup() {
+	if (timerfd >= 0)
+		return;
+
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerfd < 0) {
+		throw std::runtime_error("Unable to create hook timer: " + string(strerror(errno)));
+	}
+
+	if (coprocess())
+		startHelper();
+}
+
+void HookRunner::run(const string &name, const string &command) {
+	for (std::deque<Hook>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+		if (it->name == name && it->command == command) {
+			LOG4CPLUS_DEBUG(logger, "Hook " << name << " already pending");
+			return;
+		}
+	}
+
+	Hook hook = { name, command };
+
+	if (running.size() < maxRunning)
+		start(hook);
+	else
+		pending.push_back(hook);
+}
+
+/*
+ * Starts "/bin/sh -c command" in its own process group with the signal
+ * mask and dispositions reset. stdin is fd when given, else /dev/null.
+ */
+static int spawn(const string &command, pid_t &pid, int fd) {
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+	sigset_t mask, defaults;
+
+	const char *argv[] = { "/bin/sh", "-c", command.c_str(), NULL };
+
+	// the daemon blocks signals it reads from a signalfd, the hook must not inherit that
+	sigemptyset(&mask);
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGHUP);
+	sigaddset(&defaults, SIGINT);
+	sigaddset(&defaults, SIGTERM);
+	sigaddset(&defaults, SIGPIPE);
+	sigaddset(&defaults, SIGCHLD);
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	// own process group, so a timeout also kills whatever the shell started
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+	posix_spawn_file_actions_init(&actions);
+	if (fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, fd, STDIN_FILENO);
+	else
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+	int ret = posix_spawn(&pid, argv[0], &actions, &attr, (char * const *)argv, environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	return ret;
+}
+
+void HookRunner::start(const Hook &hook) {
+	Child child;
+
+	LOG4CPLUS_DEBUG(logger, "Hook " << hook.name << ": Running \"" << hook.command << "\"");
+
+	int ret = spawn(hook.command, child.pid, -1);
+	if (ret != 0) {
+		LOG4CPLUS_ERROR(logger, "Hook " << hook.name << " failed to start: " << strerror(ret));
+		return;
+	}
+
+	child.name = hook.name;
+	child.terminated = false;
+	clock_gettime(CLOCK_MONOTONIC, &child.started);
+	child.deadline = child.started;
+	addMs(child.deadline, timeout);
+
+	running.push_back(child);
+	arm();
+}
+
+void HookRunner::startHelper() {
+	int fds[2];
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		LOG4CPLUS_ERROR(logger, "Unable to create helper pipe: " << strerror(errno));
+		retryHelper();
+		return;
+	}
+
+	LOG4CPLUS_DEBUG(logger, "Starting helper \"" << helper << "\"");
+
+	int ret = spawn(helper, helperPid, fds[0]);
+	close(fds[0]);
+
+	if (ret != 0) {
+		LOG4CPLUS_ERROR(logger, "Helper failed to start: " << strerror(ret));
+		close(fds[1]);
+		retryHelper();
+		return;
+	}
+
+	// a stuck helper must not stall the main loop, its events are dropped instead
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	helperfd = fds[1];
+
+	LOG4CPLUS_INFO(logger, "Helper started as " << helperPid);
+}
+
+void HookRunner::retryHelper() {
+	helperPid = -1;
+	clock_gettime(CLOCK_MONOTONIC, &helperRestart);
+	addMs(helperRestart, HOOK_HELPER_RESTART);
+	arm();
+}
+
+void HookRunner::notify(const string &event) {
+	if (helperfd < 0) {
+		LOG4CPLUS_DEBUG(logger, "Helper down, dropping " << event);
+		return;
+	}
+
+	// lines up to PIPE_BUF are written whole or not at all
+	string line = event + "\n";
+	if (line.size() > PIPE_BUF) {
+		LOG4CPLUS_ERROR(logger, "Event too long for helper: " << event);
+		return;
+	}
+
+	if (write(helperfd, line.data(), line.size()) < 0) {
+		if (errno == EPIPE) {
+			// SIGPIPE is blocked and read from the signalfd, where it means restart. Eat it.
+			sigset_t pipe;
+			struct timespec zero = { 0, 0 };
+
+			sigemptyset(&pipe);
+			sigaddset(&pipe, SIGPIPE);
+			sigtimedwait(&pipe, NULL, &zero);
+		}
+		LOG4CPLUS_ERROR(logger, "Unable to pass " << event << " to helper: " << strerror(errno));
+	}
+}
+
+/*
+ * Points the timer at the earliest deadline
+ */
+void HookRunner::arm() {
+	struct itimerspec its = {{0, 0}, {0, 0}};
+	bool armed = false;
+
+	for (size_t i = 0; i < running.size(); i++) {
+		if (!armed || before(running[i].deadline, its.it_value))
+			its.it_value = running[i].deadline;
+		armed = true;
+	}
+
+	if (coprocess() && helperPid < 0) {
+		if (!armed || before(helperRestart, its.it_value))
+			its.it_value = helperRestart;
+	}
+
+	timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void HookRunner::onChildExit() {
+	struct timespec now;
+	int status;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (helperPid > 0 && waitpid(helperPid, &status, WNOHANG) == helperPid) {
+		if (WIFSIGNALED(status))
+			LOG4CPLUS_ERROR(logger, "Helper killed by signal " << WTERMSIG(status) << ", restarting");
+		else
+			LOG4CPLUS_ERROR(logger, "Helper exited with " << WEXITSTATUS(status) << ", restarting");
+
+		close(helperfd);
+		helperfd = -1;
+		retryHelper();
+	}
+
+	for (size_t i = 0; i < running.size(); ) {
+		pid_t pid = waitpid(running[i].pid, &status, WNOHANG);
+
+		if (pid == 0 || (pid < 0 && errno == EINTR)) {
+			i++;
+			continue;
+		}
+
+		long ms = (now.tv_sec - running[i].started.tv_sec) * 1000 + (now.tv_nsec - running[i].started.tv_nsec) / 1000000;
+
+		metricsAdd(METRIC_HOOK_RUNS);
+		metricsAdd(METRIC_HOOK_MS, ms);
+		if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			metricsAdd(METRIC_HOOK_FAILURES);
+
+		if (pid < 0)
+			LOG4CPLUS_ERROR(logger, "Hook " << running[i].name << " lost: " << strerror(errno));
+		else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			LOG4CPLUS_INFO(logger, "Hook " << running[i].name << " finished after " << ms << "ms");
+		else if (WIFEXITED(status))
+			LOG4CPLUS_ERROR(logger, "Hook " << running[i].name << " failed with " << WEXITSTATUS(status) << " after " << ms << "ms");
+		else if (WIFSIGNALED(status))
+			LOG4CPLUS_ERROR(logger, "Hook " << running[i].name << " killed by signal " << WTERMSIG(status) << " after " << ms << "ms");
+
+		running.erase(running.begin() + i);
+	}
+
+	while (running.size() < maxRunning && !pending.empty()) {
+		Hook hook = pending.front();
+		pending.pop_front();
+		start(hook);
+	}
+
+	arm();
+}
+
+void HookRunner::onTimer() {
+	struct timespec now;
+	uint64_t expirations;
+
+	if (read(timerfd, &expirations, sizeof expirations) < 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (coprocess() && helperPid < 0 && !before(now, helperRestart))
+		startHelper();
+
+	for (size_t i = 0; i < running.size(); i++) {
+		Child &child = running[i];
+
+		if (before(now, child.deadline))
+			continue;
+
+		if (!child.terminated) {
+			LOG4CPLUS_ERROR(logger, "Hook " << child.name << " timed out, terminating");
+			kill(-child.pid, SIGTERM);
+			child.terminated = true;
+			child.deadline = now;
+			addMs(child.deadline, HOOK_KILL_GRACE);
+		} else {
+			LOG4CPLUS_ERROR(logger, "Hook " << child.name << " did not terminate, killing");
+			kill(-child.pid, SIGKILL);
+			// nothing left to escalate, it is reaped on SIGCHLD
+			child.deadline.tv_sec += 3600;
+		}
+	}
+
+	arm();
+}
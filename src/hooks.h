@@ -0,0 +1,118 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <time.h>
+#include <sys/types.h>
+
+#define HOOK_MAX_RUNNING	2
+#define HOOK_TIMEOUT		30000	// ms until a hook gets SIGTERM
+#define HOOK_KILL_GRACE		2000	// ms from SIGTERM to SIGKILL
+#define HOOK_HELPER_RESTART	1000	// ms before a dead helper is started again
+
+/**
+ * Runs the on standby/activate/deactivate commands without blocking the
+ * main loop. Children are started with posix_spawn, reaped on SIGCHLD and
+ * killed when they run too long. Must only be used from the main loop.
+ *
+ * With a helper set, a single long-lived coprocess is started instead and
+ * events are written to its stdin, one line per event.
+ */
+class HookRunner {
+
+	private:
+
+		struct Hook {
+			std::string name;
+			std::string command;
+		};
+
+		struct Child {
+			pid_t pid;
+			std::string name;
+			struct timespec started;
+			struct timespec deadline;
+			bool terminated;	// SIGTERM sent, SIGKILL is next
+		};
+
+		std::deque<Hook> pending;
+		std::vector<Child> running;
+
+		int timerfd;
+
+		pid_t helperPid;
+		int helperfd;
+		struct timespec helperRestart;
+
+		void start(const Hook &hook);
+		void startHelper();
+		void retryHelper();
+		void arm();
+
+	public:
+
+		unsigned maxRunning;
+		unsigned timeout;
+		std::string helper;
+
+		HookRunner();
+		virtual ~HookRunner();
+
+		/**
+		 * Creates the timer, call before the first hook runs
+		 */
+		void setup();
+
+		/**
+		 * Queues a hook. An identical hook that has not started yet
+		 * absorbs this one.
+		 */
+		void run(const std::string &name, const std::string &command);
+
+		/**
+		 * True when events go to the helper instead of separate hooks
+		 */
+		bool coprocess() const { return !helper.empty(); };
+
+		/**
+		 * Writes one event line to the helper, dropped while it is down
+		 */
+		void notify(const std::string &event);
+
+		/**
+		 * Reaps finished children, call on SIGCHLD
+		 */
+		void onChildExit();
+
+		/**
+		 * Kills children that ran out of time, call when fd() is readable
+		 */
+		void onTimer();
+
+		/**
+		 * The timerfd for the next deadline
+		 */
+		int fd() const { return timerfd; };
+};
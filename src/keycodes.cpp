@@ -0,0 +1,43 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "keycodes.h"
+
+using namespace CEC;
+
+/*
+ * Looks up one code in CEC_KEYCODES. Only ever evaluated by the compiler,
+ * to fill cecKeys below.
+ */
+static constexpr CecKey makeCecKey(unsigned code) {
+	return
+#define X(code_, lirc1, lirc2) \
+		code == CEC_USER_CONTROL_CODE_##code_ ? \
+			CecKey{ #code_, (lirc1 != NULL) + (lirc2 != NULL), { lirc1, lirc2 } } :
+	CEC_KEYCODES(X)
+#undef X
+		CecKey{ NULL, 0, { NULL, NULL } };
+}
+
+#define K4(n)	makeCecKey(n), makeCecKey(n + 1), makeCecKey(n + 2), makeCecKey(n + 3)
+#define K16(n)	K4(n), K4(n + 4), K4(n + 8), K4(n + 12)
+#define K64(n)	K16(n), K16(n + 16), K16(n + 32), K16(n + 48)
+
+const CecKey cecKeys[256] = { K64(0), K64(64), K64(128), K64(192) };
@@ -0,0 +1,135 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <libcec/cectypes.h>
+
+#define LIRC_KEY_LINES	2
+
+/*
+ * The one place that lists the CEC user control codes: the name we log and
+ * the LIRC key names (libcec-daemon's KEY_* names) sent for each of them.
+ *
+ *   X(code, lirc name, second lirc name)
+ */
+#define CEC_KEYCODES(X) \
+	X(SELECT,                      "KEY_OK",          NULL) \
+	X(UP,                          "KEY_UP",          NULL) \
+	X(DOWN,                        "KEY_DOWN",        NULL) \
+	X(LEFT,                        "KEY_LEFT",        NULL) \
+	X(RIGHT,                       "KEY_RIGHT",       NULL) \
+	X(RIGHT_UP,                    "KEY_RIGHT",       "KEY_UP") \
+	X(RIGHT_DOWN,                  "KEY_RIGHT",       "KEY_DOWN") \
+	X(LEFT_UP,                     "KEY_LEFT",        "KEY_UP") \
+	X(LEFT_DOWN,                   "KEY_LEFT",        "KEY_DOWN") \
+	X(ROOT_MENU,                   "KEY_HOME",        NULL) \
+	X(SETUP_MENU,                  "KEY_SETUP",       NULL) \
+	X(CONTENTS_MENU,               "KEY_MENU",        NULL) \
+	X(FAVORITE_MENU,               "KEY_FAVORITES",   NULL) \
+	X(EXIT,                        "KEY_EXIT",        NULL) \
+	X(NUMBER0,                     "KEY_0",           NULL) \
+	X(NUMBER1,                     "KEY_1",           NULL) \
+	X(NUMBER2,                     "KEY_2",           NULL) \
+	X(NUMBER3,                     "KEY_3",           NULL) \
+	X(NUMBER4,                     "KEY_4",           NULL) \
+	X(NUMBER5,                     "KEY_5",           NULL) \
+	X(NUMBER6,                     "KEY_6",           NULL) \
+	X(NUMBER7,                     "KEY_7",           NULL) \
+	X(NUMBER8,                     "KEY_8",           NULL) \
+	X(NUMBER9,                     "KEY_9",           NULL) \
+	X(DOT,                         "KEY_DOT",         NULL) \
+	X(ENTER,                       "KEY_ENTER",       NULL) \
+	X(CLEAR,                       "KEY_BACKSPACE",   NULL) \
+	X(NEXT_FAVORITE,               NULL,              NULL) \
+	X(CHANNEL_UP,                  "KEY_CHANNELUP",   NULL) \
+	X(CHANNEL_DOWN,                "KEY_CHANNELDOWN", NULL) \
+	X(PREVIOUS_CHANNEL,            "KEY_PREVIOUS",    NULL) \
+	X(SOUND_SELECT,                "KEY_SOUND",       NULL) \
+	X(INPUT_SELECT,                "KEY_TUNER",       NULL) \
+	X(DISPLAY_INFORMATION,         "KEY_INFO",        NULL) \
+	X(HELP,                        "KEY_HELP",        NULL) \
+	X(PAGE_UP,                     "KEY_PAGEUP",      NULL) \
+	X(PAGE_DOWN,                   "KEY_PAGEDOWN",    NULL) \
+	X(POWER,                       "KEY_POWER",       NULL) \
+	X(VOLUME_UP,                   "KEY_VOLUMEUP",    NULL) \
+	X(VOLUME_DOWN,                 "KEY_VOLUMEDOWN",  NULL) \
+	X(MUTE,                        "KEY_MUTE",        NULL) \
+	X(PLAY,                        "KEY_PLAY",        NULL) \
+	X(STOP,                        "KEY_STOP",        NULL) \
+	X(PAUSE,                       "KEY_PAUSE",       NULL) \
+	X(RECORD,                      "KEY_RECORD",      NULL) \
+	X(REWIND,                      "KEY_REWIND",      NULL) \
+	X(FAST_FORWARD,                "KEY_FASTFORWARD", NULL) \
+	X(EJECT,                       "KEY_EJECTCD",     NULL) \
+	X(FORWARD,                     "KEY_FORWARD",     NULL) \
+	X(BACKWARD,                    "KEY_BACK",        NULL) \
+	X(STOP_RECORD,                 NULL,              NULL) \
+	X(PAUSE_RECORD,                NULL,              NULL) \
+	X(ANGLE,                       "KEY_SCREEN",      NULL) \
+	X(SUB_PICTURE,                 "KEY_SUBTITLE",    NULL) \
+	X(VIDEO_ON_DEMAND,             "KEY_VIDEO",       NULL) \
+	X(ELECTRONIC_PROGRAM_GUIDE,    "KEY_EPG",         NULL) \
+	X(TIMER_PROGRAMMING,           "KEY_TIME",        NULL) \
+	X(INITIAL_CONFIGURATION,       "KEY_CONFIG",      NULL) \
+	X(PLAY_FUNCTION,               NULL,              NULL) \
+	X(PAUSE_PLAY_FUNCTION,         NULL,              NULL) \
+	X(RECORD_FUNCTION,             NULL,              NULL) \
+	X(PAUSE_RECORD_FUNCTION,       NULL,              NULL) \
+	X(STOP_FUNCTION,               NULL,              NULL) \
+	X(MUTE_FUNCTION,               NULL,              NULL) \
+	X(RESTORE_VOLUME_FUNCTION,     NULL,              NULL) \
+	X(TUNE_FUNCTION,               NULL,              NULL) \
+	X(SELECT_MEDIA_FUNCTION,       "KEY_MEDIA",       NULL) \
+	X(SELECT_AV_INPUT_FUNCTION,    NULL,              NULL) \
+	X(SELECT_AUDIO_INPUT_FUNCTION, NULL,              NULL) \
+	X(POWER_TOGGLE_FUNCTION,       NULL,              NULL) \
+	X(POWER_OFF_FUNCTION,          NULL,              NULL) \
+	X(POWER_ON_FUNCTION,           NULL,              NULL) \
+	X(F1_BLUE,                     "KEY_BLUE",        NULL) \
+	X(F2_RED,                      "KEY_RED",         NULL) \
+	X(F3_GREEN,                    "KEY_GREEN",       NULL) \
+	X(F4_YELLOW,                   "KEY_YELLOW",      NULL) \
+	X(F5,                          NULL,              NULL) \
+	X(DATA,                        "KEY_TEXT",        NULL) \
+	X(AN_RETURN,                   "KEY_ESC",         NULL) \
+	X(AN_CHANNELS_LIST,            "KEY_LIST",        NULL) \
+	X(UNKNOWN,                     NULL,              NULL)
+
+/**
+ * Everything we know about one user control code
+ */
+struct CecKey
+{
+	const char *name;			// without the CEC_USER_CONTROL_CODE_ prefix
+	unsigned count;				// number of LIRC key names
+	const char *lirc[LIRC_KEY_LINES];
+};
+
+/**
+ * Dense table indexed by the user control code byte, built at compile time
+ */
+extern const CecKey cecKeys[256];
+
+inline const CecKey & cecKey(CEC::cec_user_control_code code) {
+	return cecKeys[(uint8_t)code];
+}
@@ -0,0 +1,239 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "keymap.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::string;
+
+static Logger logger = Logger::getInstance("keymap");
+
+Keymap::Keymap() : current(NULL), generation(0), inotifyfd(-1) {
+	LircKeys *keys = new LircKeys();
+
+	readers[0] = 0;
+	readers[1] = 0;
+
+	for (unsigned keycode = 0; keycode <= CEC_USER_CONTROL_CODE_MAX; keycode++) {
+		for (unsigned i = 0; i < cecKeys[keycode].count; i++)
+			addLine(keys->keys[keycode], keycode, cecKeys[keycode].lirc[i]);
+	}
+
+	current = keys;
+}
+
+Keymap::~Keymap() {
+	if (inotifyfd >= 0)
+		close(inotifyfd);
+	delete current.load();
+}
+
+/*
+ * Renders one LIRC line for keycode
+ */
+bool Keymap::addLine(LircKey & key, unsigned keycode, const char *name) {
+	if (key.count == LIRC_KEY_LINES)
+		return false;
+
+	int prefix = snprintf(key.lines[key.count].text, LIRC_LINE_MAX, "%x ", keycode);
+	int len = snprintf(key.lines[key.count].text, LIRC_LINE_MAX, "%x 00 %s RPICEC\n", keycode, name);
+
+	if (len >= LIRC_LINE_MAX) {
+		LOG4CPLUS_ERROR(logger, "Keymap::addLine() " << name << " too long");
+		return false;
+	}
+
+	key.lines[key.count].len = len;
+	key.lines[key.count].repeatPos = prefix;
+	key.count++;
+
+	return true;
+}
+
+/*
+ * Publishes keys and frees the previous table after a grace period
+ */
+void Keymap::swap(LircKeys *keys) {
+	LircKeys *old = current.exchange(keys);
+	unsigned slot = generation.fetch_add(1) & 1;
+
+	// wait for everybody who might have picked up the old table
+	while (readers[slot].load() != 0)
+		sched_yield();
+
+	delete old;
+}
+
+bool Keymap::load(const string &path) {
+	LOG4CPLUS_TRACE_STR(logger, "Keymap::load() " + path);
+
+	// reloads happen after daemon() has moved to /
+	char *absolute = realpath(path.c_str(), NULL);
+	if (!absolute) {
+		LOG4CPLUS_ERROR(logger, "Unable to open " << path << ": " << strerror(errno));
+		return false;
+	}
+	string file(absolute);
+	free(absolute);
+
+	struct stat st;
+	int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		LOG4CPLUS_ERROR(logger, "Unable to open " << path << ": " << strerror(errno));
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(keymap_header)) {
+		LOG4CPLUS_ERROR(logger, path << " is not a keymap");
+		close(fd);
+		return false;
+	}
+
+	size_t length = st.st_size;
+	void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		LOG4CPLUS_ERROR(logger, "Unable to map " << path << ": " << strerror(errno));
+		return false;
+	}
+
+	const char *base = (const char *)map;
+	const keymap_header *header = (const keymap_header *)map;
+	const keymap_slot *slots = (const keymap_slot *)(base + sizeof *header);
+	bool valid = memcmp(header->magic, KEYMAP_MAGIC, sizeof header->magic) == 0
+			&& header->length == length
+			&& header->bits >= 1 && header->bits <= KEYMAP_MAX_BITS;
+
+	// only shifted by once it is known to be small
+	if (valid) {
+		size_t nslots = (size_t)1 << header->bits;
+		valid = header->strings >= sizeof *header + nslots * sizeof *slots
+			&& header->strings <= length;
+	}
+
+	if (!valid) {
+		LOG4CPLUS_ERROR(logger, path << " is not a valid keymap");
+		munmap(map, length);
+		return false;
+	}
+
+	const char *strings = base + header->strings;
+	unsigned count = header->count;
+	size_t stringsLength = length - header->strings;
+	LircKeys *keys = new LircKeys();
+
+	for (unsigned key = 0; key <= (KEYMAP_LONG | CEC_USER_CONTROL_CODE_MAX) && valid; key++) {
+		const keymap_slot & slot = slots[keymap_hash(key, header->seed, header->bits)];
+		unsigned keycode = key & ~KEYMAP_LONG;
+
+		if (keycode > CEC_USER_CONTROL_CODE_MAX || slot.key != key)
+			continue;
+
+		LircKey & lircKey = (key & KEYMAP_LONG) ? keys->longKeys[keycode] : keys->keys[keycode];
+
+		for (unsigned i = 0; i < slot.count && i < LIRC_KEY_LINES; i++) {
+			if (slot.names[i] >= stringsLength || !memchr(strings + slot.names[i], 0, stringsLength - slot.names[i])) {
+				valid = false;
+				break;
+			}
+			addLine(lircKey, keycode, strings + slot.names[i]);
+		}
+	}
+
+	munmap(map, length);
+
+	if (!valid) {
+		LOG4CPLUS_ERROR(logger, path << " has a broken string table");
+		delete keys;
+		return false;
+	}
+
+	this->path = file;
+	swap(keys);
+
+	LOG4CPLUS_INFO(logger, "Loaded keymap " << path << " (" << count << " keys)");
+	return true;
+}
+
+bool Keymap::watch() {
+	if (path.empty())
+		return false;
+
+	inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyfd < 0) {
+		LOG4CPLUS_ERROR(logger, "Unable to create inotify instance: " << strerror(errno));
+		return false;
+	}
+
+	// watch the directory, editors and installers replace the file by renaming
+	char *dir = strdup(path.c_str());
+	int wd = inotify_add_watch(inotifyfd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO);
+	free(dir);
+
+	if (wd < 0) {
+		LOG4CPLUS_ERROR(logger, "Unable to watch " << path << ": " << strerror(errno));
+		close(inotifyfd);
+		inotifyfd = -1;
+		return false;
+	}
+
+	return true;
+}
+
+bool Keymap::changed() {
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+	ssize_t len;
+
+	if (inotifyfd < 0)
+		return false;
+
+	char *file = strdup(path.c_str());
+	const char *name = basename(file);
+
+	while ((len = read(inotifyfd, buf, sizeof buf)) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			const struct inotify_event *event = (const struct inotify_event *)p;
+
+			if (event->len && strcmp(event->name, name) == 0)
+				changed = true;
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	free(file);
+
+	if (changed)
+		LOG4CPLUS_INFO(logger, "Keymap " << path << " changed");
+
+	return changed;
+}
@@ -0,0 +1,183 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+#include "keycodes.h"
+#include "lirc.h"
+
+/*
+ * Compiled translation table, as written by ceclircd-keymap and mapped by
+ * the daemon. The slots form a perfect hash: every key lands in its own
+ * slot for the seed stored in the header. Names are offsets into a table
+ * of NUL terminated strings at the end of the file.
+ */
+#define KEYMAP_MAGIC		"CECKMAP1"
+#define KEYMAP_EMPTY		0xffffffff
+#define KEYMAP_MAX_BITS		16
+#define KEYMAP_LONG		0x100	// or'ed into the keycode of a long press mapping
+
+struct keymap_header {
+	char magic[8];
+	uint32_t seed;
+	uint32_t bits;		// the table has 1 << bits slots
+	uint32_t count;		// used slots
+	uint32_t strings;	// offset of the string table
+	uint32_t length;	// total file length
+};
+
+struct keymap_slot {
+	uint32_t key;		// the keycode, maybe | KEYMAP_LONG, KEYMAP_EMPTY if unused
+	uint32_t count;
+	uint32_t names[LIRC_KEY_LINES];
+};
+
+static inline uint32_t keymap_hash(uint32_t key, uint32_t seed, uint32_t bits) {
+	return ((key ^ seed) * 0x9e3779b1u) >> (32 - bits);
+}
+
+/**
+ * Ready-to-send LIRC lines for one cec_user_control_code, only the repeat
+ * counter has to be patched in before sending
+ */
+struct LircKey
+{
+	unsigned count;
+	struct
+	{
+		uint16_t len;
+		uint16_t repeatPos;	// offset of the two hex digits of the repeat counter
+		char text[LIRC_LINE_MAX];
+	} lines[LIRC_KEY_LINES];
+};
+
+struct LircKeys
+{
+	LircKey keys[CEC::CEC_USER_CONTROL_CODE_MAX + 1];
+	LircKey longKeys[CEC::CEC_USER_CONTROL_CODE_MAX + 1];	// held past the long press threshold, mostly empty
+};
+
+/**
+ * The live translation table. Starts out with the built-in CEC_KEYCODES
+ * and can be replaced at runtime from a compiled keymap file. Readers never
+ * block, a replaced table is freed once no reader can still see it.
+ */
+class Keymap {
+
+	private:
+
+		std::atomic<LircKeys *> current;
+
+		// readers announce themselves in the slot of the generation they started in
+		std::atomic<unsigned> generation;
+		std::atomic<unsigned> readers[2];
+
+		std::string path;
+		int inotifyfd;
+
+		// Not implemented, the table is owned by this instance
+		Keymap(Keymap const&);
+		void operator=(Keymap const&);
+
+		void swap(LircKeys *keys);
+
+	public:
+
+		/**
+		 * Renders one LIRC line for name into key, false if it is full
+		 * or the name too long
+		 */
+		static bool addLine(LircKey & key, unsigned keycode, const char *name);
+
+		Keymap();
+		virtual ~Keymap();
+
+		/**
+		 * Loads a compiled keymap file and makes it the live table,
+		 * remembering its absolute path for reload()
+		 */
+		bool load(const std::string &path);
+
+		/**
+		 * Reloads the file given to load() whenever it is rewritten
+		 */
+		bool watch();
+
+		/**
+		 * The inotify fd, readable when watch() saw a change
+		 */
+		int fd() const { return inotifyfd; };
+
+		/**
+		 * Reads pending inotify events, never blocks. Returns true if
+		 * the keymap file was among them.
+		 */
+		bool changed();
+
+		/**
+		 * Loads the file given to load() again
+		 */
+		bool reload() { return load(path); };
+
+		/**
+		 * Keeps the table it was created with alive for its own lifetime
+		 */
+		class Reader {
+			private:
+				Keymap & keymap;
+				unsigned slot;
+				const LircKeys *keys;
+
+				Reader(Reader const&);
+				void operator=(Reader const&);
+
+			public:
+				Reader(Keymap & keymap) : keymap(keymap) {
+					// a swap between reading the generation and announcing
+					// ourselves would not wait for us, so check it is still
+					// the same once we are counted
+					for (;;) {
+						unsigned gen = keymap.generation.load();
+						slot = gen & 1;
+						keymap.readers[slot]++;
+						if (keymap.generation.load() == gen)
+							break;
+						keymap.readers[slot]--;
+					}
+					keys = keymap.current.load();
+				}
+
+				~Reader() {
+					keymap.readers[slot]--;
+				}
+
+				const LircKey & operator[](unsigned keycode) const {
+					return keys->keys[keycode];
+				}
+
+				const LircKey & longPress(unsigned keycode) const {
+					return keys->longKeys[keycode];
+				}
+		};
+};
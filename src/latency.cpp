@@ -0,0 +1,106 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "latency.h"
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace log4cplus;
+
+static Logger logger = Logger::getInstance("latency");
+
+static const char *stageNames[LATENCY_STAGES] = { "bus", "mapped", "queued", "written" };
+
+Histogram latency[LATENCY_STAGES];
+
+thread_local uint64_t latencyStart = 0;
+
+Histogram::Histogram() {
+	reset();
+}
+
+/*
+ * Values below 2^SUB_BITS get a bucket each, above that every power of two
+ * is split into 2^SUB_BITS linear buckets.
+ */
+unsigned Histogram::bucket(uint64_t us) {
+	if (us >> 32)
+		return HISTOGRAM_BUCKETS - 1;
+	if (us < (1u << HISTOGRAM_SUB_BITS))
+		return us;
+
+	unsigned exp = 31 - __builtin_clz((uint32_t)us);
+	unsigned sub = (us >> (exp - HISTOGRAM_SUB_BITS)) & ((1u << HISTOGRAM_SUB_BITS) - 1);
+
+	return ((exp - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + sub;
+}
+
+uint64_t Histogram::lower(unsigned bucket) {
+	if (bucket < (1u << HISTOGRAM_SUB_BITS))
+		return bucket;
+
+	unsigned exp = (bucket >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+	uint64_t sub = bucket & ((1u << HISTOGRAM_SUB_BITS) - 1);
+
+	return ((1ull << HISTOGRAM_SUB_BITS) + sub) << (exp - HISTOGRAM_SUB_BITS);
+}
+
+void Histogram::reset() {
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+		buckets[i].store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const {
+	uint64_t total = 0;
+
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+		total += buckets[i].load(std::memory_order_relaxed);
+
+	return total;
+}
+
+uint64_t Histogram::percentile(double q) const {
+	uint64_t total = count();
+	uint64_t rank = (uint64_t)(q * total + 0.5);
+	uint64_t seen = 0;
+
+	if (total == 0)
+		return 0;
+	if (rank == 0)
+		rank = 1;
+
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return lower(i);
+	}
+
+	return lower(HISTOGRAM_BUCKETS - 1);
+}
+
+void latencyReport() {
+	for (unsigned i = 0; i < LATENCY_STAGES; i++) {
+		LOG4CPLUS_INFO(logger, "Latency " << stageNames[i] << ": " << latency[i].count() << " samples"
+			<< ", p50 " << latency[i].percentile(0.5) << "us"
+			<< ", p99 " << latency[i].percentile(0.99) << "us"
+			<< ", p999 " << latency[i].percentile(0.999) << "us");
+	}
+}
@@ -0,0 +1,97 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+// 16 linear buckets per power of two, about 6% error, up to 2^32us
+#define HISTOGRAM_SUB_BITS	4
+#define HISTOGRAM_BUCKETS	((32 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+/*
+ * Where a key spent its time. Every stage but LATENCY_BUS is measured from
+ * the entry into the libcec callback.
+ */
+typedef enum {
+	LATENCY_BUS,		// CEC frame logged by libcec -> callback, estimated
+	LATENCY_MAPPED,		// callback -> LIRC lines ready in LircSink::key
+	LATENCY_QUEUED,		// callback -> taken off the event queue by the lirc thread
+	LATENCY_WRITTEN,	// callback -> written to a client, once per client
+	LATENCY_STAGES
+} latency_stage_t;
+
+/**
+ * Log-linear histogram of microseconds. record() is a single relaxed
+ * atomic increment, so any thread can call it.
+ */
+class Histogram {
+
+	private:
+
+		std::atomic<uint32_t> buckets[HISTOGRAM_BUCKETS];
+
+		static unsigned bucket(uint64_t us);
+		static uint64_t lower(unsigned bucket);
+
+	public:
+
+		Histogram();
+
+		void record(uint64_t us) { buckets[bucket(us)].fetch_add(1, std::memory_order_relaxed); };
+
+		uint64_t count() const;
+
+		void reset();
+
+		/**
+		 * Lower bound of the bucket holding the q quantile, 0 < q <= 1
+		 */
+		uint64_t percentile(double q) const;
+};
+
+extern Histogram latency[LATENCY_STAGES];
+
+// set on entry into a libcec callback, 0 on threads outside a callback
+extern thread_local uint64_t latencyStart;
+
+inline uint64_t latencyNow() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+inline void latencyRecord(latency_stage_t stage, uint64_t start, uint64_t now) {
+	if (start && now >= start)
+		latency[stage].record(now - start);
+}
+
+inline void latencyRecord(latency_stage_t stage, uint64_t start) {
+	if (start)
+		latencyRecord(stage, start, latencyNow());
+}
+
+/**
+ * Logs p50/p99/p999 of every stage
+ */
+void latencyReport();
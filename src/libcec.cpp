@@ -41,13 +41,19 @@
  
 #include "libcec.h"
 #include "hdmi.h"
+#include "keycodes.h"
+#include "latency.h"
+#include "capture.h"
+#include "flight.h"
 
 #include <cstdio>
 #include <iostream>
 #include <ostream>
 #include <stdexcept>
 #include <cassert>
-#include <map>
+#include <climits>
+#include <cstring>
+#include <atomic>
 
 #include <log4cplus/logger.h>
 #include <log4cplus/loggingmacros.h>
@@ -56,7 +62,6 @@ using namespace CEC;
 using namespace log4cplus;
 
 using std::endl;
-using std::map;
 using std::ostream;
 using std::string;
 
@@ -69,13 +74,54 @@ static Logger logger = Logger::getInstance("libcec");
 
 #define MAX_CEC_PORTS (CEC_MAX_HDMI_PORTNUMBER-CEC_MIN_HDMI_PORTNUMBER)
 
-// Map of control codes to Strings
-const map<enum cec_user_control_code, const char *> Cec::cecUserControlCodeName = Cec::setupUserControlCodeName();
+// We store a global handle, so we can use g_backend->toString(..) in certain cases. This is a bit of a HACK :(
+static CecBackend * g_backend = NULL;
 
-// We store a global handle, so we can use g_cec->ToString(..) in certain cases. This is a bit of a HACK :(
-static ICECAdapter * g_cec = NULL;
+// libcec stamps log messages with its own clock in ms. The smallest
+// difference to ours seen so far is taken as the offset between both.
+static std::atomic<int64_t> busOffset(LLONG_MAX);
+// when the last frame came off the bus, our clock in us, 0 once consumed
+static std::atomic<uint64_t> busReceived(0);
+
+// libcec 2.x has no log level of its own, messages outside it end in the trampoline
+static std::atomic<int> logMask(CEC_LOG_ALL);
+
+static void onBusTraffic(const cec_log_message &message) {
+	int64_t now = latencyNow() / 1000;
+	int64_t offset = now - message.time;
+
+	if (offset < busOffset.load(std::memory_order_relaxed))
+		busOffset.store(offset, std::memory_order_relaxed);
+
+	busReceived.store((message.time + busOffset.load(std::memory_order_relaxed)) * 1000, std::memory_order_relaxed);
+}
+
+/*
+ * Stamps a key or command callback for as long as it runs, see latency.h.
+ * Whatever the thread posts afterwards is not this callback's.
+ */
+struct CallbackStamp {
+	CallbackStamp() {
+		latencyStart = latencyNow();
+
+		uint64_t received = busReceived.exchange(0, std::memory_order_relaxed);
+		if (received)
+			latencyRecord(LATENCY_BUS, received, latencyStart);
+	}
+
+	~CallbackStamp() {
+		latencyStart = 0;
+	}
+};
 
 int cecLogMessage(void *cbParam, const cec_log_message message) {
+	// received frames are logged as ">> 0f:44:01"
+	if (message.level == CEC_LOG_TRAFFIC && strncmp(message.message, ">> ", 3) == 0)
+		onBusTraffic(message);
+
+	if (!(message.level & logMask.load(std::memory_order_relaxed)))
+		return 1;
+
 	try {
 		return ((CecCallback*) cbParam)->onCecLogMessage(message);
 	} catch (...) {}
@@ -83,6 +129,9 @@ int cecLogMessage(void *cbParam, const cec_log_message message) {
 }
 
 int cecKeyPress(void *cbParam, const cec_keypress key) {
+	CallbackStamp stamp;
+	captureKeyPress(key);
+	flightRecord(FLIGHT_KEYPRESS, key.keycode, 0, 0, key.duration);
 	try {
 		return ((CecCallback*) cbParam)->onCecKeyPress(key);
 	} catch (...) {}
@@ -90,6 +139,10 @@ int cecKeyPress(void *cbParam, const cec_keypress key) {
 }
 
 int cecCommand(void *cbParam, const cec_command command) {
+	CallbackStamp stamp;
+	captureCommand(command);
+	flightRecord(FLIGHT_COMMAND, 0, command.opcode, (command.initiator & 0xf) << 4 | (command.destination & 0xf),
+		command.parameters.size ? command.parameters[0] : 0, command.parameters.size);
 	try {
 		return ((CecCallback*) cbParam)->onCecCommand(command);
 	} catch (...) {}
@@ -97,6 +150,8 @@ int cecCommand(void *cbParam, const cec_command command) {
 }
 
 int cecAlert(void *cbParam, const libcec_alert alert, const libcec_parameter param) {
+	captureAlert(alert, param);
+	flightRecord(FLIGHT_ALERT, 0, 0, 0, alert);
 	try {
 		return ((CecCallback*) cbParam)->onCecAlert(alert, param);
 	} catch (...) {}
@@ -104,6 +159,8 @@ int cecAlert(void *cbParam, const libcec_alert alert, const libcec_parameter par
 }
 
 int cecConfigurationChanged(void *cbParam, const libcec_configuration configuration) {
+	captureConfigurationChanged(configuration);
+	flightRecord(FLIGHT_CONFIGURATION, 0, 0, (configuration.logicalAddresses.primary & 0xf) << 4, 0);
 	try {
 		return ((CecCallback*) cbParam)->onCecConfigurationChanged(configuration);
 	} catch (...) {}
@@ -118,6 +175,8 @@ int cecMenuStateChanged(void *cbParam, const cec_menu_state menu_state) {
 }
 
 void cecSourceActivated(void *cbParam, const cec_logical_address address, const uint8_t val) {
+	captureSourceActivated(address, val);
+	flightRecord(FLIGHT_SOURCE, 0, 0, (address & 0xf) << 4, val);
 	try {
 		return ((CecCallback*) cbParam)->onCecSourceActivated(address, val);
 	} catch (...) {}
@@ -129,7 +188,6 @@ struct ICECAdapterDeleter : std::default_delete<ICECAdapter> {
 	void operator()(ICECAdapter* ptr) const {
 		if (ptr) {
 			UnloadLibCec(ptr);
-			g_cec = NULL;
 		}
 	}
 };
@@ -156,6 +214,60 @@ public:
 	}
 };
 
+/**
+ * The real thing, libcec loaded at runtime
+ */
+class LibCecBackend : public CecBackend {
+	private:
+		std::unique_ptr<ICECAdapter, ICECAdapterDeleter> cec;
+
+	public:
+		bool init(libcec_configuration &config) {
+			if (cec)
+				return true;
+
+			// LibCecInitialise is noisy, so we redirect cout to nowhere
+			RedirectStreamBuffer redirect(cout, 0);
+			cec.reset(LibCecInitialise(&config));
+			if (!cec)
+				return false;
+			cec->InitVideoStandalone();
+			return true;
+		}
+
+		void release() { cec.reset(); }
+
+		// after a failed init() there is no adapter, everything fails until the next one works
+		int8_t findAdapters(cec_adapter *devices, uint8_t size) { return cec ? cec->FindAdapters(devices, size, NULL) : -1; }
+		bool open(const char *port) { return cec && cec->Open(port); }
+		void close() { if (cec) cec->Close(); }
+		bool ping() { return cec && cec->PingAdapter(); }
+
+		bool setActiveSource(cec_device_type type) { return cec && cec->SetActiveSource(type); }
+		bool setInactiveView() { return cec && cec->SetInactiveView(); }
+
+		cec_logical_addresses getActiveDevices() {
+			cec_logical_addresses none;
+			memset(&none, 0, sizeof none);
+			none.primary = CECDEVICE_UNREGISTERED;
+			return cec ? cec->GetActiveDevices() : none;
+		}
+		uint16_t getDevicePhysicalAddress(cec_logical_address address) {
+			return cec ? cec->GetDevicePhysicalAddress(address) : CEC_INVALID_PHYSICAL_ADDRESS;
+		}
+		cec_osd_name getDeviceOSDName(cec_logical_address address) {
+			cec_osd_name none;
+			memset(&none, 0, sizeof none);
+			none.device = address;
+			return cec ? cec->GetDeviceOSDName(address) : none;
+		}
+		uint64_t getDeviceVendorId(cec_logical_address address) { return cec ? cec->GetDeviceVendorId(address) : CEC_VENDOR_UNKNOWN; }
+
+		const char *toString(cec_logical_address address) { return cec ? cec->ToString(address) : "unknown"; }
+		const char *toString(cec_opcode opcode) { return cec ? cec->ToString(opcode) : "unknown"; }
+		const char *toString(cec_vendor_id vendor) { return cec ? cec->ToString(vendor) : "unknown"; }
+};
+
 Cec::Cec(const char * name, CecCallback * callback) {
 	assert(name != NULL);
 	assert(callback != NULL);
@@ -190,21 +302,27 @@ Cec::Cec(const char * name, CecCallback * callback) {
 	config.callbacks                    = &callbacks;
 }
 
-Cec::~Cec() {}
+Cec::~Cec() {
+	if (g_backend == backend.get())
+		g_backend = NULL;
+}
+
+void Cec::setBackend(CecBackend *backend) {
+	if (g_backend == this->backend.get())
+		g_backend = NULL;
+	this->backend.reset(backend);
+}
 
 void Cec::init()
 {
-    if (! cec)
+    if (! backend)
     {
-        // LibCecInitialise is noisy, so we redirect cout to nowhere
-        RedirectStreamBuffer redirect(cout, 0);
-        g_cec = LibCecInitialise(&config);
-        if (! g_cec) {
-            throw std::runtime_error("Failed to initialise libCEC");
-        }
-        cec = std::unique_ptr<CEC::ICECAdapter>(g_cec, ICECAdapterDeleter());
-        cec->InitVideoStandalone();
+        backend.reset(new LibCecBackend());
     }
+    if (! backend->init(config)) {
+        throw std::runtime_error("Failed to initialise libCEC");
+    }
+    g_backend = backend.get();
 }
 
 void Cec::open(const std::string &name) {
@@ -216,7 +334,7 @@ void Cec::open(const std::string &name) {
 	// Search for adapters
 	cec_adapter devices[MAX_CEC_PORTS];
 
-	uint8_t ret = cec->FindAdapters(devices, MAX_CEC_PORTS, NULL);
+	int8_t ret = backend->findAdapters(devices, MAX_CEC_PORTS);
 	if (ret < 0) {
 		throw std::runtime_error("Error occurred searching for adapters");
 	}
@@ -244,19 +362,59 @@ void Cec::open(const std::string &name) {
 	// Just use the first found
 	LOG4CPLUS_INFO(logger, "Openning " << devices[id].path);
 
-	if (!cec->Open(devices[id].comm)) {
+	if (!backend->open(devices[id].comm)) {
 		throw std::runtime_error("Failed to open adapter");
 	}
 
 	LOG4CPLUS_INFO(logger, "Opened " << devices[id].path);
+
+	// reopen() goes straight back to it
+	adapter = name;
+	port = devices[id].comm;
+}
+
+bool Cec::reopen() {
+	assert(backend);
+
+	if (port.empty())
+		return reinit();
+
+	try {
+		init();
+	} catch (std::exception &e) {
+		LOG4CPLUS_ERROR(logger, e.what());
+		return false;
+	}
+
+	LOG4CPLUS_INFO(logger, "Reopening " << port);
+	return backend->open(port.c_str());
+}
+
+bool Cec::reinit() {
+	assert(backend);
+
+	LOG4CPLUS_INFO(logger, "Reinitialising");
+	backend->release();
+
+	try {
+		open(adapter);
+	} catch (std::exception &e) {
+		LOG4CPLUS_ERROR(logger, e.what());
+		return false;
+	}
+	return true;
 }
 
 void Cec::close(bool makeInactive) {
-	assert(cec);
+	assert(backend);
 
     if (makeInactive)
-        cec->SetInactiveView();
-    cec->Close();
+        backend->setInactiveView();
+    backend->close();
+}
+
+void Cec::setLogMask(int mask) {
+	logMask.store(mask, std::memory_order_relaxed);
 }
 
 void Cec::setTargetAddress(const HDMI::address & address) {
@@ -269,18 +427,18 @@ void Cec::setTargetAddress(const HDMI::address & address) {
 }
 
 void Cec::makeActive() {
-	assert(cec);
+	assert(backend);
 
 	// and made active
-	if (!cec->SetActiveSource(config.deviceTypes[0])) {
+	if (!backend->setActiveSource(config.deviceTypes[0])) {
 		throw std::runtime_error("Failed to become active");
 	}
 }
 
 bool Cec::ping() {
-	assert(cec);
+	assert(backend);
 
-    return cec->PingAdapter();
+    return backend->ping();
 }
 
 
@@ -293,7 +451,7 @@ ostream & Cec::listDevices(ostream & out) {
 
     init();
 
-	int8_t ret = cec->FindAdapters(devices, MAX_CEC_PORTS, NULL);
+	int8_t ret = backend->findAdapters(devices, MAX_CEC_PORTS);
 	if (ret < 0) {
 		LOG4CPLUS_ERROR(logger, "Error occurred searching for adapters");
 		return out;
@@ -306,22 +464,22 @@ ostream & Cec::listDevices(ostream & out) {
 	for (int8_t i = 0; i < ret; i++) {
 		out << "[" << (int) i << "] port:" << devices[i].comm << " path:" << devices[i].path << endl;
 
-		if (!cec->Open(devices[i].comm)) {
+		if (!backend->open(devices[i].comm)) {
 			out << "\tFailed to open" << endl;
 		}
 
-		cec_logical_addresses devices = cec->GetActiveDevices();
+		cec_logical_addresses devices = backend->getActiveDevices();
 		for (int j = 0; j < 16; j++) {
 			if (devices[j]) {
 				cec_logical_address logical_addres = (cec_logical_address) j;
 
-                HDMI::physical_address physical_address(cec->GetDevicePhysicalAddress(logical_addres));
-				cec_osd_name name = cec->GetDeviceOSDName(logical_addres);
-				cec_vendor_id vendor = (cec_vendor_id) cec->GetDeviceVendorId(logical_addres);
+                HDMI::physical_address physical_address(backend->getDevicePhysicalAddress(logical_addres));
+				cec_osd_name name = backend->getDeviceOSDName(logical_addres);
+				cec_vendor_id vendor = (cec_vendor_id) backend->getDeviceVendorId(logical_addres);
 
-				out << "\t"  << cec->ToString(logical_addres)
+				out << "\t"  << backend->toString(logical_addres)
 				    << "@"  << physical_address
-				    << " "   << name.name << " (" << cec->ToString(vendor) << ")"
+				    << " "   << name.name << " (" << backend->toString(vendor) << ")"
 				    << endl;
 			}
 		}
@@ -329,106 +487,10 @@ ostream & Cec::listDevices(ostream & out) {
 	return out;
 }
 
-map<cec_user_control_code, const char *> & Cec::setupUserControlCodeName() {
-	static map<cec_user_control_code, const char *> cecUserControlCodeName;
-
-	if (cecUserControlCodeName.empty()) {
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_SELECT]="SELECT";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_UP]="UP";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_DOWN]="DOWN";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_LEFT]="LEFT";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_RIGHT]="RIGHT";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_RIGHT_UP]="RIGHT_UP";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_RIGHT_DOWN]="RIGHT_DOWN";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_LEFT_UP]="LEFT_UP";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_LEFT_DOWN]="LEFT_DOWN";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_ROOT_MENU]="ROOT_MENU";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_SETUP_MENU]="SETUP_MENU";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_CONTENTS_MENU]="CONTENTS_MENU";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_FAVORITE_MENU]="FAVORITE_MENU";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_EXIT]="EXIT";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER0]="NUMBER0";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER1]="NUMBER1";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER2]="NUMBER2";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER3]="NUMBER3";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER4]="NUMBER4";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER5]="NUMBER5";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER6]="NUMBER6";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER7]="NUMBER7";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER8]="NUMBER8";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NUMBER9]="NUMBER9";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_DOT]="DOT";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_ENTER]="ENTER";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_CLEAR]="CLEAR";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_NEXT_FAVORITE]="NEXT_FAVORITE";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_CHANNEL_UP]="CHANNEL_UP";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_CHANNEL_DOWN]="CHANNEL_DOWN";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_PREVIOUS_CHANNEL]="PREVIOUS_CHANNEL";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_SOUND_SELECT]="SOUND_SELECT";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_INPUT_SELECT]="INPUT_SELECT";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_DISPLAY_INFORMATION]="DISPLAY_INFORMATION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_HELP]="HELP";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_PAGE_UP]="PAGE_UP";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_PAGE_DOWN]="PAGE_DOWN";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_POWER]="POWER";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_VOLUME_UP]="VOLUME_UP";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_VOLUME_DOWN]="VOLUME_DOWN";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_MUTE]="MUTE";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_PLAY]="PLAY";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_STOP]="STOP";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_PAUSE]="PAUSE";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_RECORD]="RECORD";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_REWIND]="REWIND";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_FAST_FORWARD]="FAST_FORWARD";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_EJECT]="EJECT";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_FORWARD]="FORWARD";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_BACKWARD]="BACKWARD";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_STOP_RECORD]="STOP_RECORD";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_PAUSE_RECORD]="PAUSE_RECORD";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_ANGLE]="ANGLE";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_SUB_PICTURE]="SUB_PICTURE";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_VIDEO_ON_DEMAND]="VIDEO_ON_DEMAND";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_ELECTRONIC_PROGRAM_GUIDE]="ELECTRONIC_PROGRAM_GUIDE";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_TIMER_PROGRAMMING]="TIMER_PROGRAMMING";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_INITIAL_CONFIGURATION]="INITIAL_CONFIGURATION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_PLAY_FUNCTION]="PLAY_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_PAUSE_PLAY_FUNCTION]="PAUSE_PLAY_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_RECORD_FUNCTION]="RECORD_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_PAUSE_RECORD_FUNCTION]="PAUSE_RECORD_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_STOP_FUNCTION]="STOP_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_MUTE_FUNCTION]="MUTE_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_RESTORE_VOLUME_FUNCTION]="RESTORE_VOLUME_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_TUNE_FUNCTION]="TUNE_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_SELECT_MEDIA_FUNCTION]="SELECT_MEDIA_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_SELECT_AV_INPUT_FUNCTION]="SELECT_AV_INPUT_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_SELECT_AUDIO_INPUT_FUNCTION]="SELECT_AUDIO_INPUT_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_POWER_TOGGLE_FUNCTION]="POWER_TOGGLE_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_POWER_OFF_FUNCTION]="POWER_OFF_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_POWER_ON_FUNCTION]="POWER_ON_FUNCTION";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_F1_BLUE]="F1_BLUE";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_F2_RED]="F2_RED";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_F3_GREEN]="F3_GREEN";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_F4_YELLOW]="F4_YELLOW";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_F5]="F5";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_DATA]="DATA";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_AN_RETURN]="AN_RETURN";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_AN_CHANNELS_LIST]="AN_CHANNELS_LIST";
-		cecUserControlCodeName[CEC_USER_CONTROL_CODE_UNKNOWN]="UNKNOWN";
-	}
-
-	return cecUserControlCodeName;
-}
-
 std::ostream& operator<<(std::ostream &out, const cec_user_control_code code) {
-	map<cec_user_control_code, const char *>::const_iterator it;
-
-	it = Cec::cecUserControlCodeName.find(code);
-	if (it == Cec::cecUserControlCodeName.end()) {
-		it = Cec::cecUserControlCodeName.find(CEC_USER_CONTROL_CODE_UNKNOWN);
-		assert(it != Cec::cecUserControlCodeName.end());
-	}
+	const char *name = cecKey(code).name;
 
-	return out << it->second;
+	return out << (name ? name : "UNKNOWN");
 }
 
 std::ostream& operator<<(std::ostream &out, const cec_log_level & log) {
@@ -470,14 +532,14 @@ std::ostream& operator<<(std::ostream &out, const cec_command & cmd) {
 }
 
 std::ostream& operator<<(std::ostream &out, const cec_opcode & opcode) {
-	if (g_cec)
-		return out << g_cec->ToString(opcode);
+	if (g_backend)
+		return out << g_backend->toString(opcode);
 	return out << "UNKNOWN";
 }
 
 std::ostream& operator<<(std::ostream &out, const cec_logical_address & address) {
-	if (g_cec)
-		return out << g_cec->ToString(address);
+	if (g_backend)
+		return out << g_backend->toString(address);
 	return out << "UNKNOWN";
 }
 
@@ -29,8 +29,9 @@
 #include <cstddef>
 #include <libcec/cec.h>
 
+#include "backend.h"
+
 #include <memory>
-#include <map>
 #include <string>
 
 namespace HDMI {
@@ -59,21 +60,21 @@ class Cec {
 
 	private:
 
-		static std::map<CEC::cec_user_control_code, const char *> & setupUserControlCodeName();
-
 		// Members for the libcec interface
 		CEC::ICECCallbacks callbacks;
 		CEC::libcec_configuration config;
 
-		std::unique_ptr<CEC::ICECAdapter> cec;
+		std::unique_ptr<CecBackend> backend;
 
-		// Inits the CECAdapter 
+		// what open() was asked for and what it found
+		std::string adapter;
+		std::string port;
+
+		// Inits the backend, libcec unless setBackend() was called
 		void init();
 
 	public:
 
-		const static std::map<CEC::cec_user_control_code, const char *> cecUserControlCodeName;
-
 		Cec(const char *name, CecCallback *callback);
 		virtual ~Cec();
 
@@ -87,6 +88,17 @@ class Cec {
 		 */
 		void open(const std::string &adapter = "");
 
+		/**
+		 * Opens the adapter open() found again, without searching for it.
+		 * Runs in the main loop, so it reports errors instead of throwing.
+		 */
+		bool reopen();
+
+		/**
+		 * Unloads libcec, then does what open() does, false on error
+		 */
+		bool reinit();
+
 		/**
 		 * Closes the open adapter
 		 */
@@ -96,6 +108,17 @@ class Cec {
 		void setTargetAddress(const HDMI::address & address);
 		bool ping();
 
+		/**
+		 * The cec_log_level bits passed on to onCecLogMessage. Frames
+		 * are still seen for the bus latency.
+		 */
+		static void setLogMask(int mask);
+
+		/**
+		 * Replaces the backend, takes ownership. Only before open()
+		 */
+		void setBackend(CecBackend *backend);
+
 	// These are just wrapper functions, to map C callbacks to C++
 	friend int cecLogMessage (void *cbParam, const CEC::cec_log_message &message);
 	friend int cecKeyPress   (void *cbParam, const CEC::cec_keypress &key);
@@ -108,6 +131,8 @@ class Cec {
 
 
 // Some helper << methods
+std::ostream& operator<<(std::ostream &out, const CEC::cec_user_control_code code);
+std::ostream& operator<<(std::ostream &out, const CEC::cec_log_level & log);
 std::ostream& operator<<(std::ostream &out, const CEC::cec_log_message & message);
 std::ostream& operator<<(std::ostream &out, const CEC::cec_keypress & key);
 std::ostream& operator<<(std::ostream &out, const CEC::cec_command & command);
@@ -32,17 +32,22 @@
 #include <log4cplus/loggingmacros.h>                                                                          
 
 #include "lirc.h"                                                                                                               
+#include "latency.h"
+#include "metrics.h"
+#include "flight.h"
 
 using namespace log4cplus;                                                                                    
  
 static Logger logger = Logger::getInstance("lirc");        
-static pthread_mutex_t lirc_sync = PTHREAD_MUTEX_INITIALIZER;
+
+#define MAX_EVENTS 64
 
 extern "C" void *extf(void* This) {
 	static_cast<lirc*>(This)->main_loop();
+	return NULL;
 }
 
-lirc::lirc() : isRunning(false) {
+lirc::lirc() : isRunning(false), isStarted(false), overruns(0) {
 	device = string("/var/run/lirc/lircd");
 	gettimeofday(&previous_input, NULL);
 }
@@ -67,7 +72,8 @@ bool lirc::Open(void) {
 	const char *lircpath = device.c_str();
 	
 	struct sockaddr_un sa = {0};
-	sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
 	if(sockfd < 0) {
 		fprintf(stderr, "Unable to create an AF_UNIX socket: %s\n", strerror(errno));
@@ -86,17 +92,205 @@ bool lirc::Open(void) {
 
 	chmod(lircpath, 0666);
 
-	if(listen(sockfd, 3) < 0) {
+	if(listen(sockfd, SOMAXCONN) < 0) {
 		fprintf(stderr, "Unable to listen on AF_UNIX socket: %s\n", strerror(errno));
 		return false;
 	}
 
+	if(tcp_port && !listentcp())
+		return false;
+
+	return start(NULL);
+}
+
+/*
+ * Binds the TCP listener, as lircd --listen does
+ */
+bool lirc::listentcp(void) {
+	struct addrinfo hints = {0};
+	struct addrinfo *result;
+	char port[8];
+	int on = 1;
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+	snprintf(port, sizeof port, "%u", tcp_port);
+
+	int err = getaddrinfo(tcp_address.empty() ? NULL : tcp_address.c_str(), port, &hints, &result);
+	if(err) {
+		fprintf(stderr, "Unable to listen on %s: %s\n", tcp_address.c_str(), gai_strerror(err));
+		return false;
+	}
+
+	tcpfd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(tcpfd < 0) {
+		fprintf(stderr, "Unable to create a TCP socket: %s\n", strerror(errno));
+		freeaddrinfo(result);
+		return false;
+	}
+
+	// a restart must not wait for the connections of the last run to time out
+	setsockopt(tcpfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+
+	if(bind(tcpfd, result->ai_addr, result->ai_addrlen) < 0) {
+		fprintf(stderr, "Unable to bind TCP socket to port %u: %s\n", tcp_port, strerror(errno));
+		freeaddrinfo(result);
+		close(tcpfd);
+		tcpfd = -1;
+		return false;
+	}
+	freeaddrinfo(result);
+
+	if(listen(tcpfd, SOMAXCONN) < 0) {
+		fprintf(stderr, "Unable to listen on TCP socket: %s\n", strerror(errno));
+		close(tcpfd);
+		tcpfd = -1;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Every line goes out at once, and a client that vanished without a FIN
+ * is found by keepalive rather than by a full queue
+ */
+void lirc::setuptcp(int fd) {
+	int on = 1;
+	int idle = LIRC_TCP_KEEPIDLE, interval = LIRC_TCP_KEEPINTVL, probes = LIRC_TCP_KEEPCNT;
+
+	if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on) < 0
+			|| setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof on) < 0
+			|| setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof idle) < 0
+			|| setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof interval) < 0
+			|| setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof probes) < 0)
+		LOG4CPLUS_DEBUG_STR(logger, "lirc::setuptcp() - Error during setsockopt(): " + string(strerror(errno)));
+
+	// a slow client backs up into its own queue, where the overflow policy applies
+	if(tcp_sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &tcp_sndbuf, sizeof tcp_sndbuf) < 0)
+		LOG4CPLUS_DEBUG_STR(logger, "lirc::setuptcp() - Error setting SO_SNDBUF: " + string(strerror(errno)));
+}
+
+bool lirc::Open(Handoff &handoff) {
+	LOG4CPLUS_TRACE_STR(logger, "lirc::Open() handoff");
+
+	// owns the fds from here on, also on failure
+	sockfd = handoff.fds[0];
+
+	// the TCP listener comes along like a client, it only listens
+	for(size_t i = 1; i < handoff.fds.size(); i++) {
+		int listening = 0;
+		socklen_t len = sizeof listening;
+
+		if(getsockopt(handoff.fds[i], SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening)
+			continue;
+
+		struct sockaddr_storage sa;
+		socklen_t salen = sizeof sa;
+		unsigned port = 0;
+		if(getsockname(handoff.fds[i], (struct sockaddr *)&sa, &salen) == 0)
+			port = ntohs(sa.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&sa)->sin6_port : ((struct sockaddr_in *)&sa)->sin_port);
+
+		if(port == tcp_port)
+			tcpfd = handoff.fds[i];
+		else
+			close(handoff.fds[i]);
+
+		handoff.fds.erase(handoff.fds.begin() + i);
+		handoff.pending.erase(handoff.pending.begin() + i);
+		break;
+	}
+
+	// asked for only now, the UNIX socket's clients are served either way
+	if(tcp_port && tcpfd < 0)
+		listentcp();
+
+	bool started = start(&handoff);
+	handoff.fds.clear();
+	handoff.pending.clear();
+	return started;
+}
+
+/*
+ * Sets up the reactor and starts its thread. Clients of a handoff are added
+ * before, the thread owns the client list once it runs.
+ */
+bool lirc::start(const Handoff *handoff) {
+	struct epoll_event ev = {0};
+
+	// a partially sent line always stays queued, so we need room for one more
+	if(queue_len < 2)
+		queue_len = 2;
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epollfd < 0) {
+		fprintf(stderr, "Unable to create epoll instance: %s\n", strerror(errno));
+		return false;
+	}
+
+	wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(wakefd < 0) {
+		fprintf(stderr, "Unable to create eventfd: %s\n", strerror(errno));
+		return false;
+	}
+
+	// the listener and the wakeup fd are told apart from clients by their data.ptr
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = &sockfd;
+	if(epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+		fprintf(stderr, "Unable to add listener to epoll: %s\n", strerror(errno));
+		return false;
+	}
+
+	ev.data.ptr = &tcpfd;
+	if(tcpfd >= 0 && epoll_ctl(epollfd, EPOLL_CTL_ADD, tcpfd, &ev) < 0) {
+		fprintf(stderr, "Unable to add TCP listener to epoll: %s\n", strerror(errno));
+		return false;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &wakefd;
+	if(epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &ev) < 0) {
+		fprintf(stderr, "Unable to add eventfd to epoll: %s\n", strerror(errno));
+		return false;
+	}
+
+	for(size_t i = 1; handoff && i < handoff->fds.size(); i++) {
+		client_t *client = addclient(handoff->fds[i]);
+		const string &pending = handoff->pending[i];
+
+		if(client && !pending.empty()) {
+			lirc_event_t event;
+			event.len = pending.size();
+			event.repeat = false;
+			event.stamp = 0;
+			memcpy(event.data, pending.data(), pending.size());
+
+			// EPOLLOUT fires as soon as the reactor waits, which sends it
+			lirc_frame_t *frame = newframe(event);
+			enqueue(client, frame, 0);
+			releaseframe(frame);
+		}
+	}
+
+	// a client that can't keep up holds at most queue_len frames, the batch
+	// being sent the rest, so the key path never allocates for one of them
+	for(unsigned i = 0; i < queue_len + LIRC_BATCH_MAX; i++) {
+		lirc_frame_t *frame = (lirc_frame_t *)xalloc(sizeof *frame);
+		frame->next = freeframes;
+		freeframes = frame;
+	}
+
+	isRunning = true;
+
 	if (pthread_create(&lirc_thread, NULL, &extf, this)) {
-        	fprintf(stderr, "Can't create lirc thread");
-        	return false;
+		fprintf(stderr, "Can't create lirc thread");
+		isRunning = false;
+		return false;
 	}
 	
-	isRunning = true;
+	isStarted = true;
 	
 	return true;
 }
@@ -105,107 +299,537 @@ bool lirc::Close() {
 	LOG4CPLUS_TRACE_STR(logger, "lirc::Close()");
 	
 	isRunning = false;
+
+	if (isStarted) {
+		wakeup();
+		pthread_join(lirc_thread, NULL);
+		isStarted = false;
+		LOG4CPLUS_TRACE_STR(logger, "lirc::Close() lirc_thread terminated");
+	}
+
+	while (clients) {
+		client_t *next = clients->next;
+		disconnect(clients);
+		close(clients->fd);
+		free(clients->queue);
+		free(clients);
+		clients = next;
+	}
+	flightClients.store(0, std::memory_order_relaxed);
+
+	while (freeframes) {
+		lirc_frame_t *next = freeframes->next;
+		free(freeframes);
+		freeframes = next;
+	}
 	
 	if (sockfd >= 0) {
 		LOG4CPLUS_TRACE_STR(logger, "lirc::Close() sockfd");
 		shutdown (sockfd, SHUT_RDWR);
 		close (sockfd);
+		sockfd = -1;
+	}
+
+	if (tcpfd >= 0) {
+		close (tcpfd);
+		tcpfd = -1;
+	}
+
+	if (wakefd >= 0) {
+		close (wakefd);
+		wakefd = -1;
 	}
 
-	pthread_mutex_destroy( &lirc_sync);
-	pthread_join(lirc_thread, NULL);
-	LOG4CPLUS_TRACE_STR(logger, "lirc::Close() lirc_thread terminated");
+	if (epollfd >= 0) {
+		close (epollfd);
+		epollfd = -1;
+	}
 
 	return true; 
 }     
 
-void lirc::processnewclient(void) {
-	
-	LOG4CPLUS_TRACE_STR(logger, "lirc::processnewclient(void) start");
-	
-	pthread_mutex_lock( &lirc_sync );
+void lirc::Detach(Handoff &handoff) {
+	LOG4CPLUS_TRACE_STR(logger, "lirc::Detach()");
+
+	isRunning = false;
+
+	if (isStarted) {
+		wakeup();
+		pthread_join(lirc_thread, NULL);
+		isStarted = false;
+	}
+
+	handoff.fds.assign(1, sockfd);
+	handoff.pending.assign(1, string());
+	sockfd = -1;
+
+	if (tcpfd >= 0) {
+		handoff.fds.push_back(tcpfd);
+		handoff.pending.push_back(string());
+		tcpfd = -1;
+	}
+
+	while (clients) {
+		client_t *next = clients->next;
+
+		if (clients->dead) {
+			close(clients->fd);
+		} else {
+			// only the rest of a torn line goes along, lines queued behind it are lost
+			string pending;
+			if (clients->count && clients->queue[clients->head].offset) {
+				outmsg_t *out = &clients->queue[clients->head];
+				pending.assign(out->frame->data + out->offset, out->frame->len - out->offset);
+			}
+			handoff.fds.push_back(clients->fd);
+			handoff.pending.push_back(pending);
+		}
+
+		while (clients->count) {
+			releaseframe(clients->queue[clients->head].frame);
+			clients->head = (clients->head + 1) % queue_len;
+			clients->count--;
+		}
+		free(clients->queue);
+		free(clients);
+		clients = next;
+	}
+
+	// frees the frames, closes the reactor's own fds
+	Close();
+}
+
+void lirc::wakeup(void) {
+	uint64_t one = 1;
+
+	if (wakefd >= 0 && write(wakefd, &one, sizeof one) < 0 && errno != EAGAIN)
+		syslog(LOG_ERR, "Error writing to eventfd: %s\n", strerror(errno));
+}
+
+void lirc::processnewclient(int listener) {
 	
-	client_t *newclient = (client_t *)xalloc(sizeof *newclient);
+	LOG4CPLUS_TRACE_STR(logger, "lirc::processnewclient() start");
+
+	// the listener is edge-triggered, so drain the whole accept queue
+	for(;;) {
+		int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if(fd < 0) {
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				LOG4CPLUS_DEBUG_STR(logger, "lirc::processnewclient() - Error during accept(): " + string(strerror(errno)));
+			return;
+		}
 
-	newclient->fd = accept(sockfd, NULL, NULL);
+		if(listener == tcpfd)
+			setuptcp(fd);
 
-	if(newclient->fd < 0) {
+		metricsAdd(METRIC_CLIENTS_CONNECTED);
+		addclient(fd);
+	}
+}
+
+/*
+ * Adds a connected socket to the clients, closes it on error
+ */
+client_t *lirc::addclient(int fd) {
+	client_t *newclient = (client_t *)xalloc(sizeof *newclient);
+	newclient->fd = fd;
+	newclient->queue = (outmsg_t *)xalloc(queue_len * sizeof *newclient->queue);
+
+	// EPOLLOUT is edge-triggered too, so it only fires once a full socket drains
+	struct epoll_event ev = {0};
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = newclient;
+
+	if(epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		LOG4CPLUS_DEBUG_STR(logger, "lirc::addclient() - Error during epoll_ctl(): " + string(strerror(errno)));
+		close(fd);
+		free(newclient->queue);
 		free(newclient);
-		pthread_mutex_unlock( &lirc_sync );
-		LOG4CPLUS_DEBUG_STR(logger, "lirc::processnewclient(void) - Error during accept(): " + string(strerror(errno)));
-		return;
+		return NULL;
 	}
 
-	int flags = fcntl(newclient->fd, F_GETFL);
-	fcntl(newclient->fd, F_SETFL, flags | O_NONBLOCK);
 	newclient->next = clients;
 	clients = newclient;
-	
-	pthread_mutex_unlock( &lirc_sync );
+	flightClients.fetch_add(1, std::memory_order_relaxed);
+	return newclient;
 }
 
-void lirc::processevent(const char *message) {
-	LOG4CPLUS_TRACE_STR(logger, "lirc::processevent start " + string(message));
+void lirc::processclient(client_t *client, uint32_t events) {
+	char buf[256];
 
-	pthread_mutex_lock( &lirc_sync );
-	int len = strlen(message);
-	client_t *client, *prev, *next;
-	struct timeval current;
-	
-	previous_input = current;
-	for(client = clients; client; client = client->next) {
-		if(write(client->fd, message, len) != len) {
-			close(client->fd);
-			client->fd = -1;
+	if(events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+		removeclient(client);
+		return;
+	}
+
+	if(events & EPOLLOUT)
+		flush(client);
+
+	if(events & EPOLLIN) {
+		// lircd clients may send commands we don't implement, discard them
+		for(;;) {
+			ssize_t len = read(client->fd, buf, sizeof buf);
+			if(len > 0)
+				continue;
+			if(len < 0 && errno == EINTR)
+				continue;
+			if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return;
+			removeclient(client);
+			return;
 		}
 	}
+}
 
-	for(prev = NULL, client = clients; client; client = next) {
-		next = client->next;
-		if(client->fd < 0) {
-			if(prev)
-				prev->next = client->next;
-			else
-				clients = client->next;
-			free(client);
-		} else {
-			prev = client;
+void lirc::removeclient(client_t *client) {
+	client_t **pp;
+
+	LOG4CPLUS_TRACE_STR(logger, "lirc::removeclient()");
+
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, client->fd, NULL);
+
+	for(pp = &clients; *pp; pp = &(*pp)->next) {
+		if(*pp == client) {
+			*pp = client->next;
+			break;
+		}
+	}
+
+	if(client->dropped)
+		LOG4CPLUS_DEBUG(logger, "lirc::removeclient() fd=" << client->fd << " dropped " << client->dropped << " events");
+
+	disconnect(client);
+	close(client->fd);
+	free(client->queue);
+	free(client);
+	flightClients.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/*
+ * The reactor sees the hangup and reaps the client.
+ */
+void lirc::disconnect(client_t *client) {
+	client->dead = true;
+	while(client->count) {
+		releaseframe(client->queue[client->head].frame);
+		client->head = (client->head + 1) % queue_len;
+		client->count--;
+	}
+	shutdown(client->fd, SHUT_RDWR);
+}
+
+/*
+ * Removes the entry at position index of the client's ring, keeping order.
+ */
+void lirc::dequeue(client_t *client, unsigned index) {
+	releaseframe(client->queue[(client->head + index) % queue_len].frame);
+	for(unsigned i = index; i > 0; i--)
+		client->queue[(client->head + i) % queue_len] = client->queue[(client->head + i - 1) % queue_len];
+	client->head = (client->head + 1) % queue_len;
+	client->count--;
+	client->dropped++;
+}
+
+/*
+ * Queues the unsent part of a frame, applying the overflow policy when the
+ * ring is full. Returns false if the client has to be disconnected.
+ */
+bool lirc::enqueue(client_t *client, lirc_frame_t *frame, size_t sent) {
+	if(client->count == queue_len) {
+		// the head may be partially sent, it must never be dropped
+		unsigned first = client->queue[client->head].offset ? 1 : 0;
+		unsigned i;
+
+		switch(overflow) {
+			case OVERFLOW_DROP_OLDEST:
+				dequeue(client, first);
+				break;
+			case OVERFLOW_DROP_REPEATS:
+				if(frame->repeat) {
+					client->dropped++;
+					return true;
+				}
+				for(i = first; i < client->count; i++) {
+					if(client->queue[(client->head + i) % queue_len].frame->repeat)
+						break;
+				}
+				if(i == client->count)
+					return false;
+				dequeue(client, i);
+				break;
+			case OVERFLOW_DISCONNECT:
+			default:
+				return false;
+		}
+	}
+
+	outmsg_t *msg = &client->queue[(client->head + client->count) % queue_len];
+	msg->frame = frame;
+	msg->offset = sent;
+	frame->refs++;
+	client->count++;
+	metricsMax(METRIC_CLIENT_QUEUE_HIGH, client->count);
+
+	return true;
+}
+
+/*
+ * Sends as much of the client's queue as the socket takes, all queued
+ * frames go out in a single sendmsg().
+ */
+void lirc::flush(client_t *client) {
+	struct iovec iov[LIRC_BATCH_MAX];
+	struct msghdr msg = {0};
+
+	while(client->count && !client->dead) {
+		unsigned n = client->count < LIRC_BATCH_MAX ? client->count : LIRC_BATCH_MAX;
+
+		for(unsigned i = 0; i < n; i++) {
+			outmsg_t *out = &client->queue[(client->head + i) % queue_len];
+			iov[i].iov_base = out->frame->data + out->offset;
+			iov[i].iov_len = out->frame->len - out->offset;
+		}
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+
+		ssize_t sent = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if(sent < 0) {
+			if(errno == EINTR)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK) {
+				metricsAdd(METRIC_CLIENTS_DROPPED);
+				disconnect(client);
+			}
+			return;
+		}
+
+		metricsAdd(METRIC_BYTES_WRITTEN, sent);
+
+		while(sent > 0) {
+			outmsg_t *out = &client->queue[client->head];
+			size_t left = out->frame->len - out->offset;
+
+			if((size_t)sent < left) {
+				metricsAdd(METRIC_SHORT_WRITES);
+				out->offset += sent;
+				return;
+			}
+
+			sent -= left;
+			latencyRecord(LATENCY_WRITTEN, out->frame->stamp);
+			releaseframe(out->frame);
+			client->head = (client->head + 1) % queue_len;
+			client->count--;
+		}
+	}
+}
+
+/*
+ * Hands a batch of lines to the broadcast thread as one event. Never blocks,
+ * so it is safe to call from the libcec callback thread. Returns false if
+ * the event was dropped.
+ */
+bool lirc::post(const struct iovec *lines, unsigned count, bool repeat, uint64_t stamp) {
+	lirc_event_t event;
+
+	if(!isRunning)
+		return false;
+
+	event.len = 0;
+	event.repeat = repeat;
+	event.stamp = stamp;
+	for(unsigned i = 0; i < count; i++) {
+		// only ever send complete lines
+		if(event.len + lines[i].iov_len > LIRC_EVENT_MAX)
+			break;
+		memcpy(event.data + event.len, lines[i].iov_base, lines[i].iov_len);
+		event.len += lines[i].iov_len;
+	}
+
+	if(event.len == 0)
+		return true;
+
+	if(!events.push(event)) {
+		overruns++;
+		return false;
+	}
+	flightQueued.store(events.size(), std::memory_order_relaxed);
+
+	wakeup();
+	return true;
+}
+
+bool lirc::post(const char *message, size_t len, bool repeat, uint64_t stamp) {
+	struct iovec line = { (void *)message, len };
+
+	return post(&line, 1, repeat, stamp);
+}
+
+lirc_frame_t *lirc::newframe(const lirc_event_t &event) {
+	lirc_frame_t *frame = freeframes;
+
+	if(frame)
+		freeframes = frame->next;
+	else
+		frame = (lirc_frame_t *)xalloc(sizeof *frame);
+
+	frame->refs = 1;
+	frame->len = event.len;
+	frame->repeat = event.repeat;
+	frame->stamp = event.stamp;
+	memcpy(frame->data, event.data, event.len);
+
+	return frame;
+}
+
+void lirc::releaseframe(lirc_frame_t *frame) {
+	if(--frame->refs == 0) {
+		frame->next = freeframes;
+		freeframes = frame;
+	}
+}
+
+/*
+ * Drains the event queue, runs on the reactor thread only.
+ */
+void lirc::processevents(void) {
+	lirc_frame_t *frames[LIRC_BATCH_MAX];
+	lirc_event_t event;
+	uint64_t seq;
+	unsigned count;
+
+	metricsMax(METRIC_EVENT_QUEUE_HIGH, events.size());
+
+	do {
+		for(count = 0; count < LIRC_BATCH_MAX && events.pop(event, &seq); count++) {
+			if(seq != next_seq)
+				LOG4CPLUS_DEBUG(logger, "lirc::processevents() expected seq " << next_seq << " got " << seq);
+			next_seq = seq + 1;
+			latencyRecord(LATENCY_QUEUED, event.stamp);
+			frames[count] = newframe(event);
 		}
+
+		if(count)
+			broadcast(frames, count);
+
+		for(unsigned i = 0; i < count; i++)
+			releaseframe(frames[i]);
+	} while(count == LIRC_BATCH_MAX);
+	flightQueued.store(events.size(), std::memory_order_relaxed);
+
+	unsigned long lost = overruns.exchange(0);
+	metricsAdd(METRIC_EVENTS_DROPPED, lost);
+	if(lost)
+		LOG4CPLUS_DEBUG(logger, "lirc::processevents() event queue overrun, " << lost << " events dropped");
+}
+
+/*
+ * Sends a batch of frames to every client, one sendmsg() per client. What
+ * a client's socket doesn't take is queued by reference.
+ */
+void lirc::broadcast(lirc_frame_t **frames, unsigned count) {
+	struct iovec iov[LIRC_BATCH_MAX];
+	struct msghdr msg = {0};
+	client_t *client;
+	size_t total = 0;
+	uint64_t now;
+
+	for(unsigned i = 0; i < count; i++) {
+		iov[i].iov_base = frames[i]->data;
+		iov[i].iov_len = frames[i]->len;
+		total += frames[i]->len;
 	}
 
-	pthread_mutex_unlock( &lirc_sync );
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	gettimeofday(&previous_input, NULL);
+	now = latencyNow();
+	for(client = clients; client; client = client->next) {
+		ssize_t sent = 0;
+		unsigned first = 0;
+
+		if(client->dead)
+			continue;
+
+		// keep ordering, only write directly if nothing is queued
+		if(client->count == 0) {
+			do {
+				sent = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+			} while(sent < 0 && errno == EINTR);
+
+			if(sent < 0) {
+				if(errno != EAGAIN && errno != EWOULDBLOCK) {
+					metricsAdd(METRIC_CLIENTS_DROPPED);
+					disconnect(client);
+					continue;
+				}
+				sent = 0;
+			}
+
+			metricsAdd(METRIC_BYTES_WRITTEN, sent);
+			if((size_t)sent < total)
+				metricsAdd(METRIC_SHORT_WRITES);
+
+			// skip the frames that went out completely
+			while(first < count && (size_t)sent >= frames[first]->len) {
+				latencyRecord(LATENCY_WRITTEN, frames[first]->stamp, now);
+				sent -= frames[first]->len;
+				first++;
+			}
+
+			if(first == count)
+				continue;
+		}
+
+		for(unsigned i = first; i < count; i++) {
+			if(!enqueue(client, frames[i], i == first ? sent : 0)) {
+				LOG4CPLUS_DEBUG(logger, "lirc::broadcast() fd=" << client->fd << " queue overflow, disconnecting");
+				metricsAdd(METRIC_CLIENTS_DROPPED);
+				disconnect(client);
+				break;
+			}
+		}
+	}
 }
 
 void lirc::main_loop(void) {
 
 	LOG4CPLUS_TRACE_STR (logger, "main_loop start");
 	
-	fd_set fdset;
-	int maxfd = 0;
-
-	FD_ZERO(&fdset);
-	
-	FD_SET(sockfd, &fdset);
-	if(sockfd > maxfd)
-		maxfd = sockfd;
-
-	maxfd++;
+	struct epoll_event events[MAX_EVENTS];
 	
 	while(isRunning) {
 		LOG4CPLUS_TRACE_STR(logger, "lirc::main_loop() while entered");
 		
-		if(select(maxfd, &fdset, NULL, NULL, NULL) < 0) {
+		int n = epoll_wait(epollfd, events, MAX_EVENTS, -1);
+		if(n < 0) {
 			if(errno == EINTR)
 				continue;
-			syslog(LOG_ERR, "Error during select(): %s\n", strerror(errno));
-			throw std::runtime_error("Error during select()");
+			syslog(LOG_ERR, "Error during epoll_wait(): %s\n", strerror(errno));
+			throw std::runtime_error("Error during epoll_wait()");
 		}
 
-		if(FD_ISSET(sockfd, &fdset))
-			processnewclient();
-			
+		for(int i = 0; i < n; i++) {
+			if(events[i].data.ptr == &sockfd) {
+				processnewclient(sockfd);
+			} else if(events[i].data.ptr == &tcpfd) {
+				processnewclient(tcpfd);
+			} else if(events[i].data.ptr == &wakefd) {
+				uint64_t value;
+				if(read(wakefd, &value, sizeof value) < 0 && errno != EAGAIN)
+					syslog(LOG_ERR, "Error reading eventfd: %s\n", strerror(errno));
+				processevents();
+			} else {
+				processclient((client_t *)events[i].data.ptr, events[i].events);
+			}
+		}
 	}
 	
 	LOG4CPLUS_TRACE_STR(logger, "lirc::main_loop() end");
 }
-
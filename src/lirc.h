@@ -41,6 +41,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 #include <sysexits.h>
 #include <sys/stat.h>
@@ -52,10 +58,72 @@
 #include <ctype.h>
 #include <pthread.h>
 
+#include <atomic>
+
+#include "eventqueue.h"
+#include "handoff.h"
+
 using std::string;
 
+#define LIRC_LINE_MAX		128
+#define LIRC_QUEUE_LEN		32
+#define LIRC_QUEUE_MAX		4096	// -q, each client's queue is allocated up front
+#define LIRC_EVENT_QUEUE_LEN	256
+#define LIRC_EVENT_MAX		(2 * LIRC_LINE_MAX)
+#define LIRC_BATCH_MAX		16
+
+#define LIRC_TCP_PORT		8765	// lircd --listen
+#define LIRC_TCP_SNDBUF		16384	// bytes of kernel buffer per TCP client, queue_len lines on top
+#define LIRC_TCP_KEEPIDLE	60	// s without traffic before the first keepalive probe
+#define LIRC_TCP_KEEPINTVL	10	// s between probes
+#define LIRC_TCP_KEEPCNT	6	// probes lost before the client counts as gone
+
+/*
+ * What to do when a client's outbound queue is full
+ */
+typedef enum {
+	OVERFLOW_DROP_OLDEST,	// drop the oldest queued line
+	OVERFLOW_DROP_REPEATS,	// drop repeat lines only, disconnect if there are none
+	OVERFLOW_DISCONNECT,	// disconnect the client
+} overflow_policy_t;
+
+/*
+ * A key event handed from the CEC callbacks to the broadcast thread,
+ * holds one or more complete lines
+ */
+typedef struct lirc_event {
+	uint16_t len;
+	bool repeat;
+	uint64_t stamp;		// entry into the libcec callback, 0 if none
+	char data[LIRC_EVENT_MAX];
+} lirc_event_t;
+
+/*
+ * The lines of one event, shared by all clients that still have to send
+ * them. Only the reactor thread touches frames, so refs is a plain count.
+ */
+typedef struct lirc_frame {
+	unsigned refs;
+	uint16_t len;
+	bool repeat;
+	uint64_t stamp;
+	struct lirc_frame *next;	// free list
+	char data[LIRC_EVENT_MAX];
+} lirc_frame_t;
+
+typedef struct outmsg {
+	lirc_frame_t *frame;
+	uint16_t offset;	// bytes of the frame already sent
+} outmsg_t;
+
 typedef struct client {
 	int fd;
+	bool dead;
+	// bounded ring of frames waiting for the socket to become writable
+	outmsg_t *queue;
+	unsigned head;
+	unsigned count;
+	unsigned long dropped;
 	struct client *next;
 } client_t;
 
@@ -69,20 +137,61 @@ private:
 	
 	void* xalloc(size_t size);
 	pthread_t lirc_thread;
-	bool isRunning;
+	std::atomic<bool> isRunning;
+	bool isStarted;
+
+	// epoll reactor, owns the listening socket and every client fd
+	int epollfd = -1;
+	// eventfd used to wake the reactor, e.g. on Close()
+	int wakefd = -1;
+
+	// events waiting for the broadcast thread, the only writer to client sockets
+	mpsc_queue<lirc_event_t, LIRC_EVENT_QUEUE_LEN> events;
+	uint64_t next_seq = 0;
+	std::atomic<unsigned long> overruns;
+
+	lirc_frame_t *freeframes = NULL;
+
+	bool start(const Handoff *handoff);
+	bool listentcp(void);
+	void setuptcp(int fd);
+	client_t *addclient(int fd);
+	void wakeup(void);
+	lirc_frame_t *newframe(const lirc_event_t &event);
+	void releaseframe(lirc_frame_t *frame);
+	void processevents(void);
+	void broadcast(lirc_frame_t **frames, unsigned count);
+	void processclient(client_t *client, uint32_t events);
+	void removeclient(client_t *client);
+	void disconnect(client_t *client);
+	bool enqueue(client_t *client, lirc_frame_t *frame, size_t sent);
+	void dequeue(client_t *client, unsigned index);
+	void flush(client_t *client);
 	
 public:
 	bool grab = false;
 	string device;
 	long repeat_time = 0L;
 	int sockfd = -1;
+	// optional TCP listener, served like the UNIX socket
+	int tcpfd = -1;
+	string tcp_address;	// empty for any
+	unsigned tcp_port = 0;	// 0 for none
+	int tcp_sndbuf = LIRC_TCP_SNDBUF;
+	unsigned queue_len = LIRC_QUEUE_LEN;
+	overflow_policy_t overflow = OVERFLOW_DROP_OLDEST;
 
 	lirc();
 	virtual ~lirc();
 	bool Open(void);
+	// takes over the listener and clients of a handoff
+	bool Open(Handoff &handoff);
 	bool Close(void);
-	void processnewclient(void);
-	void processevent(const char *);
+	// stops like Close(), but leaves the listener and clients to the handoff
+	void Detach(Handoff &handoff);
+	void processnewclient(int listener);
+	bool post(const struct iovec *lines, unsigned count, bool repeat = false, uint64_t stamp = 0);
+	bool post(const char *message, size_t len, bool repeat = false, uint64_t stamp = 0);
 	void main_loop(void);
 	
 };
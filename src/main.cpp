@@ -28,12 +28,22 @@
 
 #include "main.h"
 #include "hdmi.h"
+#include "latency.h"
+#include "metrics.h"
+#include "fakecec.h"
+#include "capture.h"
+#include "handoff.h"
+#include "asynclog.h"
+#include "flight.h"
 
 #define CEC_NAME    "RaspberryPI"
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
 
 #include <algorithm>
+#include <random>
 #include <cstdio>
 #include <iostream>
 #include <sstream>
@@ -45,6 +55,10 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 #include <log4cplus/logger.h>
 #include <log4cplus/loggingmacros.h>
@@ -62,32 +76,57 @@ using std::string;
 using std::stringstream;
 using std::vector;
 using std::queue;
-using std::list;
 
 static Logger logger = Logger::getInstance("main");
 static pthread_mutex_t libcec_sync = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  libcec_cond = PTHREAD_COND_INITIALIZER;
-const vector<list<string>> Main::uinputCecMap = Main::setupUinputMap();
+
+// how long the keymap has to stay unchanged before it is reloaded
+#define KEYMAP_RELOAD_DELAY	200
+
+// retries of a failed recovery, ms, doubling from min to max
+#define RECOVER_BACKOFF_MIN	250U
+#define RECOVER_BACKOFF_MAX	30000U
+// reopens tried before libcec is reinitialised
+#define RECOVER_REOPEN_ATTEMPTS	3
+
+static std::minstd_rand recoverJitter(time(NULL) ^ getpid());
+
+static long elapsedMs(const struct timespec &from, const struct timespec &to) {
+	return (to.tv_sec - from.tv_sec) * 1000 + (to.tv_nsec - from.tv_nsec) / 1000000;
+}
 
 enum
 {
 	COMMAND_STANDBY,
 	COMMAND_ACTIVE,
 	COMMAND_INACTIVE,
-	COMMAND_RESTART,
+	COMMAND_ALERT,
 	COMMAND_EXIT,
 };
 
 Main & Main::instance() {
-	// Singleton pattern so we can use main from a sighandle
+	// Singleton pattern, libcec calls back into the one instance
 	static Main main;
 	return main;
 }
 
 Main::Main() : cec(getCecName(), this), 
-	makeActive(true), running(false), repeatCount(0), logicalAddress(CECDEVICE_UNKNOWN) {
+	makeActive(true), running(false), 
+	epollfd(-1), commandfd(-1), signalfd(-1), timerfd(-1), metricsfd(-1), handofffd(-1), takeover(false),
+	recoverfd(-1), recovering(RECOVER_NONE), recoverAttempts(0), recoverStarted(0), keyInitiator(CECDEVICE_TV),
+	lircSink(mylirc), logicalAddress(CECDEVICE_UNKNOWN) {
 	LOG4CPLUS_TRACE_STR(logger, "Main::Main()");
 
+	repeater.emit = [this](key_event_t event, cec_user_control_code keycode, unsigned count) { onKeyEvent(event, keycode, count); };
+	sequencer.pass = [this](cec_user_control_code keycode) { sendKey(keycode, 0, false); };
+	sequencer.replay = [this](cec_user_control_code keycode) { if (sendKey(keycode, 0, false)) sendRelease(keycode, false); };
+	sequencer.match = [this](const LircKey &lircKey) {
+		dispatch(CEC_USER_CONTROL_CODE_UNKNOWN, lircKey, 0, false);
+		dispatch(CEC_USER_CONTROL_CODE_UNKNOWN, lircKey, 0, true);
+	};
+
+	sinks.push_back(&lircSink);
+
 }
 
 Main::~Main() {
@@ -95,138 +134,483 @@ Main::~Main() {
 
 //	stop();
 
-	pthread_cond_destroy (&libcec_cond);                                                                                         
+	int fds[] = { epollfd, commandfd, signalfd, timerfd, recoverfd, metricsfd, handofffd };
+	for (size_t i = 0; i < sizeof fds / sizeof fds[0]; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+
 	pthread_mutex_destroy (&libcec_sync);                                                                                              
   
 }
 
-void Main::loop(const string & device) {
-	LOG4CPLUS_TRACE_STR(logger, "Main::loop()");
+/*
+ * Creates the fds the main loop waits on. Signals are blocked in every
+ * thread and read from a signalfd, so nothing runs in signal context.
+ */
+void Main::setupLoop() {
+	struct epoll_event ev = {0};
+	sigset_t mask;
+
+	if (epollfd >= 0)
+		return;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGPIPE);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+
+	// before libcec and lirc start their threads, so they inherit the mask
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	epollfd   = epoll_create1(EPOLL_CLOEXEC);
+	commandfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	signalfd  = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	timerfd   = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	recoverfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	hooks.setup();
+	repeater.setup();
+	sequencer.setup();
+
+	if (epollfd < 0 || commandfd < 0 || signalfd < 0 || timerfd < 0 || recoverfd < 0) {
+		throw std::runtime_error("Unable to set up main loop: " + string(strerror(errno)));
+	}
+
+	flightSetup(flightPath.empty() ? mylirc.device + ".flight" : flightPath);
+
+	// next to the LIRC socket unless set, without it ceclircd still works
+	metricsfd = metricsListen(metricsPath.empty() ? mylirc.device + ".metrics" : metricsPath);
+	// the next ceclircd takes over the LIRC clients from here, see handOver()
+	handofffd = handoffListen(mylirc.device + ".handoff");
+
+	int fds[] = { commandfd, signalfd, timerfd, recoverfd, repeater.fd(), sequencer.fd(), keymap.fd(), hooks.fd(), metricsfd, handofffd };
+	for (size_t i = 0; i < sizeof fds / sizeof fds[0]; i++) {
+		if (fds[i] < 0)
+			continue;
+		ev.events = EPOLLIN;
+		ev.data.fd = fds[i];
+		if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+			throw std::runtime_error("Unable to set up main loop: " + string(strerror(errno)));
+		}
+	}
+}
+
+/*
+ * Arms one of the loop's one-shot timers, 0 disarms it
+ */
+void Main::setTimer(int fd, unsigned ms) {
+	struct itimerspec its = {{0, 0}, {0, 0}};
+
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+	timerfd_settime(fd, 0, &its, NULL);
+}
 
-	struct timeval now;                                                                                                  
-	struct timespec timeout;
+void Main::onTimer() {
+	uint64_t expirations;
 
-	struct sigaction action;
+	if (read(timerfd, &expirations, sizeof expirations) < 0)
+		return;
 
-	action.sa_handler = &Main::signalHandler;
-	action.sa_flags = SA_RESETHAND;
-	sigemptyset(&action.sa_mask);
+	// the keymap settled down, see onKeymapChanged()
+	keymap.reload();
+}
 
-	int restart = false;
+void Main::onKeymapChanged() {
+	// installers tend to write a file in several steps, wait for the last one
+	if (keymap.changed())
+		setTimer(timerfd, KEYMAP_RELOAD_DELAY);
+}
 
-	do
-	{
-		cec.open(device);
-		if (!mylirc.Open()) {
-				/* reset signals */
-			signal (SIGHUP,  SIG_DFL);
-			signal (SIGINT,  SIG_DFL);
-			signal (SIGTERM, SIG_DFL);
-			signal (SIGPIPE, SIG_DFL);
-			
-			cec.close(!restart);
-			
-			return;
-		}
-
-		running = true;
-
-		/* install signals */
-		sigaction (SIGHUP,  &action, NULL);
-		sigaction (SIGINT,  &action, NULL);
-		sigaction (SIGTERM, &action, NULL);
-		sigaction (SIGPIPE, &action, NULL);
-		
-		if (makeActive) 
-		{
-			cec.makeActive();
+void Main::onSignal() {
+	struct signalfd_siginfo info;
+
+	while (read(signalfd, &info, sizeof info) == sizeof info) {
+		LOG4CPLUS_DEBUG(logger, "Main::onSignal(" << info.ssi_signo << ")");
+		flightRecord(FLIGHT_SIGNAL, 0, 0, 0, info.ssi_signo);
+
+		switch( info.ssi_signo ) {
+			case SIGCHLD:
+				hooks.onChildExit();
+				break;
+			case SIGUSR1:
+				if (flightDump(SIGUSR1))
+					LOG4CPLUS_INFO(logger, "Flight recorder dumped to " << (flightPath.empty() ? mylirc.device + ".flight" : flightPath));
+				else
+					LOG4CPLUS_ERROR(logger, "Unable to dump the flight recorder: " << strerror(errno));
+				break;
+			case SIGUSR2:
+				latencyReport();
+				break;
+			case SIGPIPE:
+				metricsAdd(METRIC_RESTART_SIGPIPE);
+				recover(RECOVER_REOPEN);
+				break;
+			case SIGHUP:
+				// asked for it, so start over completely
+				metricsAdd(METRIC_RESTART_SIGHUP);
+				recover(RECOVER_REINIT);
+				break;
+			default:
+				stop();
+				break;
 		}
-		
-		do
+	}
+}
+
+/*
+ * Formats a command as one line for the hook helper, e.g.
+ * "standby initiator=0 destination=f opcode=36"
+ */
+static string describe(const char *event, const Command &cmd) {
+	stringstream line;
+
+	line << event << hex;
+	if (cmd.initiator != CECDEVICE_UNKNOWN)
+		line << " initiator=" << (int)cmd.initiator;
+	if (cmd.destination != CECDEVICE_UNKNOWN)
+		line << " destination=" << (int)cmd.destination;
+	if (cmd.opcode != CEC_OPCODE_NONE)
+		line << " opcode=" << (int)cmd.opcode;
+
+	return line.str();
+}
+
+/*
+ * The lightest action that can recover from an alert
+ */
+static recover_action_t recoverAction(libcec_alert alert) {
+	switch( alert )
+	{
+		case CEC_ALERT_TV_POLL_FAILED:
+			// the TV did not answer, which says nothing about the adapter
+			return RECOVER_PING;
+		case CEC_ALERT_CONNECTION_LOST:
+		case CEC_ALERT_PORT_BUSY:
+		case CEC_ALERT_PHYSICAL_ADDRESS_ERROR:
+			return RECOVER_REOPEN;
+		case CEC_ALERT_PERMISSION_ERROR:
+			return RECOVER_REINIT;
+		case CEC_ALERT_SERVICE_DEVICE:
+		default:
+			return RECOVER_NONE;
+	}
+}
+
+static const char *recoverName(recover_action_t action) {
+	static const char *names[] = { "none", "ping", "reopen", "reinit" };
+	return names[action];
+}
+
+/*
+ * Runs the queued commands, returns false once the loop has to end
+ */
+bool Main::processCommands() {
+	queue<Command> pending;
+	uint64_t count;
+
+	if (read(commandfd, &count, sizeof count) < 0 && errno != EAGAIN)
+		LOG4CPLUS_ERROR(logger, "Error reading command eventfd: " << strerror(errno));
+
+	// take the whole queue, so pushers never wait for a command to finish
+	pthread_mutex_lock( &libcec_sync );
+	pending.swap(commands);
+	pthread_mutex_unlock( &libcec_sync );
+
+	while( !pending.empty() )
+	{
+		Command cmd = pending.front();
+		pending.pop();
+
+		switch( cmd.command )
 		{
-			pthread_mutex_lock( &libcec_sync );
-			while( running && !commands.empty() )
-			{
-				Command cmd = commands.front();
-				switch( cmd.command )
+			case COMMAND_STANDBY:
+				if( hooks.coprocess() )
+				{
+					hooks.notify(describe("standby", cmd));
+				}
+				else if( ! onStandbyCommand.empty() )
+				{
+					hooks.run("standby", onStandbyCommand);
+				}
+				else
+				{
+					onCecKeyPress( CEC_USER_CONTROL_CODE_POWER, cmd.initiator );
+				}
+				break;
+			case COMMAND_ACTIVE:
+				makeActive = true;
+				if( hooks.coprocess() )
+				{
+					hooks.notify(describe("activate", cmd));
+				}
+				else if( ! onActivateCommand.empty() )
+				{
+					hooks.run("activate", onActivateCommand);
+				}
+				break;
+			case COMMAND_INACTIVE:
+				makeActive = false;
+				if( hooks.coprocess() )
+				{
+					hooks.notify(describe("deactivate", cmd));
+				}
+				else if( ! onDeactivateCommand.empty() )
 				{
-					case COMMAND_STANDBY:
-						if( ! onStandbyCommand.empty() )
-						{
-							LOG4CPLUS_DEBUG(logger, "Standby: Running \"" << onStandbyCommand << "\"");
-							int ret = system(onStandbyCommand.c_str());
-                            if( ret )
-                                LOG4CPLUS_ERROR(logger, "Standby command failed: " << ret);
-							
-						}
-						else
-						{
-							onCecKeyPress( CEC_USER_CONTROL_CODE_POWER );
-						}
-						break;
-					case COMMAND_ACTIVE:
-						makeActive = true;
-						if( ! onActivateCommand.empty() )
-						{
-							LOG4CPLUS_DEBUG(logger, "Activated: Running \"" << onActivateCommand << "\"");
-							int ret = system(onActivateCommand.c_str());
-                            if( ret )
-                                LOG4CPLUS_ERROR(logger, "Activate command failed: " << ret);
-						}
-						break;
-					case COMMAND_INACTIVE:
-						makeActive = false;
-						if( ! onDeactivateCommand.empty() )
-						{
-							LOG4CPLUS_DEBUG(logger, "Deactivated: Running \"" << onDeactivateCommand << "\"");
-							int ret = system(onDeactivateCommand.c_str());
-                            if( ret )
-                                LOG4CPLUS_ERROR(logger, "Deactivate command failed: " << ret);
-						}
-						break;
-					case COMMAND_RESTART:
-						LOG4CPLUS_DEBUG(logger, "COMMAND_RESTART");
-						running = false;
-						restart = true;
-						break;
-					case COMMAND_EXIT:
-						LOG4CPLUS_DEBUG(logger, "COMMAND_EXIT");
-						running = false;
-						break;
+					hooks.run("deactivate", onDeactivateCommand);
 				}
-				commands.pop();
+				break;
+			case COMMAND_ALERT:
+				if( recoverAction(cmd.alert) != RECOVER_NONE )
+				{
+					metricsAdd((metric_t)(METRIC_ALERTS + cmd.alert));
+					recover(recoverAction(cmd.alert));
+				}
+				break;
+			case COMMAND_EXIT:
+				LOG4CPLUS_DEBUG(logger, "COMMAND_EXIT");
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Starts recovering, or steps up a recovery under way. Only ever gets
+ * heavier, a later lighter alert doesn't undo a reopen in progress.
+ */
+void Main::recover(recover_action_t action) {
+	if (action == RECOVER_NONE || action <= recovering)
+		return;
+
+	if (recovering == RECOVER_NONE) {
+		recoverStarted = latencyNow();
+		recoverAttempts = 0;
+	}
+
+	LOG4CPLUS_INFO(logger, "Recovering CEC session: " << recoverName(action));
+	recovering = action;
+	setTimer(recoverfd, 0);
+	attemptRecovery();
+}
+
+void Main::onRecoverTimer() {
+	uint64_t expirations;
+
+	if (read(recoverfd, &expirations, sizeof expirations) < 0)
+		return;
+
+	if (recovering != RECOVER_NONE)
+		attemptRecovery();
+}
+
+void Main::attemptRecovery() {
+	bool recovered = false;
+
+	flightRecord(FLIGHT_RECOVER, 0, 0, 0, recovering, recoverAttempts);
+
+	if (recovering == RECOVER_PING) {
+		recovered = cec.ping();
+		if (!recovered) {
+			LOG4CPLUS_INFO(logger, "Adapter did not answer, reopening it");
+			recovering = RECOVER_REOPEN;
+		}
+	}
+
+	if (recovering == RECOVER_REOPEN || recovering == RECOVER_REINIT) {
+		cec.close(false);
+		recovered = recovering == RECOVER_REOPEN ? cec.reopen() : cec.reinit();
+
+		if (recovered && makeActive) {
+			try {
+				cec.makeActive();
+			} catch (std::exception &e) {
+				LOG4CPLUS_ERROR(logger, e.what());
+				recovered = false;
 			}
+		}
+	}
+
+	if (recovered) {
+		uint64_t ms = (latencyNow() - recoverStarted) / 1000;
+
+		LOG4CPLUS_INFO(logger, "Recovered by " << recoverName(recovering) << " in " << ms << "ms");
+		metricsAdd((metric_t)(METRIC_RECOVERIES + recovering));
+		metricsAdd(METRIC_RECOVER_MS, ms);
+		metricsMax(METRIC_RECOVER_MS_HIGH, ms);
+		recovering = RECOVER_NONE;
+		return;
+	}
+
+	metricsAdd(METRIC_RECOVER_FAILURES);
+	recoverAttempts++;
+
+	// an adapter that can't be reopened may have gone, look for it again
+	if (recovering == RECOVER_REOPEN && recoverAttempts >= RECOVER_REOPEN_ATTEMPTS)
+		recovering = RECOVER_REINIT;
+
+	// jittered, so several ceclircd on one bus don't retry in lockstep
+	unsigned backoff = min(RECOVER_BACKOFF_MAX, RECOVER_BACKOFF_MIN << min(recoverAttempts - 1, 16u));
+	unsigned delay = backoff / 2 + recoverJitter() % (backoff / 2 + 1);
+
+	LOG4CPLUS_WARN(logger, "Recovery failed, " << recoverName(recovering) << " in " << delay << "ms");
+	setTimer(recoverfd, delay);
+}
+
+/*
+ * Passes the LIRC socket and clients to the new ceclircd on fd, true once it
+ * has them. The adapter is closed first, so it can open it right away.
+ */
+bool Main::handOver(int fd) {
+	Handoff handoff;
+
+	LOG4CPLUS_INFO(logger, "Handing over to a new ceclircd");
+
+	cec.close(false);
+	mylirc.Detach(handoff);
+
+	bool done = handoffSend(fd, handoff);
+	close(fd);
+
+	if (done) {
+		handoffRelease(handoff);
+		return true;
+	}
+
+	// carry on as if nothing happened, see loop() for the adapter
+	if (!mylirc.Open(handoff)) {
+		throw std::runtime_error("Unable to take the LIRC socket back");
+	}
+	return false;
+}
+
+void Main::loop(const string & device) {
+	LOG4CPLUS_TRACE_STR(logger, "Main::loop()");
+
+	struct epoll_event events[8];
+	struct timespec stopped, done;
+	bool handedOver = false;
+	Handoff handoff;
+
+	// before setupLoop() binds a handoff socket of our own
+	if (takeover && !handoffReceive(mylirc.device + ".handoff", handoff)) {
+		throw std::runtime_error("Unable to take over from the running ceclircd");
+	}
+
+	setupLoop();
 
-			gettimeofday(&now, NULL);
-			timeout.tv_sec = now.tv_sec + 1;
-			timeout.tv_nsec = now.tv_usec * 1000;
+	// the LIRC server outlives CEC recoveries, clients never notice them
+	if (takeover ? !mylirc.Open(handoff) : !mylirc.Open()) {
+		return;
+	}
+
+	// a sink that can't start is left out, the others still get keys
+	for (size_t i = 0; i < sinks.size(); i++)
+		sinks[i]->start();
+
+	cec.open(device);
+
+	pthread_mutex_lock( &libcec_sync );
+	running = true;
+	pthread_mutex_unlock( &libcec_sync );
 
-			pthread_cond_timedwait(&libcec_cond, &libcec_sync, &timeout);
-			pthread_mutex_unlock( &libcec_sync );
+	if (makeActive) 
+	{
+		cec.makeActive();
+	}
+
+	// no timeout, the loop only wakes up when there is something to do
+	bool loop = true;
+	while( loop )
+	{
+		int n = epoll_wait(epollfd, events, sizeof events / sizeof events[0], -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Error during epoll_wait(): " + string(strerror(errno)));
 		}
-		while( running );
 
-		/* reset signals */
-		signal (SIGHUP,  SIG_DFL);
-		signal (SIGINT,  SIG_DFL);
-		signal (SIGTERM, SIG_DFL);
-		signal (SIGPIPE, SIG_DFL);
-		
-		cec.close(!restart);
-		mylirc.Close();
+		for (int i = 0; i < n && loop; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == commandfd)
+				loop = processCommands();
+			else if (fd == signalfd)
+				onSignal();
+			else if (fd == timerfd)
+				onTimer();
+			else if (fd == recoverfd)
+				onRecoverTimer();
+			else if (fd == repeater.fd())
+				repeater.onTimer();
+			else if (fd == sequencer.fd())
+				sequencer.onTimer();
+			else if (fd == keymap.fd())
+				onKeymapChanged();
+			else if (fd == hooks.fd())
+				hooks.onTimer();
+			else if (fd == metricsfd)
+				metricsServe(metricsfd);
+			else if (fd == handofffd) {
+				int peer = handoffAccept(handofffd);
+				if (peer >= 0) {
+					// closes the adapter either way, a failed handoff reopens it
+					handedOver = handOver(peer);
+					if (handedOver)
+						loop = false;
+					else
+						recover(RECOVER_REOPEN);
+				}
+			}
+		}
 	}
-	while( restart );
+
+	clock_gettime(CLOCK_MONOTONIC, &stopped);
+
+	pthread_mutex_lock( &libcec_sync );
+	running = false;
+	while( !commands.empty() )
+		commands.pop();
+	pthread_mutex_unlock( &libcec_sync );
+
+	if (!handedOver)
+		cec.close();
+	mylirc.Close();
+	for (size_t i = 0; i < sinks.size(); i++)
+		sinks[i]->stop();
+
+	clock_gettime(CLOCK_MONOTONIC, &done);
+	LOG4CPLUS_INFO(logger, (handedOver ? "Handoff" : "Shutdown") << ": closing took " << elapsedMs(stopped, done) << "ms");
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGPIPE);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
 }
 
 void Main::push(Command cmd) {
+	uint64_t one = 1;
+
 	pthread_mutex_lock(&libcec_sync);
 	if( running )
 	{
 		commands.push(cmd);
-		pthread_cond_signal(&libcec_cond);
-
 	}
 	pthread_mutex_unlock( &libcec_sync );
+
+	if (write(commandfd, &one, sizeof one) < 0 && errno != EAGAIN)
+		LOG4CPLUS_ERROR(logger, "Error writing command eventfd: " << strerror(errno));
 }
 
 void Main::stop() {
@@ -234,30 +618,11 @@ void Main::stop() {
 	push(Command(COMMAND_EXIT));
 }
 
-void Main::restart() {
-	LOG4CPLUS_TRACE_STR(logger, "Main::restart()");
-	push(Command(COMMAND_RESTART));
-}
-
 void Main::listDevices() {
 	LOG4CPLUS_TRACE_STR(logger, "Main::listDevices()");
 	cec.listDevices(cout);
 }
 
-void Main::signalHandler(int sigNum) {
-	LOG4CPLUS_DEBUG_STR(logger, "Main::signalHandler()");
-	
-	switch( sigNum ) {
-		case SIGPIPE:
-		case SIGHUP:
-			Main::instance().restart();
-			break;
-		default:
-			Main::instance().stop();
-			break;
-	}
-}
-
 char *Main::getCecName() {
 	LOG4CPLUS_TRACE_STR(logger, "Main::getCecName()");
 	if (gethostname(cec_name,HOST_NAME_MAX) < 0 ) {
@@ -268,149 +633,163 @@ char *Main::getCecName() {
 	return cec_name;
 }
 
-const std::vector<list<string>> & Main::setupUinputMap() {
-	static std::vector<list<string>> uinputCecMap;
-
-	if (uinputCecMap.empty()) {
-		uinputCecMap.resize(CEC_USER_CONTROL_CODE_MAX + 1, {});
-		uinputCecMap[CEC_USER_CONTROL_CODE_SELECT                      ] = { "KEY_OK" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_UP                          ] = { "KEY_UP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_DOWN                        ] = { "KEY_DOWN" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_LEFT                        ] = { "KEY_LEFT" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_RIGHT                       ] = { "KEY_RIGHT" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_RIGHT_UP                    ] = { "KEY_RIGHT", "KEY_UP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_RIGHT_DOWN                  ] = { "KEY_RIGHT", "KEY_DOWN" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_LEFT_UP                     ] = { "KEY_LEFT", "KEY_UP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_LEFT_DOWN                   ] = { "KEY_RIGHT", "KEY_UP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_ROOT_MENU                   ] = { "KEY_HOME" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_SETUP_MENU                  ] = { "KEY_SETUP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_CONTENTS_MENU               ] = { "KEY_MENU" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_FAVORITE_MENU               ] = { "KEY_FAVORITES" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_EXIT                        ] = { "KEY_EXIT" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER0                     ] = { "KEY_0" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER1                     ] = { "KEY_1" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER2                     ] = { "KEY_2" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER3                     ] = { "KEY_3" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER4                     ] = { "KEY_4" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER5                     ] = { "KEY_5" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER6                     ] = { "KEY_6" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER7                     ] = { "KEY_7" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER8                     ] = { "KEY_8" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NUMBER9                     ] = { "KEY_9" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_DOT                         ] = { "KEY_DOT" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_ENTER                       ] = { "KEY_ENTER" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_CLEAR                       ] = { "KEY_BACKSPACE" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_NEXT_FAVORITE               ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_CHANNEL_UP                  ] = { "KEY_CHANNELUP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_CHANNEL_DOWN                ] = { "KEY_CHANNELDOWN" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_PREVIOUS_CHANNEL            ] = { "KEY_PREVIOUS" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_SOUND_SELECT                ] = { "KEY_SOUND" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_INPUT_SELECT                ] = { "KEY_TUNER" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_DISPLAY_INFORMATION         ] = { "KEY_INFO" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_HELP                        ] = { "KEY_HELP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_PAGE_UP                     ] = { "KEY_PAGEUP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_PAGE_DOWN                   ] = { "KEY_PAGEDOWN" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_POWER                       ] = { "KEY_POWER" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_VOLUME_UP                   ] = { "KEY_VOLUMEUP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_VOLUME_DOWN                 ] = { "KEY_VOLUMEDOWN" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_MUTE                        ] = { "KEY_MUTE" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_PLAY                        ] = { "KEY_PLAY" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_STOP                        ] = { "KEY_STOP" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_PAUSE                       ] = { "KEY_PAUSE" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_RECORD                      ] = { "KEY_RECORD" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_REWIND                      ] = { "KEY_REWIND" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_FAST_FORWARD                ] = { "KEY_FASTFORWARD" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_EJECT                       ] = { "KEY_EJECTCD" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_FORWARD                     ] = { "KEY_FORWARD" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_BACKWARD                    ] = { "KEY_BACK" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_STOP_RECORD                 ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_PAUSE_RECORD                ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_ANGLE                       ] = { "KEY_SCREEN" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_SUB_PICTURE                 ] = { "KEY_SUBTITLE" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_VIDEO_ON_DEMAND             ] = { "KEY_VIDEO" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_ELECTRONIC_PROGRAM_GUIDE    ] = { "KEY_EPG" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_TIMER_PROGRAMMING           ] = { "KEY_TIME" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_INITIAL_CONFIGURATION       ] = { "KEY_CONFIG" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_PLAY_FUNCTION               ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_PAUSE_PLAY_FUNCTION         ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_RECORD_FUNCTION             ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_PAUSE_RECORD_FUNCTION       ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_STOP_FUNCTION               ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_MUTE_FUNCTION               ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_RESTORE_VOLUME_FUNCTION     ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_TUNE_FUNCTION               ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_SELECT_MEDIA_FUNCTION       ] = { "KEY_MEDIA" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_SELECT_AV_INPUT_FUNCTION    ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_SELECT_AUDIO_INPUT_FUNCTION ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_POWER_TOGGLE_FUNCTION       ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_POWER_OFF_FUNCTION          ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_POWER_ON_FUNCTION           ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_F1_BLUE                     ] = { "KEY_BLUE" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_F2_RED                      ] = { "KEY_RED" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_F3_GREEN                    ] = { "KEY_GREEN" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_F4_YELLOW                   ] = { "KEY_YELLOW" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_F5                          ] = { ""};
-		uinputCecMap[CEC_USER_CONTROL_CODE_DATA                        ] = { "KEY_TEXT" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_AN_RETURN                   ] = { "KEY_ESC" };
-		uinputCecMap[CEC_USER_CONTROL_CODE_AN_CHANNELS_LIST            ] = { "KEY_LIST" };
-	}
+int Main::onCecLogMessage(const cec_log_message &message) {
+	ALOG_DEBUG(logger, "Main::onCecLogMessage(", message, ")");
+	return 1;
+}
 
-	return uinputCecMap;
+/*
+ * Hands a mapped key to every sink
+ */
+void Main::dispatch(cec_user_control_code keycode, const LircKey &lircKey, unsigned repeat, bool release) {
+	for (size_t i = 0; i < sinks.size(); i++)
+		sinks[i]->key(keycode, lircKey, repeat, release);
 }
 
-int Main::onCecLogMessage(const cec_log_message &message) {
-	LOG4CPLUS_DEBUG(logger, "Main::onCecLogMessage(" << message << ")");
-	return 1;
+void Main::setEvdevSink(const string &path, bool uinput) {
+	evdevSink.path = path;
+	evdevSink.uinput = uinput;
+	if (sinks.back() != &evdevSink)
+		sinks.push_back(&evdevSink);
 }
 
-void Main::writeLirc(const cec_keypress &key, const string &keyString, const bool &repeat) {
-	LOG4CPLUS_DEBUG(logger, "Main::writeLirc() " << key);
-	stringstream s;
+/*
+ * Sends a key, or its long press, to the sinks, false if the keymap has
+ * none
+ */
+bool Main::sendKey(cec_user_control_code keycode, unsigned repeat, bool isLong) {
+	if (keycode < 0 || keycode > CEC_USER_CONTROL_CODE_MAX)
+		return false;
+
+	Keymap::Reader lircKeys(keymap);
+	const LircKey &lircKey = isLong ? lircKeys.longPress(keycode) : lircKeys[keycode];
 
-	s << "" << hex << key.keycode << " " << repeat << " " << keyString << " RPICEC" << endl;
-	mylirc.processevent(s.str().c_str());
+	if (!lircKey.count)
+		return false;
 
+	dispatch(keycode, lircKey, repeat, false);
+	return true;
+}
+
+/*
+ * Releases the names the press went out with. The LIRC socket only gets
+ * them if -E asked for them, as lircd --release does.
+ */
+void Main::sendRelease(cec_user_control_code keycode, bool isLong) {
+	if (keycode < 0 || keycode > CEC_USER_CONTROL_CODE_MAX)
+		return;
+
+	Keymap::Reader lircKeys(keymap);
+	const LircKey &lircKey = isLong ? lircKeys.longPress(keycode) : lircKeys[keycode];
+
+	if (lircKey.count)
+		dispatch(keycode, lircKey, 0, true);
+}
+
+/*
+ * Events of the held key, from the Repeater
+ */
+void Main::onKeyEvent(key_event_t event, cec_user_control_code keycode, unsigned count) {
+	flightRecord(FLIGHT_KEY_EVENT, keycode, 0, 0, event, count);
+
+	switch (event) {
+		case KEY_EVENT_PRESS:
+			// presses may be part of a sequence, repeats follow their press
+			if (count == 0)
+				sequencer.press(keycode);
+			else if (!sequencer.holding(keycode))
+				sendKey(keycode, count, false);
+			break;
+		case KEY_EVENT_LONG:
+			metricsAdd(METRIC_LONG_PRESSES);
+			sequencer.interrupt();
+			sendKey(keycode, 0, true);
+			break;
+		case KEY_EVENT_RELEASE:
+			// count tells whether the press was a long one
+			if (count || !sequencer.holding(keycode))
+				sendRelease(keycode, count != 0);
+			break;
+	}
 }
 
 int Main::onCecKeyPress(const cec_keypress &key) {
-	LOG4CPLUS_DEBUG(logger, "Main::onCecKeyPress(" << key << ") start");
+	ALOG_DEBUG(logger, "Main::onCecKeyPress(", key, ")");
+
+	bool pressed = key.duration == 0 || key.keycode == CEC_USER_CONTROL_CODE_AN_CHANNELS_LIST || key.keycode == CEC_USER_CONTROL_CODE_AN_RETURN;
+
+	// a key press doesn't say who sent it, the User Control Pressed it came from does
+	if (pressed && deduper.duplicate(key.keycode, keyInitiator.load())) {
+		ALOG_DEBUG(logger, "Main::onCecKeyPress(", key, ") duplicate dropped");
+		metricsAdd(METRIC_DUPLICATES);
+		return 1;
+	}
+
+	if (key.keycode >= 0 && key.keycode <= CEC_USER_CONTROL_CODE_MAX)
+		metricsAdd((metric_t)(METRIC_KEYS + key.keycode));
+
+	bool mapped = false;
+	bool hasLong = false;
 
-	// Check bounds and find uinput code for this cec keypress
 	if (key.keycode >= 0 && key.keycode <= CEC_USER_CONTROL_CODE_MAX) {
-		const list<string> & uinputKeys = uinputCecMap[key.keycode];
-
-		if ( !uinputKeys.empty() ) {
-			if( key.duration == 0 || key.keycode == CEC_USER_CONTROL_CODE_AN_CHANNELS_LIST || key.keycode == CEC_USER_CONTROL_CODE_AN_RETURN) {
-				lastKey = key;
-
-				/*
-				** KEY PRESSED
-				*/
-				for (std::list<string>::const_iterator ukeys = uinputKeys.begin(); ukeys != uinputKeys.end(); ++ukeys) {
-					string ukey = *ukeys;
-					writeLirc(key, ukey, (repeatCount > 2));
-				}
-			}
+		Keymap::Reader lircKeys(keymap);
+		hasLong = lircKeys.longPress(key.keycode).count != 0;
+		mapped = hasLong || lircKeys[key.keycode].count != 0;
+	}
+
+	if( key.duration == 0 )
+	{
+		/*
+		** KEY PRESSED, repeated or classified as long until it is released
+		*/
+		if( mapped )
+			repeater.press(key.keycode, hasLong);
+	}
+	else if( key.keycode == CEC_USER_CONTROL_CODE_AN_CHANNELS_LIST || key.keycode == CEC_USER_CONTROL_CODE_AN_RETURN )
+	{
+		// some TVs only ever send these as a release, the duration still tells short from long
+		if( mapped )
+		{
+			repeater.press(key.keycode, hasLong);
+			repeater.release(key.keycode, key.duration);
 		}
 	}
+	else
+	{
+		/*
+		** KEY RELEASED, after duration ms
+		*/
+		repeater.release(key.keycode, key.duration);
+	}
 
-	LOG4CPLUS_DEBUG(logger, "Main::onCecKeyPress(" << key << ") end");
 	return 1;
 }
 
-int Main::onCecKeyPress(const cec_user_control_code & keycode) {
-	cec_keypress key = { .keycode=keycode };
+/*
+ * A key ceclircd made up from a command, sent once and never repeated
+ */
+int Main::onCecKeyPress(const cec_user_control_code & keycode, cec_logical_address initiator) {
+	if (deduper.duplicate(keycode, initiator)) {
+		ALOG_DEBUG(logger, "Main::onCecKeyPress(", keycode, ") duplicate dropped");
+		metricsAdd(METRIC_DUPLICATES_COMMAND);
+		return 1;
+	}
+
+	if (keycode >= 0 && keycode <= CEC_USER_CONTROL_CODE_MAX)
+		metricsAdd((metric_t)(METRIC_KEYS + keycode));
 
 	/* PUSH KEY */
-	key.duration = 0;
-	onCecKeyPress( key );
+	if (sendKey(keycode, 0, false))
+		sendRelease(keycode, false);
 
 	return 1;
 }
 
 
 int Main::onCecCommand(const cec_command & command) {
-	LOG4CPLUS_DEBUG(logger, "Main::onCecCommand(" << command << ") start");
+	ALOG_DEBUG(logger, "Main::onCecCommand(", command, ")");
+
+	metricsAdd((metric_t)(METRIC_OPCODES + (command.opcode & 0xff)));
 	
 	switch( command.opcode )
 	{
@@ -418,7 +797,7 @@ int Main::onCecCommand(const cec_command & command) {
 //			if( (command.initiator == CECDEVICE_TV)
 //                         && ( (command.destination == CECDEVICE_BROADCAST) || (command.destination == logicalAddress))  )
 //			{
-				push(Command(COMMAND_STANDBY));
+				push(Command(COMMAND_STANDBY, command));
 //			}
 			break;
 		case CEC_OPCODE_REQUEST_ACTIVE_SOURCE:
@@ -428,14 +807,14 @@ int Main::onCecCommand(const cec_command & command) {
                 if( makeActive )
                 {
                     /* remind TV we are active */
-                    push(Command(COMMAND_ACTIVE));
+                    push(Command(COMMAND_ACTIVE, command));
                 }
 //			}
 		case CEC_OPCODE_SET_MENU_LANGUAGE:
 			if( (command.initiator == CECDEVICE_TV) && (command.parameters.size == 3)
                          && ( (command.destination == CECDEVICE_BROADCAST) || (command.destination == logicalAddress))  )
 			{
-				LOG4CPLUS_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_SET_MENU_LANGUAGE)");
+				ALOG_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_SET_MENU_LANGUAGE)");
 				/* TODO */
 			}
 			break;
@@ -444,65 +823,57 @@ int Main::onCecCommand(const cec_command & command) {
 //                         && ( (command.destination == CECDEVICE_BROADCAST) || (command.destination == logicalAddress))  )
 //			{
 				if( command.parameters[0] == CEC_DECK_CONTROL_MODE_STOP ) {
-					onCecKeyPress(CEC_USER_CONTROL_CODE_STOP);
+					onCecKeyPress(CEC_USER_CONTROL_CODE_STOP, command.initiator);
 				}
 //			}
 			break;
 		case CEC_OPCODE_PLAY:
-			LOG4CPLUS_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_PLAY)");
+			ALOG_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_PLAY)");
 //			if( (command.initiator == CECDEVICE_TV) && (command.parameters.size == 1)
 //                         && ( (command.destination == CECDEVICE_BROADCAST) || (command.destination == logicalAddress))  )
 //			{
 				if( command.parameters[0] == CEC_PLAY_MODE_PLAY_FORWARD ) {
-					onCecKeyPress(CEC_USER_CONTROL_CODE_PLAY);
+					onCecKeyPress(CEC_USER_CONTROL_CODE_PLAY, command.initiator);
 				}
 				else if( command.parameters[0] == CEC_PLAY_MODE_PLAY_STILL ) {
-					onCecKeyPress(CEC_USER_CONTROL_CODE_PAUSE);
+					onCecKeyPress(CEC_USER_CONTROL_CODE_PAUSE, command.initiator);
 				} else {
-					onCecKeyPress(CEC_USER_CONTROL_CODE_PLAY);
+					onCecKeyPress(CEC_USER_CONTROL_CODE_PLAY, command.initiator);
 				}
 //			}
 			break;
 		case CEC_OPCODE_USER_CONTROL_PRESSED:
-			LOG4CPLUS_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_USER_CONTROL_PRESSED)");
-			repeatCount = 0;
-			lastKey.keycode = CEC_USER_CONTROL_CODE_UNKNOWN;
+			ALOG_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_USER_CONTROL_PRESSED)");
+			// TVs resend it while the key is down. libcec turns each one into a key
+			// press too while iButtonRepeatRateMs is 0, press() just extends the hold then
+			keyInitiator = command.initiator;
+			if( command.parameters.size >= 1 )
+				repeater.hold((cec_user_control_code)command.parameters[0]);
+			break;
+		case CEC_OPCODE_USER_CONTROL_RELEASE:
+			ALOG_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_USER_CONTROL_RELEASE)");
+			repeater.release();
 			break;
+		case CEC_OPCODE_VENDOR_REMOTE_BUTTON_DOWN:
 		case CEC_OPCODE_VENDOR_REMOTE_BUTTON_UP:
-			LOG4CPLUS_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_VENDOR_REMOTE_BUTTON_UP) repeatCount=" << repeatCount);
-			repeatCount++;
-			if (repeatCount > 2 && lastKey.keycode != CEC_USER_CONTROL_CODE_UNKNOWN) {
-				onCecKeyPress( lastKey.keycode );
-			} else {
-				LOG4CPLUS_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_VENDOR_REMOTE_BUTTON_UP) code ignored");
-			}
+			// sent by some TVs while a key is held
+			ALOG_DEBUG(logger, "Main::onCecCommand(CEC_OPCODE_VENDOR_REMOTE_BUTTON) key held");
+			repeater.hold();
 			break;
 		default:
-			LOG4CPLUS_DEBUG(logger, "Main::onCecCommand(UNKONWN) opcode=" << hex << command.opcode); 
+			ALOG_DEBUG(logger, "Main::onCecCommand(UNKONWN)");
 			break;
 	}
-	
-	LOG4CPLUS_DEBUG(logger, "Main::onCecCommand(" << command << ") end");
+
 
 	return 1;
 }
 
 int Main::onCecAlert(const CEC::libcec_alert alert, const CEC::libcec_parameter & param) {
 	LOG4CPLUS_ERROR(logger, "Main::onCecAlert(alert=" << alert << ")");
-	switch( alert )
-	{
-		case CEC_ALERT_SERVICE_DEVICE:
-			break;
-		case CEC_ALERT_CONNECTION_LOST:
-		case CEC_ALERT_PERMISSION_ERROR:
-		case CEC_ALERT_PORT_BUSY:
-		case CEC_ALERT_PHYSICAL_ADDRESS_ERROR:
-		case CEC_ALERT_TV_POLL_FAILED:
-			Main::instance().restart();
-			break;
-		default:
-			break;
-	}
+
+	// recovery runs in the main loop, never on a libcec thread
+	push(Command(COMMAND_ALERT, alert));
 	return 1;
 }
 
@@ -517,7 +888,7 @@ int Main::onCecConfigurationChanged(const libcec_configuration & configuration)
 int Main::onCecMenuStateChanged(const cec_menu_state & menu_state) {
 	LOG4CPLUS_DEBUG(logger, "Main::onCecMenuStateChanged(" << menu_state << ")");
 
-	return onCecKeyPress(CEC_USER_CONTROL_CODE_CONTENTS_MENU);
+	return onCecKeyPress(CEC_USER_CONTROL_CODE_CONTENTS_MENU, CECDEVICE_TV);
 }
 
 void Main::onCecSourceActivated(const cec_logical_address & address, bool bActivated) {
@@ -526,16 +897,44 @@ void Main::onCecSourceActivated(const cec_logical_address & address, bool bActiv
 	{
 		if( bActivated )
 		{
-			push(Command(COMMAND_ACTIVE));
+			push(Command(COMMAND_ACTIVE, address));
 		}
 		else
 		{	
-			push(Command(COMMAND_INACTIVE));
+			push(Command(COMMAND_INACTIVE, address));
 		}
 	}
 }
 
 
+/*
+ * libcec log levels by name, e.g. error,warning or all, or as a number
+ */
+static bool parseLogMask(const string &levels, int &mask) {
+	static const struct { const char *name; int level; } names[] = {
+		{ "error", CEC_LOG_ERROR }, { "warning", CEC_LOG_WARNING }, { "notice", CEC_LOG_NOTICE },
+		{ "traffic", CEC_LOG_TRAFFIC }, { "debug", CEC_LOG_DEBUG }, { "all", CEC_LOG_ALL }, { "none", 0 },
+	};
+	stringstream in(levels);
+	string name;
+
+	char *end;
+	mask = strtol(levels.c_str(), &end, 0);
+	if (!*end && end != levels.c_str())
+		return true;
+
+	mask = 0;
+	while (std::getline(in, name, ',')) {
+		size_t i;
+		for (i = 0; i < sizeof names / sizeof names[0] && name != names[i].name; i++)
+			;
+		if (i == sizeof names / sizeof names[0])
+			return false;
+		mask |= names[i].level;
+	}
+	return true;
+}
+
 int main (int argc, char *argv[]) {
 
     BasicConfigurator config;
@@ -547,8 +946,25 @@ int main (int argc, char *argv[]) {
 	bool list = false;
 	bool dontactivate = false;
 	string lircpath;
+	unsigned queuelen = 0;
+	string overflow;
+	string keymap;
+	string helper;
+	string metricspath;
+	string backend;
+	string capture;
+	bool takeover = false;
+	string repeat;
+	int longPress = -1;
+	string releaseSuffix;
+	string sequences;
+	int dedupe = -1;
+	int logMask = -1;
+	string flightpath;
+	string sink;
+	string tcp;
 	
-	while((opt = getopt(argc, argv, "hVflv:ai:")) != -1) {
+	while((opt = getopt(argc, argv, "hVfd:lv:ai:q:o:t:x:m:b:r:uR:L:E:s:D:C:F:O:T:")) != -1) {
         switch(opt) {
 			case 'd':
 				lircpath = string(optarg);
@@ -566,17 +982,117 @@ int main (int argc, char *argv[]) {
 			case 'a':
 				dontactivate = true;
 				break;
+			case 'q': {
+				// strtoul() would take -1 as ULONG_MAX
+				char *end;
+				errno = 0;
+				unsigned long len = strtoul(optarg, &end, 10);
+				if (!isdigit((unsigned char)*optarg) || *end || errno || len < 1 || len > LIRC_QUEUE_MAX) {
+					cerr << "Expected a queue length from 1 to " << LIRC_QUEUE_MAX << ", got " << optarg << endl;
+					return -1;
+				}
+				queuelen = len;
+				break;
+			}
+			case 't':
+				keymap = string(optarg);
+				break;
+			case 'x':
+				helper = string(optarg);
+				break;
+			case 'm':
+				metricspath = string(optarg);
+				break;
+			case 'b':
+				backend = string(optarg);
+				if (backend != "libcec" && backend.compare(0, 5, "fake:") != 0 && backend.compare(0, 7, "replay:") != 0) {
+					cerr << "Unknown backend " << backend << endl;
+					return -1;
+				}
+				break;
+			case 'r':
+				capture = string(optarg);
+				break;
+			case 'u':
+				takeover = true;
+				break;
+			case 'R':
+				repeat = string(optarg);
+				break;
+			case 'L':
+				longPress = atoi(optarg);
+				break;
+			case 'F':
+				flightpath = string(optarg);
+				break;
+			case 'T':
+				tcp = string(optarg);
+				break;
+			case 'O':
+				sink = string(optarg);
+				if (sink != "uinput" && sink.compare(0, 7, "uinput:") != 0 && sink.compare(0, 5, "pipe:") != 0) {
+					cerr << "Unknown sink " << sink << endl;
+					return -1;
+				}
+				break;
+			case 'C':
+				if (!parseLogMask(optarg, logMask)) {
+					cerr << "Unknown libcec log level in " << optarg << endl;
+					return -1;
+				}
+				break;
+			case 'D':
+				dedupe = atoi(optarg);
+				break;
+			case 's':
+				sequences = string(optarg);
+				break;
+			case 'E':
+				releaseSuffix = string(optarg);
+				if (releaseSuffix.empty() || releaseSuffix.size() > 16 || releaseSuffix.find_first_of(" \n") != string::npos) {
+					cerr << "Expected a release suffix of up to 16 characters without blanks, got " << releaseSuffix << endl;
+					return -1;
+				}
+				break;
+			case 'o':
+				overflow = string(optarg);
+				if (overflow != "oldest" && overflow != "repeats" && overflow != "disconnect") {
+					cerr << "Unknown overflow policy " << overflow << endl;
+					return -1;
+				}
+				break;
 			case 'V':
 			case 'h':
             default:
 		cout << "Usage: " << argv[0] << " [options] " << endl << endl;
 		cout << "Options:" << endl;
 		cout << "\t-d <socket> UNIX socket. The default is /var/run/lirc/lircd." << endl;
+		cout << "\t-T [<address>:]<port>[,<send buffer>] Also serve LIRC clients over TCP, like lircd --listen. lircd's port is " << LIRC_TCP_PORT << "." << endl;
+		cout << "\t\tThe default address is any, the default send buffer " << LIRC_TCP_SNDBUF << " bytes per client." << endl;
 		cout << "\t-f Run in the foreground." << endl;
 		cout << "\t-l list cec devices" << endl;
 		cout << "\t-a do not activate" << endl;
 		cout << "\t-v <num> log level" << endl;
-		cout << "\t-t <path> Path to translation table." << endl;
+		cout << "\t-q <num> Lines queued per LIRC client, up to " << LIRC_QUEUE_MAX << ". The default is " << LIRC_QUEUE_LEN << "." << endl;
+		cout << "\t-o <policy> What to do when a client queue is full: oldest (drop oldest line, default), repeats (drop repeats only) or disconnect." << endl;
+		cout << "\t-t <path> Path to translation table, as compiled by ceclircd-keymap. Reloaded when it changes." << endl;
+		cout << "\t-x <command> Keep <command> running and write standby/activate/deactivate events to its stdin, one line each." << endl;
+		cout << "\t-m <socket> UNIX socket serving metrics in Prometheus text format. The default is the LIRC socket with .metrics appended." << endl;
+		cout << "\t-b <backend> libcec (default) or fake:<script>[:<record>] to play a script of CEC events instead, see fakecec.h." << endl;
+		cout << "\t\treplay:<capture>[:<speed>] plays a capture back, at <speed> times the pace it was captured at, 0 as fast as possible. The default speed is 1." << endl;
+		cout << "\t-r <path> Capture every CEC callback to <path>, appended to if it exists." << endl;
+		cout << "\t-R <delay>,<rate>[,<max rate>,<ramp>] Repeat held keys after <delay> ms at <rate> per second, rising to <max rate> over <ramp> ms. The default is " << REPEAT_DELAY << "," << REPEAT_RATE << "." << endl;
+		cout << "\t-L <ms> Keys with a long press mapping in the translation table count as long when held for <ms>. The default is " << REPEAT_LONG_PRESS << ", 0 turns long presses off." << endl;
+		cout << "\t-E <suffix> Send a release event for every key, with <suffix> appended to its name, e.g. _UP. Like lircd --release." << endl;
+		cout << "\t-s <path> Recognise the key sequences and chords in <path> and send a LIRC name for each, see sequence.h." << endl;
+		cout << "\t-D <ms> Drop a key that came from the same device within <ms>, e.g. as a key press and as a Play command. The default is " << DEDUPE_WINDOW << ", 0 keeps every key." << endl;
+		cout << "\t-C <levels> libcec log levels to log, any of error,warning,notice,traffic,debug, or all or none. The default is all." << endl;
+		cout << "\t-u Take over the LIRC socket and its clients from the running ceclircd, which then exits. For upgrades without dropping clients." << endl;
+		cout << "\t-O <sink> Also send keys as evdev events: uinput creates an input device named " << SINK_UINPUT_NAME << " on " << SINK_UINPUT << "," << endl;
+		cout << "\t\tuinput:<path> on another uinput node, pipe:<path> writes the bare input_event records to a pipe or file instead." << endl;
+		cout << "\t-F <path> Where SIGUSR1 and crashes dump the flight recorder, read it with ceclircd-flight. The default is the LIRC socket with .flight appended." << endl;
+		cout << "\tSend SIGUSR1 to dump the flight recorder." << endl;
+		cout << "\tSend SIGUSR2 to log key latency percentiles." << endl;
                 return 0;
         }
     }
@@ -606,6 +1122,141 @@ int main (int argc, char *argv[]) {
 		if (!lircpath.empty()) {
 			main.setLircPath(lircpath);
 		}
+
+		if (!keymap.empty() && !main.setKeymap(keymap)) {
+			cerr << "Unable to load translation table " << keymap << endl;
+			return -1;
+		}
+
+		if (!helper.empty()) {
+			main.setHookHelper(helper);
+		}
+
+		if (!metricspath.empty()) {
+			main.setMetricsPath(metricspath);
+		}
+
+		if (takeover) {
+			main.setTakeover(true);
+		}
+
+		if (!repeat.empty()) {
+			unsigned delay = REPEAT_DELAY, rate = REPEAT_RATE, maxRate = 0, ramp = 0;
+			int n = sscanf(repeat.c_str(), "%u,%u,%u,%u", &delay, &rate, &maxRate, &ramp);
+			if (n != 2 && n != 4) {
+				cerr << "Expected -R <delay>,<rate>[,<max rate>,<ramp>], got " << repeat << endl;
+				return -1;
+			}
+			main.setRepeat(delay, rate, n == 4 ? maxRate : rate, ramp);
+		}
+
+		if (longPress >= 0) {
+			main.setLongPress(longPress);
+		}
+
+		if (!releaseSuffix.empty()) {
+			main.setReleaseSuffix(releaseSuffix);
+		}
+
+		if (!flightpath.empty()) {
+			main.setFlightPath(flightpath);
+		}
+
+		if (!tcp.empty()) {
+			string spec = tcp;
+			string address;
+			unsigned port = 0;
+			int sndbuf = LIRC_TCP_SNDBUF;
+
+			size_t comma = tcp.find(',');
+			if (comma != string::npos) {
+				sndbuf = atoi(tcp.substr(comma + 1).c_str());
+				tcp = tcp.substr(0, comma);
+			}
+
+			// [::1]:8765 for IPv6
+			size_t colon = tcp.rfind(':');
+			if (colon != string::npos) {
+				address = tcp.substr(0, colon);
+				if (address.size() > 2 && address[0] == '[' && address[address.size() - 1] == ']')
+					address = address.substr(1, address.size() - 2);
+			}
+			port = atoi(tcp.substr(colon == string::npos ? 0 : colon + 1).c_str());
+
+			if (port == 0 || port > 65535 || sndbuf < 0) {
+				cerr << "Expected -T [<address>:]<port>[,<send buffer>], got " << spec << endl;
+				return -1;
+			}
+			main.setLircTcp(address, port, sndbuf);
+		}
+
+		if (sink == "uinput") {
+			main.setEvdevSink(SINK_UINPUT, true);
+		} else if (sink.compare(0, 7, "uinput:") == 0) {
+			main.setEvdevSink(sink.substr(7), true);
+		} else if (sink.compare(0, 5, "pipe:") == 0) {
+			main.setEvdevSink(sink.substr(5), false);
+		}
+
+		if (logMask >= 0) {
+			Cec::setLogMask(logMask);
+		}
+
+		if (dedupe >= 0) {
+			main.setDedupeWindow(dedupe);
+		}
+
+		if (!sequences.empty() && !main.setSequences(sequences)) {
+			return -1;
+		}
+
+		if (backend.compare(0, 5, "fake:") == 0) {
+			string script = backend.substr(5);
+			string record;
+			size_t colon = script.find(':');
+			if (colon != string::npos) {
+				record = script.substr(colon + 1);
+				script = script.substr(0, colon);
+			}
+
+			FakeBackend *fake = new FakeBackend();
+			if (!fake->load(script, record)) {
+				delete fake;
+				return -1;
+			}
+			main.setBackend(fake);
+		}
+
+		if (backend.compare(0, 7, "replay:") == 0) {
+			string path = backend.substr(7);
+			double speed = 1;
+			size_t colon = path.find(':');
+			if (colon != string::npos) {
+				speed = atof(path.substr(colon + 1).c_str());
+				path = path.substr(0, colon);
+			}
+
+			ReplayBackend *replay = new ReplayBackend();
+			if (speed < 0 || !replay->load(path, speed)) {
+				delete replay;
+				return -1;
+			}
+			main.setBackend(replay);
+		}
+
+		if (!capture.empty() && !captureOpen(capture)) {
+			return -1;
+		}
+
+		if (queuelen) {
+			main.setLircQueueLen(queuelen);
+		}
+
+		if (overflow == "repeats") {
+			main.setLircOverflow(OVERFLOW_DROP_REPEATS);
+		} else if (overflow == "disconnect") {
+			main.setLircOverflow(OVERFLOW_DISCONNECT);
+		}
 		
 		if (list) {
 			main.listDevices();
@@ -616,9 +1267,13 @@ int main (int argc, char *argv[]) {
 			daemon(0, 0);
 		}
 
+		// after daemon(), the thread wouldn't survive the fork
+		asyncLogStart();
 		main.loop(device);
+		asyncLogStop();
 
 	} catch (std::exception & e) {
+		asyncLogStop();
 		cerr << e.what() << endl;
 		return -1;
 	}
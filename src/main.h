@@ -28,23 +28,52 @@
 
 #include "libcec.h"
 #include "lirc.h"
+#include "keymap.h"
+#include "hooks.h"
+#include "repeat.h"
+#include "sequence.h"
+#include "dedupe.h"
+#include "sink.h"
+#include <atomic>
 #include <limits.h>
 #include <string>
 #include <queue>
-#include <list>
+#include <vector>
+
+/*
+ * How hard to try to get the CEC session back, lightest first
+ */
+typedef enum {
+	RECOVER_NONE,
+	RECOVER_PING,		// the adapter may well be fine, ask it
+	RECOVER_REOPEN,		// reopen the adapter found before
+	RECOVER_REINIT,		// unload libcec and start over
+} recover_action_t;
 
 class Command
 {
 	public:
-		Command(int command, CEC::cec_user_control_code keycode=CEC::CEC_USER_CONTROL_CODE_UNKNOWN) : command(command), keycode(keycode) {};
+		Command(int command, CEC::cec_user_control_code keycode=CEC::CEC_USER_CONTROL_CODE_UNKNOWN) : command(command), keycode(keycode),
+			initiator(CEC::CECDEVICE_UNKNOWN), destination(CEC::CECDEVICE_UNKNOWN), opcode(CEC::CEC_OPCODE_NONE) {};
+		Command(int command, const CEC::cec_command &cec) : command(command), keycode(CEC::CEC_USER_CONTROL_CODE_UNKNOWN),
+			initiator(cec.initiator), destination(cec.destination), opcode(cec.opcode) {};
+		Command(int command, CEC::cec_logical_address initiator) : command(command), keycode(CEC::CEC_USER_CONTROL_CODE_UNKNOWN),
+			initiator(initiator), destination(CEC::CECDEVICE_UNKNOWN), opcode(CEC::CEC_OPCODE_NONE) {};
+		Command(int command, CEC::libcec_alert alert) : command(command), alert(alert),
+			initiator(CEC::CECDEVICE_UNKNOWN), destination(CEC::CECDEVICE_UNKNOWN), opcode(CEC::CEC_OPCODE_NONE) {};
 		~Command() {};
 
 		const int command;
 		union
 		{
 			const CEC::cec_user_control_code keycode;
+			const CEC::libcec_alert alert;
 		};
 
+		// where the command came from, passed on to the hook helper
+		const CEC::cec_logical_address initiator;
+		const CEC::cec_logical_address destination;
+		const CEC::cec_opcode opcode;
 };
 
 class Main : public CecCallback {
@@ -61,11 +90,6 @@ class Main : public CecCallback {
 		bool makeActive;
 		bool running;
 
-		//
-//		std::list<string> lastUInputKeys; // for key(s) repetition
-		CEC::cec_keypress lastKey;
-		int repeatCount;
-
 		//
 		Main();
 		virtual ~Main();
@@ -74,11 +98,51 @@ class Main : public CecCallback {
 		Main(Main const&);
 		void operator=(Main const&);
 
-		static void signalHandler(int sigNum);
-
-		static const std::vector<std::list<string>> & setupUinputMap();
+		// drives the callbacks without an adapter, see bench.cpp
+		friend class Bench;
+
+		// main loop
+		int epollfd;
+		int commandfd;
+		int signalfd;
+		int timerfd;
+		int metricsfd;
+		std::string metricsPath;
+		std::string flightPath;
+		int handofffd;
+		bool takeover;
+
+		// reconnect state machine, see recover()
+		int recoverfd;
+		recover_action_t recovering;
+		unsigned recoverAttempts;
+		uint64_t recoverStarted;
+
+		void setupLoop();
+		void setTimer(int fd, unsigned ms);
+		void onTimer();
+		void onSignal();
+		void onKeymapChanged();
+		bool processCommands();
+		bool handOver(int fd);
+
+		void recover(recover_action_t action);
+		void attemptRecovery();
+		void onRecoverTimer();
+
+		Keymap keymap;
+		HookRunner hooks;
+		Repeater repeater;
+		Sequencer sequencer;
+		Deduper deduper;
+		std::atomic<CEC::cec_logical_address> keyInitiator;	// of the last User Control Pressed
 		std::queue<Command> commands;
 
+		// where mapped keys go, the LIRC socket first
+		LircSink lircSink;
+		EvdevSink evdevSink;
+		std::vector<Sink *> sinks;
+
 		std::string onStandbyCommand;
 		std::string onActivateCommand;
 		std::string onDeactivateCommand;
@@ -89,14 +153,15 @@ class Main : public CecCallback {
 
 		void push(Command command);
 
-		void writeLirc(const CEC::cec_keypress &key, const string &keyString, const bool &repeat);
+		void dispatch(CEC::cec_user_control_code keycode, const LircKey &lircKey, unsigned repeat, bool release);
+		bool sendKey(CEC::cec_user_control_code keycode, unsigned repeat, bool isLong);
+		void sendRelease(CEC::cec_user_control_code keycode, bool isLong);
+		void onKeyEvent(key_event_t event, CEC::cec_user_control_code keycode, unsigned count);
 	public:
 
-		static const std::vector<std::list<string>> uinputCecMap;
-
 		int onCecLogMessage(const CEC::cec_log_message &message);
 		int onCecKeyPress(const CEC::cec_keypress &key);
-		int onCecKeyPress(const CEC::cec_user_control_code & keycode);
+		int onCecKeyPress(const CEC::cec_user_control_code & keycode, CEC::cec_logical_address initiator);
 		int onCecCommand(const CEC::cec_command &command);
 		int onCecConfigurationChanged(const CEC::libcec_configuration & configuration);
 		int onCecAlert(const CEC::libcec_alert alert, const CEC::libcec_parameter & param);
@@ -107,7 +172,6 @@ class Main : public CecCallback {
 
 		void loop(const std::string &device = "");
 		void stop();
-		void restart();
 
 		void listDevices();
 
@@ -115,7 +179,24 @@ class Main : public CecCallback {
 		void setOnStandbyCommand(const std::string &cmd) {this->onStandbyCommand = cmd;};
 		void setOnActivateCommand(const std::string &cmd) {this->onActivateCommand = cmd;};
 		void setOnDeactivateCommand(const std::string &cmd) {this->onDeactivateCommand = cmd;};
+		void setHookHelper(const std::string &cmd) {this->hooks.helper = cmd;};
+		void setRepeat(unsigned delay, unsigned rate, unsigned maxRate, unsigned ramp) {
+			repeater.delay = delay; repeater.rate = rate; repeater.maxRate = maxRate; repeater.ramp = ramp;};
+		void setLongPress(unsigned ms) {repeater.longPress = ms;};
+		void setDedupeWindow(unsigned ms) {deduper.window = ms;};
+		bool setSequences(const std::string &path) {return sequencer.load(path);};
+		void setReleaseSuffix(const std::string &suffix) {this->lircSink.releaseSuffix = suffix;};
+		void setEvdevSink(const std::string &path, bool uinput);
 		void setTargetAddress(const HDMI::address & address) {cec.setTargetAddress(address);};
+		void setBackend(CecBackend *backend) {cec.setBackend(backend);};
 
 		void setLircPath(string lircpath) {this->mylirc.device = lircpath;};
+		bool setKeymap(const std::string &path) {return keymap.load(path) && keymap.watch();};
+		void setLircQueueLen(unsigned len) {this->mylirc.queue_len = len;};
+		void setLircOverflow(overflow_policy_t policy) {this->mylirc.overflow = policy;};
+		void setLircTcp(const std::string &address, unsigned port, int sndbuf) {
+			mylirc.tcp_address = address; mylirc.tcp_port = port; mylirc.tcp_sndbuf = sndbuf;};
+		void setMetricsPath(const std::string &path) {this->metricsPath = path;};
+		void setFlightPath(const std::string &path) {this->flightPath = path;};
+		void setTakeover(bool takeover) {this->takeover = takeover;};
 };
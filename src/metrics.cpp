@@ -0,0 +1,285 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "metrics.h"
+#include "keycodes.h"
+#include "latency.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <sstream>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::string;
+using std::stringstream;
+
+static Logger logger = Logger::getInstance("metrics");
+
+static MetricsShard shards[METRICS_SHARDS];
+
+// what exited threads counted
+static MetricsShard retired;
+
+// a scrape never sees a thread's counts in neither or both of its shard and retired
+static pthread_mutex_t foldLock = PTHREAD_MUTEX_INITIALIZER;
+
+// the last shard is for threads that found no free one
+static bool sharedShard = (shards[METRICS_SHARDS - 1].shared = true);
+
+// aggregated with max instead of summed
+static bool highWater(unsigned metric) {
+	return metric == METRIC_CLIENT_QUEUE_HIGH || metric == METRIC_EVENT_QUEUE_HIGH || metric == METRIC_RECOVER_MS_HIGH;
+}
+
+/*
+ * Folds a thread's counters into retired when it exits, libcec starts new
+ * threads on every restart and the shards have to be reused.
+ */
+class MetricsRelease {
+	public:
+		MetricsShard *shard;
+
+		MetricsRelease() : shard(NULL) {};
+		~MetricsRelease() {
+			if (!shard || shard->shared)
+				return;
+
+			pthread_mutex_lock(&foldLock);
+			for (unsigned i = 0; i < METRIC_COUNT; i++) {
+				uint64_t value = shard->values[i].exchange(0, std::memory_order_relaxed);
+
+				if (highWater(i)) {
+					uint64_t old = retired.values[i].load(std::memory_order_relaxed);
+					while (value > old && !retired.values[i].compare_exchange_weak(old, value, std::memory_order_relaxed))
+						;
+				} else if (value) {
+					retired.values[i].fetch_add(value, std::memory_order_relaxed);
+				}
+			}
+			pthread_mutex_unlock(&foldLock);
+
+			shard->used.store(false, std::memory_order_release);
+		}
+};
+
+MetricsShard *metricsAcquire() {
+	static thread_local MetricsRelease release;
+
+	for (unsigned i = 0; i < METRICS_SHARDS - 1; i++) {
+		bool expected = false;
+
+		if (shards[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+			release.shard = &shards[i];
+			return &shards[i];
+		}
+	}
+
+	// out of shards, this one is written with atomic adds
+	(void)sharedShard;
+	return &shards[METRICS_SHARDS - 1];
+}
+
+static uint64_t sum(unsigned metric) {
+	uint64_t total = retired.values[metric].load(std::memory_order_relaxed);
+
+	for (unsigned i = 0; i < METRICS_SHARDS; i++)
+		total += shards[i].values[metric].load(std::memory_order_relaxed);
+
+	return total;
+}
+
+static uint64_t highest(unsigned metric) {
+	uint64_t value = retired.values[metric].load(std::memory_order_relaxed);
+
+	for (unsigned i = 0; i < METRICS_SHARDS; i++) {
+		uint64_t shard = shards[i].values[metric].load(std::memory_order_relaxed);
+		if (shard > value)
+			value = shard;
+	}
+
+	return value;
+}
+
+uint64_t metricsValue(metric_t metric) {
+	uint64_t value;
+
+	pthread_mutex_lock(&foldLock);
+	value = highWater(metric) ? highest(metric) : sum(metric);
+	pthread_mutex_unlock(&foldLock);
+
+	return value;
+}
+
+static const char *alertName(unsigned alert) {
+	switch (alert) {
+		case CEC_ALERT_SERVICE_DEVICE:		return "service_device";
+		case CEC_ALERT_CONNECTION_LOST:		return "connection_lost";
+		case CEC_ALERT_PERMISSION_ERROR:	return "permission_error";
+		case CEC_ALERT_PORT_BUSY:		return "port_busy";
+		case CEC_ALERT_PHYSICAL_ADDRESS_ERROR:	return "physical_address_error";
+		case CEC_ALERT_TV_POLL_FAILED:		return "tv_poll_failed";
+		default:				return NULL;
+	}
+}
+
+static void header(stringstream &out, const char *name, const char *type, const char *help) {
+	out << "# HELP " << name << " " << help << "\n";
+	out << "# TYPE " << name << " " << type << "\n";
+}
+
+static void single(stringstream &out, const char *name, const char *type, const char *help, uint64_t value) {
+	header(out, name, type, help);
+	out << name << " " << value << "\n";
+}
+
+string metricsScrape() {
+	static const char *stages[LATENCY_STAGES] = { "bus", "mapped", "queued", "written" };
+	static const double quantiles[] = { 0.5, 0.99, 0.999 };
+	stringstream out;
+
+	pthread_mutex_lock(&foldLock);
+
+	header(out, "ceclircd_keys_total", "counter", "CEC keys received, by keycode.");
+	for (unsigned i = 0; i < 256; i++) {
+		uint64_t value = sum(METRIC_KEYS + i);
+		if (!value)
+			continue;
+		const char *name = cecKey((cec_user_control_code)i).name;
+		out << "ceclircd_keys_total{code=\"" << i << "\",key=\"" << (name ? name : "UNKNOWN") << "\"} " << value << "\n";
+	}
+
+	header(out, "ceclircd_opcodes_total", "counter", "CEC commands received, by opcode.");
+	for (unsigned i = 0; i < 256; i++) {
+		uint64_t value = sum(METRIC_OPCODES + i);
+		if (value)
+			out << "ceclircd_opcodes_total{opcode=\"" << i << "\"} " << value << "\n";
+	}
+
+	header(out, "ceclircd_restarts_total", "counter", "CEC session recoveries started, by cause.");
+	out << "ceclircd_restarts_total{cause=\"sighup\"} " << sum(METRIC_RESTART_SIGHUP) << "\n";
+	out << "ceclircd_restarts_total{cause=\"sigpipe\"} " << sum(METRIC_RESTART_SIGPIPE) << "\n";
+	for (unsigned i = 0; i < 16; i++) {
+		const char *name = alertName(i);
+		if (name)
+			out << "ceclircd_restarts_total{cause=\"" << name << "\"} " << sum(METRIC_ALERTS + i) << "\n";
+	}
+
+	single(out, "ceclircd_clients_connected_total", "counter", "LIRC clients accepted.", sum(METRIC_CLIENTS_CONNECTED));
+	single(out, "ceclircd_clients_dropped_total", "counter", "LIRC clients disconnected by ceclircd.", sum(METRIC_CLIENTS_DROPPED));
+	single(out, "ceclircd_bytes_written_total", "counter", "Bytes written to LIRC clients.", sum(METRIC_BYTES_WRITTEN));
+	single(out, "ceclircd_short_writes_total", "counter", "Writes to LIRC clients that did not take everything.", sum(METRIC_SHORT_WRITES));
+	single(out, "ceclircd_events_dropped_total", "counter", "Key events lost to a full event queue.", sum(METRIC_EVENTS_DROPPED));
+	single(out, "ceclircd_client_queue_high", "gauge", "Most frames ever queued for one LIRC client.", highest(METRIC_CLIENT_QUEUE_HIGH));
+	single(out, "ceclircd_event_queue_high", "gauge", "Most events ever waiting in the event queue.", highest(METRIC_EVENT_QUEUE_HIGH));
+
+	header(out, "ceclircd_hook_runs_total", "counter", "Hooks that finished, by result.");
+	out << "ceclircd_hook_runs_total{result=\"ok\"} " << sum(METRIC_HOOK_RUNS) - sum(METRIC_HOOK_FAILURES) << "\n";
+	out << "ceclircd_hook_runs_total{result=\"failed\"} " << sum(METRIC_HOOK_FAILURES) << "\n";
+	single(out, "ceclircd_hook_duration_milliseconds_total", "counter", "Time spent in hooks.", sum(METRIC_HOOK_MS));
+
+	header(out, "ceclircd_recoveries_total", "counter", "CEC sessions recovered, by the action that did it.");
+	out << "ceclircd_recoveries_total{action=\"ping\"} " << sum(METRIC_RECOVERIES + 1) << "\n";
+	out << "ceclircd_recoveries_total{action=\"reopen\"} " << sum(METRIC_RECOVERIES + 2) << "\n";
+	out << "ceclircd_recoveries_total{action=\"reinit\"} " << sum(METRIC_RECOVERIES + 3) << "\n";
+	single(out, "ceclircd_recovery_failures_total", "counter", "Recovery attempts that failed and were retried.", sum(METRIC_RECOVER_FAILURES));
+	single(out, "ceclircd_recovery_milliseconds_total", "counter", "Time from a failure to the CEC session working again.", sum(METRIC_RECOVER_MS));
+	single(out, "ceclircd_recovery_milliseconds_high", "gauge", "Longest time to recover.", highest(METRIC_RECOVER_MS_HIGH));
+	single(out, "ceclircd_long_presses_total", "counter", "Keys held past the long press threshold.", sum(METRIC_LONG_PRESSES));
+	single(out, "ceclircd_sequences_total", "counter", "Key sequences and chords recognised.", sum(METRIC_SEQUENCES));
+
+	header(out, "ceclircd_duplicates_total", "counter", "Keys dropped as a copy of one from the same device, by where the copy came from.");
+	out << "ceclircd_duplicates_total{source=\"keypress\"} " << sum(METRIC_DUPLICATES) << "\n";
+	out << "ceclircd_duplicates_total{source=\"command\"} " << sum(METRIC_DUPLICATES_COMMAND) << "\n";
+	single(out, "ceclircd_log_records_dropped_total", "counter", "Debug log lines lost to a full log ring.", sum(METRIC_LOG_DROPPED));
+	single(out, "ceclircd_evdev_events_dropped_total", "counter", "Keys the evdev sink had no room for.", sum(METRIC_SINK_DROPPED));
+
+	pthread_mutex_unlock(&foldLock);
+
+	header(out, "ceclircd_key_latency_microseconds", "summary", "Time from the libcec callback to each stage.");
+	for (unsigned i = 0; i < LATENCY_STAGES; i++) {
+		for (unsigned q = 0; q < sizeof quantiles / sizeof quantiles[0]; q++)
+			out << "ceclircd_key_latency_microseconds{stage=\"" << stages[i] << "\",quantile=\"" << quantiles[q] << "\"} " << latency[i].percentile(quantiles[q]) << "\n";
+		out << "ceclircd_key_latency_microseconds_count{stage=\"" << stages[i] << "\"} " << latency[i].count() << "\n";
+	}
+
+	return out.str();
+}
+
+int metricsListen(const string &path) {
+	struct sockaddr_un sa = {0};
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if(fd < 0) {
+		fprintf(stderr, "Unable to create an AF_UNIX socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, path.c_str(), sizeof sa.sun_path - 1);
+
+	unlink(path.c_str());
+
+	if(bind(fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+		fprintf(stderr, "Unable to bind AF_UNIX socket to %s: %s\n", path.c_str(), strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	chmod(path.c_str(), 0666);
+
+	if(listen(fd, SOMAXCONN) < 0) {
+		fprintf(stderr, "Unable to listen on AF_UNIX socket: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+void metricsServe(int fd) {
+	int client;
+
+	while((client = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		string text = metricsScrape();
+
+		// a scrape is a few kB, far below the socket buffer, so one send does it
+		ssize_t sent = send(client, text.data(), text.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(sent < (ssize_t)text.size())
+			LOG4CPLUS_ERROR(logger, "Short metrics write: " << (sent < 0 ? strerror(errno) : "client too slow"));
+
+		close(client);
+	}
+
+	if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		LOG4CPLUS_ERROR(logger, "Error accepting metrics client: " << strerror(errno));
+}
@@ -0,0 +1,113 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+#define METRICS_SHARDS	16	// threads with a shard of their own, the rest share one
+
+typedef enum {
+	METRIC_KEYS = 0,			// + cec_user_control_code
+	METRIC_OPCODES = METRIC_KEYS + 256,	// + cec_opcode
+	METRIC_ALERTS = METRIC_OPCODES + 256,	// + libcec_alert, those recovered from only
+	METRIC_RESTART_SIGHUP = METRIC_ALERTS + 16,
+	METRIC_RESTART_SIGPIPE,
+	METRIC_CLIENTS_CONNECTED,
+	METRIC_CLIENTS_DROPPED,
+	METRIC_BYTES_WRITTEN,
+	METRIC_SHORT_WRITES,
+	METRIC_EVENTS_DROPPED,
+	METRIC_CLIENT_QUEUE_HIGH,		// high-water marks, aggregated with max
+	METRIC_EVENT_QUEUE_HIGH,
+	METRIC_HOOK_RUNS,
+	METRIC_HOOK_FAILURES,
+	METRIC_HOOK_MS,
+	METRIC_RECOVERIES,			// + recover_action_t, see main.h
+	METRIC_RECOVER_FAILURES = METRIC_RECOVERIES + 4,
+	METRIC_RECOVER_MS,
+	METRIC_RECOVER_MS_HIGH,
+	METRIC_LONG_PRESSES,
+	METRIC_SEQUENCES,
+	METRIC_DUPLICATES,			// from a key press, or from a command below
+	METRIC_DUPLICATES_COMMAND,
+	METRIC_LOG_DROPPED,
+	METRIC_SINK_DROPPED,
+	METRIC_COUNT
+} metric_t;
+
+/*
+ * One thread's counters. Only the owner writes them, so an update is a
+ * plain load and store on a cache line no other thread writes.
+ */
+struct alignas(64) MetricsShard {
+	std::atomic<uint64_t> values[METRIC_COUNT];
+	std::atomic<bool> used;
+	bool shared;
+};
+
+MetricsShard *metricsAcquire();
+
+inline MetricsShard *metricsShard() {
+	static thread_local MetricsShard *shard = NULL;
+
+	if (!shard)
+		shard = metricsAcquire();
+	return shard;
+}
+
+inline void metricsAdd(metric_t metric, uint64_t n = 1) {
+	MetricsShard *shard = metricsShard();
+
+	if (shard->shared)
+		shard->values[metric].fetch_add(n, std::memory_order_relaxed);
+	else
+		shard->values[metric].store(shard->values[metric].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void metricsMax(metric_t metric, uint64_t value) {
+	MetricsShard *shard = metricsShard();
+	uint64_t old = shard->values[metric].load(std::memory_order_relaxed);
+
+	while (value > old && !shard->values[metric].compare_exchange_weak(old, value, std::memory_order_relaxed))
+		;
+}
+
+/**
+ * One metric summed over all shards, or the highest for high-water marks
+ */
+uint64_t metricsValue(metric_t metric);
+
+/**
+ * Sums all shards into Prometheus text format
+ */
+std::string metricsScrape();
+
+/**
+ * Creates the non-blocking control socket, -1 on error
+ */
+int metricsListen(const std::string &path);
+
+/**
+ * Accepts pending connections and writes a scrape to each
+ */
+void metricsServe(int fd);
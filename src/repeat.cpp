@@ -0,0 +1,218 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "repeat.h"
+#include "latency.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <stdexcept>
+#include <string>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::string;
+
+static Logger logger = Logger::getInstance("repeat");
+
+Repeater::Repeater() : timerfd(-1), held(false), deferred(false), longSent(false), keycode(CEC_USER_CONTROL_CODE_UNKNOWN),
+	count(0), pressed(0), firstRepeat(0), nextRepeat(0), holdDeadline(0),
+	delay(REPEAT_DELAY), rate(REPEAT_RATE), maxRate(REPEAT_RATE), ramp(0), longPress(REPEAT_LONG_PRESS) {
+	pthread_mutex_init(&lock, NULL);
+}
+
+Repeater::~Repeater() {
+	if (timerfd >= 0)
+		close(timerfd);
+	pthread_mutex_destroy(&lock);
+}
+
+void Repeater::setup() {
+	if (timerfd >= 0)
+		return;
+
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerfd < 0) {
+		throw std::runtime_error("Unable to create repeat timer: " + string(strerror(errno)));
+	}
+}
+
+/*
+ * us from one repeat to the next, following the acceleration ramp
+ */
+uint64_t Repeater::interval(uint64_t now) const {
+	uint64_t perSecond = rate;
+
+	if (ramp && maxRate > rate) {
+		uint64_t ms = (now - firstRepeat) / 1000;
+		if (ms > ramp)
+			ms = ramp;
+		perSecond = rate + (maxRate - rate) * ms / ramp;
+	}
+
+	return 1000000 / (perSecond ? perSecond : 1);
+}
+
+/*
+ * Sets the timer to the next repeat, the long press threshold or the hold
+ * deadline, whichever is first
+ */
+void Repeater::arm() {
+	struct itimerspec its = {{0, 0}, {0, 0}};
+
+	if (held) {
+		uint64_t when = holdDeadline;
+		uint64_t next = deferred ? pressed + longPress * 1000ull : nextRepeat;
+
+		// a classified long press only waits for its release
+		if (!longSent && next < when)
+			when = next;
+		its.it_value.tv_sec = when / 1000000;
+		its.it_value.tv_nsec = (when % 1000000) * 1000;
+	}
+
+	timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+ * The held key went up after duration us. Lock held.
+ */
+void Repeater::up(uint64_t duration) {
+	// not classified yet, the time it was down decides
+	if (deferred && !longSent) {
+		longSent = duration >= longPress * 1000ull;
+		emit(longSent ? KEY_EVENT_LONG : KEY_EVENT_PRESS, keycode, 0);
+	}
+
+	emit(KEY_EVENT_RELEASE, keycode, longSent);
+	held = false;
+	arm();
+}
+
+void Repeater::press(cec_user_control_code keycode, bool hasLongPress) {
+	uint64_t now = latencyNow();
+
+	pthread_mutex_lock(&lock);
+
+	// libcec passes the TV's repeated presses on when it doesn't repeat itself
+	if (held && this->keycode == keycode) {
+		holdDeadline = now + REPEAT_HOLD_TIMEOUT * 1000ull;
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	if (held)
+		up(now - pressed);
+
+	held = true;
+	deferred = hasLongPress && longPress;
+	longSent = false;
+	this->keycode = keycode;
+	count = 0;
+	pressed = now;
+	firstRepeat = 0;
+	nextRepeat = now + delay * 1000ull;
+	holdDeadline = now + REPEAT_HOLD_TIMEOUT * 1000ull;
+
+	if (!deferred)
+		emit(KEY_EVENT_PRESS, keycode, 0);
+
+	arm();
+	pthread_mutex_unlock(&lock);
+}
+
+void Repeater::hold() {
+	pthread_mutex_lock(&lock);
+	// onTimer() moves the timer on if it fires for the old deadline
+	if (held)
+		holdDeadline = latencyNow() + REPEAT_HOLD_TIMEOUT * 1000ull;
+	pthread_mutex_unlock(&lock);
+}
+
+void Repeater::hold(cec_user_control_code keycode) {
+	uint64_t now = latencyNow();
+
+	pthread_mutex_lock(&lock);
+	if (held && this->keycode == keycode)
+		holdDeadline = now + REPEAT_HOLD_TIMEOUT * 1000ull;
+	else if (held)
+		up(now - pressed);
+	pthread_mutex_unlock(&lock);
+}
+
+void Repeater::release(cec_user_control_code keycode, unsigned duration) {
+	pthread_mutex_lock(&lock);
+	if (held && this->keycode == keycode)
+		up(duration * 1000ull);
+	pthread_mutex_unlock(&lock);
+}
+
+void Repeater::release() {
+	pthread_mutex_lock(&lock);
+	if (held)
+		up(latencyNow() - pressed);
+	pthread_mutex_unlock(&lock);
+}
+
+void Repeater::onTimer() {
+	uint64_t expirations;
+
+	if (read(timerfd, &expirations, sizeof expirations) < 0)
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	uint64_t now = latencyNow();
+
+	if (!held) {
+		// released since the timer was armed
+	} else if (now >= holdDeadline) {
+		LOG4CPLUS_DEBUG(logger, "Repeater::onTimer() no sign of key " << keycode << " for " << REPEAT_HOLD_TIMEOUT << "ms, released");
+		up(now - pressed);
+	} else if (deferred) {
+		if (!longSent && now >= pressed + longPress * 1000ull) {
+			emit(KEY_EVENT_LONG, keycode, 0);
+			longSent = true;
+		}
+	} else if (now >= nextRepeat) {
+		if (!firstRepeat)
+			firstRepeat = now;
+
+		// two hex digits in the LIRC line, a long hold stays at ff
+		if (count < 0xff)
+			count++;
+		emit(KEY_EVENT_PRESS, keycode, count);
+
+		nextRepeat += interval(now);
+		// a late timer doesn't make up for lost repeats in a burst
+		if (nextRepeat < now)
+			nextRepeat = now + interval(now);
+	}
+
+	arm();
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,136 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include <libcec/cectypes.h>
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <functional>
+
+#define REPEAT_DELAY		500	// ms from the press to the first repeat
+#define REPEAT_RATE		10	// repeats per second
+#define REPEAT_HOLD_TIMEOUT	550	// ms without a sign of the key before it counts as released
+#define REPEAT_LONG_PRESS	1000	// ms a key with a long press mapping has to be held for it
+
+typedef enum {
+	KEY_EVENT_PRESS,	// a short press, or with a count a repeat of it
+	KEY_EVENT_LONG,		// held past the long press threshold
+	KEY_EVENT_RELEASE,	// went up, after its press or long press
+} key_event_t;
+
+/**
+ * Tracks the key that is down and turns it into events.
+ *
+ * A plain key is sent as a press right away, then repeated with LIRC
+ * repeat counts 1, 2, 3... from a timerfd. The rate starts at rate and
+ * rises linearly to maxRate over ramp ms of repeating, so long lists scroll
+ * faster the longer a key is held.
+ *
+ * A key with a long press mapping can only be told apart once it is
+ * released or held for longPress ms. It is sent as a press on a release
+ * before that, and as a long press when the timer reaches the threshold.
+ * It is never repeated.
+ *
+ * A key is up when libcec reports its release, a User Control Release
+ * arrives, another key goes down or the TV stops saying the key is still
+ * down. Every key ends with a release event.
+ *
+ * press(), hold() and release() come from libcec threads, onTimer() from
+ * the main loop, so the state is behind a mutex.
+ */
+class Repeater {
+
+	private:
+
+		pthread_mutex_t lock;
+		int timerfd;
+
+		bool held;
+		bool deferred;		// has a long press mapping
+		bool longSent;
+		CEC::cec_user_control_code keycode;
+		unsigned count;
+		uint64_t pressed;	// us, latencyNow()
+		uint64_t firstRepeat;
+		uint64_t nextRepeat;
+		uint64_t holdDeadline;
+
+		uint64_t interval(uint64_t now) const;
+		void arm();
+		void up(uint64_t duration);
+
+	public:
+
+		unsigned delay;
+		unsigned rate;
+		unsigned maxRate;
+		unsigned ramp;
+		unsigned longPress;
+
+		// sends one event, called with the mutex held. count is the
+		// repeat count of a press, and 1 for the release of a long press.
+		std::function<void(key_event_t event, CEC::cec_user_control_code keycode, unsigned count)> emit;
+
+		Repeater();
+		virtual ~Repeater();
+
+		/**
+		 * Creates the timer, call before the first press
+		 */
+		void setup();
+
+		/**
+		 * A key went down. Releases the key held before, if any, and
+		 * only keeps the key going if it is the one held.
+		 */
+		void press(CEC::cec_user_control_code keycode, bool hasLongPress);
+
+		/**
+		 * The TV says a key is still down, e.g. a vendor button frame
+		 */
+		void hold();
+
+		/**
+		 * Another User Control Pressed, keeps the key going if it is
+		 * the same one and releases it otherwise
+		 */
+		void hold(CEC::cec_user_control_code keycode);
+
+		/**
+		 * libcec saw a key go up after duration ms, releases it if it
+		 * is the one held
+		 */
+		void release(CEC::cec_user_control_code keycode, unsigned duration);
+
+		/**
+		 * Any key went up
+		 */
+		void release();
+
+		/**
+		 * Sends what is due, call when fd() is readable
+		 */
+		void onTimer();
+
+		int fd() const { return timerfd; };
+};
@@ -0,0 +1,410 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "sequence.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+using std::string;
+using std::vector;
+
+static Logger logger = Logger::getInstance("sequence");
+
+/*
+ * A user control code by name, e.g. NUMBER1, or number
+ */
+static bool parseKeycode(const string &token, cec_user_control_code &keycode) {
+	for (unsigned code = 0; code <= CEC_USER_CONTROL_CODE_MAX; code++) {
+		if (cecKeys[code].name && token == cecKeys[code].name) {
+			keycode = (cec_user_control_code)code;
+			return true;
+		}
+	}
+
+	char *end;
+	unsigned long code = strtoul(token.c_str(), &end, 0);
+	if (*end || end == token.c_str() || code > CEC_USER_CONTROL_CODE_MAX)
+		return false;
+
+	keycode = (cec_user_control_code)code;
+	return true;
+}
+
+Sequencer::Sequencer() : timerfd(-1), timeout(SEQUENCE_TIMEOUT), state(0), swallow(CEC_USER_CONTROL_CODE_UNKNOWN) {
+	pthread_mutex_init(&lock, NULL);
+}
+
+Sequencer::~Sequencer() {
+	if (timerfd >= 0)
+		close(timerfd);
+	pthread_mutex_destroy(&lock);
+}
+
+void Sequencer::setup() {
+	if (timerfd >= 0)
+		return;
+
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerfd < 0) {
+		throw std::runtime_error("Unable to create sequence timer: " + string(strerror(errno)));
+	}
+}
+
+/*
+ * Adds the path of one sequence to the trie, a new state per key that has
+ * no transition yet
+ */
+bool Sequencer::add(const vector<cec_user_control_code> &keys, int sequence) {
+	int s = 0;
+
+	if (table.empty()) {
+		table.assign(SEQUENCE_KEYS, -1);
+		accepts.push_back(-1);
+		depths.push_back(0);
+		holds.push_back(0);
+	}
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		int16_t &next = table[s * SEQUENCE_KEYS + keys[i]];
+
+		if (next < 0) {
+			if (accepts.size() >= INT16_MAX)
+				return false;
+			next = accepts.size();
+			table.resize(table.size() + SEQUENCE_KEYS, -1);
+			accepts.push_back(-1);
+			depths.push_back(i + 1);
+			holds.push_back(0);
+		}
+
+		s = table[s * SEQUENCE_KEYS + keys[i]];
+		if (sequences[sequence].suppress)
+			holds[s] = 1;
+	}
+
+	// a chord of one key twice is the same path both ways
+	if (accepts[s] >= 0 && accepts[s] != sequence)
+		return false;
+
+	accepts[s] = sequence;
+	return true;
+}
+
+/*
+ * Turns the trie into the DFA. Breadth first, every state's failure state,
+ * the longest proper tail of its keys that is also a state, is known before
+ * its children's. A key without a trie transition goes where it goes from
+ * the failure state, and a state ends with the sequences its failure state
+ * ends with.
+ */
+void Sequencer::build() {
+	vector<int16_t> failures(accepts.size(), 0);
+	std::deque<int> queue;
+
+	// states no key leads on from complete their sequence right away
+	leaves.assign(accepts.size(), 1);
+	for (size_t i = 0; i < table.size(); i++) {
+		if (table[i] >= 0)
+			leaves[i / SEQUENCE_KEYS] = 0;
+	}
+
+	outputs = accepts;
+
+	for (unsigned key = 0; key < SEQUENCE_KEYS; key++) {
+		int16_t &next = table[key];
+
+		if (next < 0)
+			next = 0;
+		else
+			queue.push_back(next);
+	}
+
+	while (!queue.empty()) {
+		int s = queue.front();
+		queue.pop_front();
+
+		if (outputs[s] < 0)
+			outputs[s] = outputs[failures[s]];
+
+		for (unsigned key = 0; key < SEQUENCE_KEYS; key++) {
+			int16_t &next = table[s * SEQUENCE_KEYS + key];
+			int16_t fallback = table[failures[s] * SEQUENCE_KEYS + key];
+
+			if (next < 0) {
+				next = fallback;
+			} else {
+				failures[next] = fallback;
+				queue.push_back(next);
+			}
+		}
+	}
+}
+
+bool Sequencer::load(const string &path) {
+	std::ifstream in(path.c_str());
+	string line;
+	unsigned number = 0;
+
+	if (!in) {
+		fprintf(stderr, "Unable to open %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	while (std::getline(in, line)) {
+		number++;
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream words(line);
+		string op, name, token;
+
+		if (!(words >> op))
+			continue;
+
+		if (op == "timeout") {
+			if (!(words >> timeout) || timeout == 0) {
+				fprintf(stderr, "%s:%u: Expected a timeout in ms\n", path.c_str(), number);
+				return false;
+			}
+			continue;
+		}
+
+		if ((op != "sequence" && op != "chord") || !(words >> name)) {
+			fprintf(stderr, "%s:%u: Expected sequence or chord and a LIRC name\n", path.c_str(), number);
+			return false;
+		}
+
+		Sequence sequence;
+		vector<cec_user_control_code> keys;
+
+		sequence.name = name;
+		sequence.suppress = false;
+		sequence.length = 0;
+		memset(&sequence.lircKey, 0, sizeof sequence.lircKey);
+
+		while (words >> token) {
+			cec_user_control_code keycode;
+
+			if (token == "suppress") {
+				sequence.suppress = true;
+			} else if (parseKeycode(token, keycode)) {
+				keys.push_back(keycode);
+			} else {
+				fprintf(stderr, "%s:%u: Unknown CEC key %s\n", path.c_str(), number, token.c_str());
+				return false;
+			}
+		}
+
+		if (op == "chord" ? keys.size() != 2 : keys.size() < 2) {
+			fprintf(stderr, "%s:%u: A %s needs %s keys\n", path.c_str(), number, op.c_str(), op == "chord" ? "two" : "at least two");
+			return false;
+		}
+
+		if (!Keymap::addLine(sequence.lircKey, SEQUENCE_CODE + sequences.size(), name.c_str())) {
+			fprintf(stderr, "%s:%u: %s is too long\n", path.c_str(), number, name.c_str());
+			return false;
+		}
+
+		sequence.length = keys.size();
+		sequences.push_back(sequence);
+
+		bool added = add(keys, sequences.size() - 1);
+		if (added && op == "chord") {
+			std::swap(keys[0], keys[1]);
+			added = add(keys, sequences.size() - 1);
+		}
+
+		if (!added) {
+			fprintf(stderr, "%s:%u: %s has the same keys as an earlier sequence\n", path.c_str(), number, name.c_str());
+			return false;
+		}
+	}
+
+	if (!table.empty())
+		build();
+
+	// the path never grows on the key path
+	this->path.reserve(depths.size());
+
+	LOG4CPLUS_INFO(logger, "Loaded " << sequences.size() << " sequences from " << path << " into " << accepts.size() << " states");
+	return true;
+}
+
+void Sequencer::arm(unsigned ms) {
+	struct itimerspec its = {{0, 0}, {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000}};
+
+	timerfd_settime(timerfd, 0, &its, NULL);
+}
+
+/*
+ * Sends the keys held back so far, they turned out not to be a sequence
+ */
+void Sequencer::flush() {
+	for (size_t i = 0; i < path.size(); i++) {
+		if (path[i].held)
+			replay(path[i].keycode);
+		path[i].held = false;
+	}
+}
+
+/*
+ * Forgets the first count keys of the path, they can no longer be part
+ * of a sequence
+ */
+void Sequencer::drop(size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		if (path[i].held)
+			replay(path[i].keycode);
+	}
+	path.erase(path.begin(), path.begin() + count);
+}
+
+/*
+ * Completes the longest sequence the current state ends with, if any, and
+ * starts over
+ */
+void Sequencer::end() {
+	int sequence = outputs[state];
+	size_t first = path.size();
+
+	// the keys of a suppressed sequence never go out, those before it do
+	if (sequence >= 0 && sequences[sequence].suppress)
+		first -= sequences[sequence].length;
+
+	drop(first);
+	path.clear();
+
+	if (sequence >= 0) {
+		LOG4CPLUS_DEBUG(logger, "Sequencer::end() " << sequences[sequence].name);
+		metricsAdd(METRIC_SEQUENCES);
+		match(sequences[sequence].lircKey);
+	}
+
+	state = 0;
+	arm(0);
+}
+
+void Sequencer::step(cec_user_control_code keycode) {
+	int next = table[state * SEQUENCE_KEYS + keycode];
+
+	if (state != 0 && depths[next] != depths[state] + 1) {
+		int sequence = outputs[state];
+
+		if (sequence >= 0 && sequences[sequence].length >= depths[next]) {
+			// the keys so far complete a sequence the fallback doesn't
+			// carry on, the key may start the next one
+			end();
+			next = table[keycode];
+		} else {
+			// no sequence goes on with this key, keep the tail that still may
+			drop(path.size() - (depths[next] ? depths[next] - 1 : 0));
+		}
+	}
+
+	if (next == 0) {
+		if (state != 0) {
+			state = 0;
+			arm(0);
+		}
+		pass(keycode);
+		return;
+	}
+
+	Step key = { keycode, holds[next] != 0 };
+
+	state = next;
+	if (key.held) {
+		swallow = keycode;
+	} else {
+		// only a suppressed sequence that went another way held these
+		flush();
+		pass(keycode);
+	}
+	path.push_back(key);
+
+	if (leaves[state])
+		end();
+	else
+		arm(timeout);
+}
+
+void Sequencer::press(cec_user_control_code keycode) {
+	if (keycode < 0 || keycode > CEC_USER_CONTROL_CODE_MAX || table.empty()) {
+		pass(keycode);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	swallow = CEC_USER_CONTROL_CODE_UNKNOWN;
+	step(keycode);
+	pthread_mutex_unlock(&lock);
+}
+
+void Sequencer::interrupt() {
+	if (table.empty())
+		return;
+
+	pthread_mutex_lock(&lock);
+	if (state != 0)
+		end();
+	pthread_mutex_unlock(&lock);
+}
+
+bool Sequencer::holding(cec_user_control_code keycode) {
+	if (table.empty())
+		return false;
+
+	pthread_mutex_lock(&lock);
+	bool held = swallow == keycode;
+	pthread_mutex_unlock(&lock);
+
+	return held;
+}
+
+void Sequencer::onTimer() {
+	uint64_t expirations;
+
+	if (read(timerfd, &expirations, sizeof expirations) < 0)
+		return;
+
+	pthread_mutex_lock(&lock);
+	// a press may have ended the sequence after the timer fired
+	if (state != 0) {
+		LOG4CPLUS_DEBUG(logger, "Sequencer::onTimer() no key for " << timeout << "ms");
+		end();
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,148 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include "keymap.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#define SEQUENCE_TIMEOUT	1000	// ms allowed between the keys of a sequence
+#define SEQUENCE_CODE		0x200	// + index, the code in the LIRC line of a sequence
+#define SEQUENCE_KEYS		(CEC::CEC_USER_CONTROL_CODE_MAX + 1)
+
+/**
+ * Recognises key sequences, e.g. 1 2 3 for a service menu, and sends one
+ * LIRC name when they are complete. Sequences are read from a text file,
+ * one per line:
+ *
+ *   # comment
+ *   timeout <ms>
+ *   sequence <lirc name> <cec key> <cec key>... [suppress]
+ *   chord <lirc name> <cec key> <cec key> [suppress]
+ *
+ * A chord matches its two keys in either order. With suppress the keys of
+ * the sequence are held back while they may still become it, and only go
+ * out if they don't. Without it they go out as usual and the name follows.
+ *
+ * The sequences are compiled into a DFA over cec_user_control_code, a
+ * table with a row per state and a column per key: a trie of the sequences
+ * with Aho-Corasick failure transitions filled in, so a key that breaks the
+ * sequence in progress falls back to the longest tail of the keys so far
+ * that still starts one, e.g. 1 1 1 2 completes 1 1 2. A state that
+ * completes a sequence but can still continue into a longer one waits up
+ * to timeout ms for the next key, as does any state in the middle of a
+ * sequence.
+ *
+ * press() is called with the Repeater's mutex held, onTimer() from the main
+ * loop, so the state is behind a mutex of its own, always taken second.
+ */
+class Sequencer {
+
+	private:
+
+		struct Sequence {
+			std::string name;
+			bool suppress;
+			unsigned length;	// keys
+			LircKey lircKey;
+		};
+
+		// a key on the way to the current state
+		struct Step {
+			CEC::cec_user_control_code keycode;
+			bool held;
+		};
+
+		pthread_mutex_t lock;
+		int timerfd;
+
+		unsigned timeout;
+		std::vector<Sequence> sequences;
+		std::vector<int16_t> table;	// state * SEQUENCE_KEYS + keycode, the next state
+		std::vector<int16_t> accepts;	// state, the sequence it completes or -1
+		std::vector<int16_t> outputs;	// state, the longest sequence it ends with or -1
+		std::vector<uint16_t> depths;	// state, keys from the start state
+		std::vector<uint8_t> holds;	// state, keys leading here are held back
+		std::vector<uint8_t> leaves;	// state, no key leads on
+
+		int state;
+		std::vector<Step> path;		// depths[state] keys
+		CEC::cec_user_control_code swallow;
+
+		bool add(const std::vector<CEC::cec_user_control_code> &keys, int sequence);
+		void build();
+		void step(CEC::cec_user_control_code keycode);
+		void end();
+		void drop(size_t count);
+		void flush();
+		void arm(unsigned ms);
+
+	public:
+
+		// sends a key as pressed, repeats and release follow as usual
+		std::function<void(CEC::cec_user_control_code keycode)> pass;
+		// sends a key that was held back, pressed and released at once
+		std::function<void(CEC::cec_user_control_code keycode)> replay;
+		// sends a completed sequence
+		std::function<void(const LircKey &lircKey)> match;
+
+		Sequencer();
+		virtual ~Sequencer();
+
+		/**
+		 * Reads and compiles a sequence file, false on error
+		 */
+		bool load(const std::string &path);
+
+		/**
+		 * Creates the timer, call before the first press
+		 */
+		void setup();
+
+		/**
+		 * A key press, passed on, held back or completing a sequence
+		 */
+		void press(CEC::cec_user_control_code keycode);
+
+		/**
+		 * Something other than a press, e.g. a long press, ends the
+		 * sequence in progress
+		 */
+		void interrupt();
+
+		/**
+		 * True if the repeats and release of keycode belong to a press
+		 * that was held back, and must not go out
+		 */
+		bool holding(CEC::cec_user_control_code keycode);
+
+		/**
+		 * Ends a sequence that timed out, call when fd() is readable
+		 */
+		void onTimer();
+
+		int fd() const { return timerfd; };
+};
@@ -0,0 +1,505 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include "sink.h"
+#include "asynclog.h"
+#include "flight.h"
+#include "latency.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+
+using namespace CEC;
+using namespace log4cplus;
+
+static Logger logger = Logger::getInstance("sink");
+
+#define SINK_RETRY	1000	// ms between attempts to open a pipe without a reader
+
+/*
+ * The KEY_* names a LIRC name can stand for, sorted for a binary search
+ */
+static const struct {
+	const char *name;
+	uint16_t code;
+} keyNames[] = {
+	{ "KEY_0",                 KEY_0 },
+	{ "KEY_1",                 KEY_1 },
+	{ "KEY_2",                 KEY_2 },
+	{ "KEY_3",                 KEY_3 },
+	{ "KEY_4",                 KEY_4 },
+	{ "KEY_5",                 KEY_5 },
+	{ "KEY_6",                 KEY_6 },
+	{ "KEY_7",                 KEY_7 },
+	{ "KEY_8",                 KEY_8 },
+	{ "KEY_9",                 KEY_9 },
+	{ "KEY_A",                 KEY_A },
+	{ "KEY_ANGLE",             KEY_ANGLE },
+	{ "KEY_ARCHIVE",           KEY_ARCHIVE },
+	{ "KEY_ASPECT_RATIO",      KEY_ASPECT_RATIO },
+	{ "KEY_AUDIO",             KEY_AUDIO },
+	{ "KEY_B",                 KEY_B },
+	{ "KEY_BACK",              KEY_BACK },
+	{ "KEY_BACKSPACE",         KEY_BACKSPACE },
+	{ "KEY_BLUE",              KEY_BLUE },
+	{ "KEY_BOOKMARKS",         KEY_BOOKMARKS },
+	{ "KEY_BRIGHTNESSDOWN",    KEY_BRIGHTNESSDOWN },
+	{ "KEY_BRIGHTNESSUP",      KEY_BRIGHTNESSUP },
+	{ "KEY_C",                 KEY_C },
+	{ "KEY_CALENDAR",          KEY_CALENDAR },
+	{ "KEY_CAMERA",            KEY_CAMERA },
+	{ "KEY_CHANNEL",           KEY_CHANNEL },
+	{ "KEY_CHANNELDOWN",       KEY_CHANNELDOWN },
+	{ "KEY_CHANNELUP",         KEY_CHANNELUP },
+	{ "KEY_CLEAR",             KEY_CLEAR },
+	{ "KEY_CONFIG",            KEY_CONFIG },
+	{ "KEY_CONTEXT_MENU",      KEY_CONTEXT_MENU },
+	{ "KEY_D",                 KEY_D },
+	{ "KEY_DELETE",            KEY_DELETE },
+	{ "KEY_DOT",               KEY_DOT },
+	{ "KEY_DOWN",              KEY_DOWN },
+	{ "KEY_DVD",               KEY_DVD },
+	{ "KEY_E",                 KEY_E },
+	{ "KEY_EJECTCD",           KEY_EJECTCD },
+	{ "KEY_END",               KEY_END },
+	{ "KEY_ENTER",             KEY_ENTER },
+	{ "KEY_EPG",               KEY_EPG },
+	{ "KEY_ESC",               KEY_ESC },
+	{ "KEY_EXIT",              KEY_EXIT },
+	{ "KEY_F",                 KEY_F },
+	{ "KEY_F1",                KEY_F1 },
+	{ "KEY_F10",               KEY_F10 },
+	{ "KEY_F11",               KEY_F11 },
+	{ "KEY_F12",               KEY_F12 },
+	{ "KEY_F2",                KEY_F2 },
+	{ "KEY_F3",                KEY_F3 },
+	{ "KEY_F4",                KEY_F4 },
+	{ "KEY_F5",                KEY_F5 },
+	{ "KEY_F6",                KEY_F6 },
+	{ "KEY_F7",                KEY_F7 },
+	{ "KEY_F8",                KEY_F8 },
+	{ "KEY_F9",                KEY_F9 },
+	{ "KEY_FASTFORWARD",       KEY_FASTFORWARD },
+	{ "KEY_FAVORITES",         KEY_FAVORITES },
+	{ "KEY_FORWARD",           KEY_FORWARD },
+	{ "KEY_G",                 KEY_G },
+	{ "KEY_GOTO",              KEY_GOTO },
+	{ "KEY_GREEN",             KEY_GREEN },
+	{ "KEY_H",                 KEY_H },
+	{ "KEY_HELP",              KEY_HELP },
+	{ "KEY_HOME",              KEY_HOME },
+	{ "KEY_HOMEPAGE",          KEY_HOMEPAGE },
+	{ "KEY_I",                 KEY_I },
+	{ "KEY_INFO",              KEY_INFO },
+	{ "KEY_INSERT",            KEY_INSERT },
+	{ "KEY_J",                 KEY_J },
+	{ "KEY_K",                 KEY_K },
+	{ "KEY_L",                 KEY_L },
+	{ "KEY_LANGUAGE",          KEY_LANGUAGE },
+	{ "KEY_LAST",              KEY_LAST },
+	{ "KEY_LEFT",              KEY_LEFT },
+	{ "KEY_LEFTALT",           KEY_LEFTALT },
+	{ "KEY_LEFTCTRL",          KEY_LEFTCTRL },
+	{ "KEY_LEFTSHIFT",         KEY_LEFTSHIFT },
+	{ "KEY_LIST",              KEY_LIST },
+	{ "KEY_M",                 KEY_M },
+	{ "KEY_MEDIA",             KEY_MEDIA },
+	{ "KEY_MEDIA_REPEAT",      KEY_MEDIA_REPEAT },
+	{ "KEY_MEMO",              KEY_MEMO },
+	{ "KEY_MENU",              KEY_MENU },
+	{ "KEY_MODE",              KEY_MODE },
+	{ "KEY_MP3",               KEY_MP3 },
+	{ "KEY_MUTE",              KEY_MUTE },
+	{ "KEY_N",                 KEY_N },
+	{ "KEY_NEXT",              KEY_NEXT },
+	{ "KEY_NEXTSONG",          KEY_NEXTSONG },
+	{ "KEY_NUMERIC_0",         KEY_NUMERIC_0 },
+	{ "KEY_NUMERIC_1",         KEY_NUMERIC_1 },
+	{ "KEY_NUMERIC_2",         KEY_NUMERIC_2 },
+	{ "KEY_NUMERIC_3",         KEY_NUMERIC_3 },
+	{ "KEY_NUMERIC_4",         KEY_NUMERIC_4 },
+	{ "KEY_NUMERIC_5",         KEY_NUMERIC_5 },
+	{ "KEY_NUMERIC_6",         KEY_NUMERIC_6 },
+	{ "KEY_NUMERIC_7",         KEY_NUMERIC_7 },
+	{ "KEY_NUMERIC_8",         KEY_NUMERIC_8 },
+	{ "KEY_NUMERIC_9",         KEY_NUMERIC_9 },
+	{ "KEY_NUMERIC_POUND",     KEY_NUMERIC_POUND },
+	{ "KEY_NUMERIC_STAR",      KEY_NUMERIC_STAR },
+	{ "KEY_O",                 KEY_O },
+	{ "KEY_OK",                KEY_OK },
+	{ "KEY_OPTION",            KEY_OPTION },
+	{ "KEY_P",                 KEY_P },
+	{ "KEY_PAGEDOWN",          KEY_PAGEDOWN },
+	{ "KEY_PAGEUP",            KEY_PAGEUP },
+	{ "KEY_PAUSE",             KEY_PAUSE },
+	{ "KEY_PAUSECD",           KEY_PAUSECD },
+	{ "KEY_PC",                KEY_PC },
+	{ "KEY_PLAY",              KEY_PLAY },
+	{ "KEY_PLAYCD",            KEY_PLAYCD },
+	{ "KEY_PLAYPAUSE",         KEY_PLAYPAUSE },
+	{ "KEY_POWER",             KEY_POWER },
+	{ "KEY_POWER2",            KEY_POWER2 },
+	{ "KEY_PREVIOUS",          KEY_PREVIOUS },
+	{ "KEY_PREVIOUSSONG",      KEY_PREVIOUSSONG },
+	{ "KEY_PROGRAM",           KEY_PROGRAM },
+	{ "KEY_PVR",               KEY_PVR },
+	{ "KEY_Q",                 KEY_Q },
+	{ "KEY_R",                 KEY_R },
+	{ "KEY_RADIO",             KEY_RADIO },
+	{ "KEY_RECORD",            KEY_RECORD },
+	{ "KEY_RED",               KEY_RED },
+	{ "KEY_REDO",              KEY_REDO },
+	{ "KEY_REWIND",            KEY_REWIND },
+	{ "KEY_RIGHT",             KEY_RIGHT },
+	{ "KEY_S",                 KEY_S },
+	{ "KEY_SAT",               KEY_SAT },
+	{ "KEY_SCREEN",            KEY_SCREEN },
+	{ "KEY_SEARCH",            KEY_SEARCH },
+	{ "KEY_SELECT",            KEY_SELECT },
+	{ "KEY_SETUP",             KEY_SETUP },
+	{ "KEY_SHUFFLE",           KEY_SHUFFLE },
+	{ "KEY_SLEEP",             KEY_SLEEP },
+	{ "KEY_SOUND",             KEY_SOUND },
+	{ "KEY_SPACE",             KEY_SPACE },
+	{ "KEY_STOP",              KEY_STOP },
+	{ "KEY_STOPCD",            KEY_STOPCD },
+	{ "KEY_SUBTITLE",          KEY_SUBTITLE },
+	{ "KEY_T",                 KEY_T },
+	{ "KEY_TAB",               KEY_TAB },
+	{ "KEY_TEXT",              KEY_TEXT },
+	{ "KEY_TIME",              KEY_TIME },
+	{ "KEY_TITLE",             KEY_TITLE },
+	{ "KEY_TUNER",             KEY_TUNER },
+	{ "KEY_TV",                KEY_TV },
+	{ "KEY_U",                 KEY_U },
+	{ "KEY_UP",                KEY_UP },
+	{ "KEY_V",                 KEY_V },
+	{ "KEY_VCR",               KEY_VCR },
+	{ "KEY_VIDEO",             KEY_VIDEO },
+	{ "KEY_VOLUMEDOWN",        KEY_VOLUMEDOWN },
+	{ "KEY_VOLUMEUP",          KEY_VOLUMEUP },
+	{ "KEY_W",                 KEY_W },
+	{ "KEY_WAKEUP",            KEY_WAKEUP },
+	{ "KEY_X",                 KEY_X },
+	{ "KEY_Y",                 KEY_Y },
+	{ "KEY_YELLOW",            KEY_YELLOW },
+	{ "KEY_Z",                 KEY_Z },
+	{ "KEY_ZOOM",              KEY_ZOOM },
+};
+
+void LircSink::key(cec_user_control_code keycode, const LircKey &lircKey, unsigned repeat, bool release) {
+	static const char hexdigits[] = "0123456789abcdef";
+	char lines[LIRC_KEY_LINES][LIRC_LINE_MAX];
+	struct iovec iov[LIRC_KEY_LINES];
+
+	if (release && releaseSuffix.empty())
+		return;
+
+	const char *suffix = release ? releaseSuffix.c_str() : NULL;
+	size_t suffixLen = release ? releaseSuffix.size() : 0;
+
+	ALOG_DEBUG(logger, "LircSink::key() ", keycode, " repeat ", repeat, release ? " release" : "");
+
+	for (unsigned i = 0; i < lircKey.count; i++) {
+		const char *text = lircKey.lines[i].text;
+		size_t len = lircKey.lines[i].len;
+
+		if (suffixLen && len + suffixLen < LIRC_LINE_MAX) {
+			// the name ends where the remote name starts
+			const char *remote = (const char *)memrchr(text, ' ', len);
+			size_t name = remote - text;
+
+			memcpy(lines[i], text, name);
+			memcpy(lines[i] + name, suffix, suffixLen);
+			memcpy(lines[i] + name + suffixLen, remote, len - name);
+			len += suffixLen;
+		} else {
+			memcpy(lines[i], text, len);
+		}
+
+		lines[i][lircKey.lines[i].repeatPos]     = hexdigits[(repeat >> 4) & 0xf];
+		lines[i][lircKey.lines[i].repeatPos + 1] = hexdigits[repeat & 0xf];
+		iov[i].iov_base = lines[i];
+		iov[i].iov_len = len;
+	}
+
+	latencyRecord(LATENCY_MAPPED, latencyStart);
+
+	// all lines of a key go out together, as one event
+	bool posted = out.post(iov, lircKey.count, repeat != 0, latencyStart);
+	flightRecord(FLIGHT_POSTED, keycode, 0, 0, repeat, !posted);
+	if (!posted)
+		ALOG_DEBUG(logger, "LircSink::key() event dropped");
+}
+
+EvdevSink::EvdevSink() : fd(-1), wakefd(-1), running(false), started(false), path(SINK_UINPUT), uinput(true) {
+}
+
+EvdevSink::~EvdevSink() {
+	stop();
+}
+
+uint16_t EvdevSink::code(const char *name, size_t len) {
+	size_t low = 0, high = sizeof keyNames / sizeof keyNames[0];
+
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		int cmp = strncmp(keyNames[mid].name, name, len);
+
+		if (cmp == 0 && keyNames[mid].name[len] != '\0')
+			cmp = 1;
+		if (cmp == 0)
+			return keyNames[mid].code;
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return 0;
+}
+
+/*
+ * Creates the keyboard, with every key we have a name for
+ */
+bool EvdevSink::setupUinput() {
+	struct uinput_user_dev dev;
+
+	if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 || ioctl(fd, UI_SET_EVBIT, EV_SYN) < 0)
+		return false;
+
+	for (size_t i = 0; i < sizeof keyNames / sizeof keyNames[0]; i++) {
+		if (ioctl(fd, UI_SET_KEYBIT, keyNames[i].code) < 0)
+			return false;
+	}
+
+	// the legacy setup, UI_DEV_SETUP needs 4.5
+	memset(&dev, 0, sizeof dev);
+	snprintf(dev.name, UINPUT_MAX_NAME_SIZE, SINK_UINPUT_NAME);
+	dev.id.bustype = BUS_VIRTUAL;
+
+	if (::write(fd, &dev, sizeof dev) != sizeof dev)
+		return false;
+
+	return ioctl(fd, UI_DEV_CREATE) == 0;
+}
+
+bool EvdevSink::start() {
+	LOG4CPLUS_TRACE_STR(logger, "EvdevSink::start()");
+
+	if (started)
+		return true;
+
+	wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakefd < 0) {
+		LOG4CPLUS_ERROR(logger, "Unable to create sink eventfd: " << strerror(errno));
+		return false;
+	}
+
+	// a missing uinput is worth knowing at once, a pipe may get its reader later
+	if (uinput) {
+		fd = open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0 || !setupUinput()) {
+			LOG4CPLUS_ERROR(logger, "Unable to create a uinput device on " << path << ": " << strerror(errno));
+			stop();
+			return false;
+		}
+		LOG4CPLUS_INFO(logger, "Created uinput device " << SINK_UINPUT_NAME << " on " << path);
+	}
+
+	running = true;
+	if (pthread_create(&thread, NULL, run, this) != 0) {
+		LOG4CPLUS_ERROR(logger, "Unable to start the evdev sink thread");
+		running = false;
+		stop();
+		return false;
+	}
+	started = true;
+
+	return true;
+}
+
+void EvdevSink::stop() {
+	uint64_t one = 1;
+
+	if (started) {
+		running = false;
+		if (::write(wakefd, &one, sizeof one) < 0 && errno != EAGAIN)
+			LOG4CPLUS_ERROR(logger, "Error writing sink eventfd: " << strerror(errno));
+		pthread_join(thread, NULL);
+		started = false;
+	}
+
+	if (fd >= 0) {
+		if (uinput)
+			ioctl(fd, UI_DEV_DESTROY);
+		close(fd);
+		fd = -1;
+	}
+	if (wakefd >= 0) {
+		close(wakefd);
+		wakefd = -1;
+	}
+}
+
+void EvdevSink::key(cec_user_control_code keycode, const LircKey &lircKey, unsigned repeat, bool release) {
+	sink_event_t event;
+	uint64_t one = 1;
+
+	// not started, or failed to
+	if (!running.load(std::memory_order_relaxed))
+		return;
+
+	event.keycode = keycode;
+	event.count = 0;
+	event.value = release ? 0 : repeat ? 2 : 1;
+
+	// "<keycode> <repeat> <name> <remote>\n"
+	for (unsigned i = 0; i < lircKey.count; i++) {
+		const char *text = lircKey.lines[i].text;
+		const char *end = text + lircKey.lines[i].len;
+		const char *name = text + lircKey.lines[i].repeatPos + 3;
+		const char *blank = (const char *)memchr(name, ' ', end - name);
+
+		uint16_t code = blank ? EvdevSink::code(name, blank - name) : 0;
+		if (code)
+			event.codes[event.count++] = code;
+	}
+
+	if (!event.count)
+		return;
+
+	if (!events.push(event)) {
+		metricsAdd(METRIC_SINK_DROPPED);
+		return;
+	}
+
+	if (::write(wakefd, &one, sizeof one) < 0 && errno != EAGAIN)
+		ALOG_DEBUG(logger, "EvdevSink::key() unable to wake the sink thread");
+}
+
+/*
+ * Writes the records of one key, false if the fd can't take them now
+ */
+bool EvdevSink::write(const sink_event_t &event) {
+	struct input_event records[LIRC_KEY_LINES + 1];
+	struct timeval now;
+	unsigned count = 0;
+
+	gettimeofday(&now, NULL);
+	memset(records, 0, sizeof records);
+
+	for (unsigned i = 0; i < event.count; i++) {
+		records[count].type = EV_KEY;
+		records[count].code = event.codes[i];
+		records[count].value = event.value;
+		count++;
+	}
+	records[count].type = EV_SYN;
+	records[count].code = SYN_REPORT;
+	count++;
+
+	for (unsigned i = 0; i < count; i++) {
+#ifdef input_event_sec
+		records[i].input_event_sec = now.tv_sec;
+		records[i].input_event_usec = now.tv_usec;
+#else
+		records[i].time = now;
+#endif
+	}
+
+	// less than PIPE_BUF, so a pipe takes all of it or nothing
+	ssize_t n = ::write(fd, records, count * sizeof records[0]);
+	if (n < 0 && errno == EAGAIN)
+		return false;
+
+	if (n < 0) {
+		LOG4CPLUS_WARN(logger, "Error writing to " << path << ": " << strerror(errno));
+		if (!uinput) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	return true;
+}
+
+/*
+ * Runs on the sink thread, the only one that writes fd
+ */
+void EvdevSink::deliver() {
+	sink_event_t event;
+	bool pending = false;
+	uint64_t wakes;
+
+	while (running) {
+		int timeout = -1;
+
+		if (fd < 0) {
+			// nonblocking, a pipe without a reader fails with ENXIO
+			fd = open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC | (uinput ? 0 : O_CREAT | O_APPEND), 0644);
+			if (fd < 0)
+				timeout = SINK_RETRY;
+			else
+				LOG4CPLUS_INFO(logger, "Writing evdev records to " << path);
+		}
+
+		// nobody to read the keys, don't leave them for later
+		while (fd < 0 && events.pop(event))
+			pending = false;
+
+		while (fd >= 0 && (pending || events.pop(event))) {
+			pending = !write(event);
+			if (pending)
+				break;
+		}
+
+		struct pollfd fds[2] = {
+			{ wakefd, POLLIN, 0 },
+			{ fd, POLLOUT, 0 },
+		};
+
+		// only wait for the fd while a key is stuck on it
+		if (poll(fds, pending ? 2 : 1, timeout) < 0 && errno != EINTR) {
+			LOG4CPLUS_ERROR(logger, "Error polling the evdev sink: " << strerror(errno));
+			break;
+		}
+
+		if (fds[0].revents & POLLIN)
+			while (read(wakefd, &wakes, sizeof wakes) == sizeof wakes)
+				;
+	}
+}
+
+void *EvdevSink::run(void *self) {
+	((EvdevSink *)self)->deliver();
+	return NULL;
+}
@@ -0,0 +1,142 @@
+/*
+    ceclircd -- LIRC daemon that reads CEC events from libcec
+                https://github.com/Pulse-Eight/libcec
+				
+    Copyright (c) 2014 Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#pragma once
+
+#include "eventqueue.h"
+#include "keymap.h"
+#include "lirc.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#define SINK_QUEUE_LEN		256
+#define SINK_UINPUT		"/dev/uinput"
+#define SINK_UINPUT_NAME	"ceclircd"
+
+/**
+ * Where mapped keys go. Main hands every press, repeat and release to each
+ * sink in turn, from libcec threads and the main loop alike, so key() must
+ * not block: a sink queues the key for a thread of its own, and a stalled
+ * sink drops its keys without holding up the others.
+ */
+class Sink {
+
+	public:
+
+		virtual ~Sink() {};
+
+		virtual bool start() = 0;
+		virtual void stop() = 0;
+
+		/**
+		 * repeat counts up from 0 while the key is held, release is set
+		 * once it is let go
+		 */
+		virtual void key(CEC::cec_user_control_code keycode, const LircKey &lircKey, unsigned repeat, bool release) = 0;
+};
+
+/**
+ * The LIRC socket. lirc already queues events for its reactor thread,
+ * so this only renders the lines.
+ */
+class LircSink : public Sink {
+
+	private:
+
+		lirc &out;
+
+	public:
+
+		std::string releaseSuffix;	// releases are only sent with one, as lircd --release
+
+		LircSink(lirc &out) : out(out) {};
+
+		bool start() { return true; };
+		void stop() {};
+
+		void key(CEC::cec_user_control_code keycode, const LircKey &lircKey, unsigned repeat, bool release);
+};
+
+/*
+ * A key as the evdev thread writes it, already resolved to KEY_* codes
+ */
+typedef struct sink_event {
+	uint8_t keycode;
+	uint8_t count;
+	uint8_t value;		// 1 press, 2 repeat, 0 release, as in struct input_event
+	uint16_t codes[LIRC_KEY_LINES];
+} sink_event_t;
+
+/**
+ * Writes keys as evdev input_event records. On a uinput device these show
+ * up as a keyboard named ceclircd, for apps that read /dev/input/event*.
+ * Without uinput, e.g. in a container, the same records can go to a pipe
+ * or a file instead.
+ *
+ * The LIRC names of the key are looked up in the kernel's KEY_* names, so
+ * a translation table changes what gets typed as well. Names that aren't
+ * kernel key names are skipped.
+ */
+class EvdevSink : public Sink {
+
+	private:
+
+		int fd;
+		int wakefd;
+
+		pthread_t thread;
+		std::atomic<bool> running;
+		bool started;
+
+		mpsc_queue<sink_event_t, SINK_QUEUE_LEN> events;
+
+		// Not implemented, the queue is not copyable
+		EvdevSink(EvdevSink const&);
+		void operator=(EvdevSink const&);
+
+		bool setupUinput();
+		bool write(const sink_event_t &event);
+		void deliver();
+		static void *run(void *self);
+
+	public:
+
+		// uinput creates a device at path, else path is a pipe or file
+		// that gets the bare records, opened by the thread
+		std::string path;
+		bool uinput;
+
+		EvdevSink();
+		virtual ~EvdevSink();
+
+		bool start();
+		void stop();
+
+		void key(CEC::cec_user_control_code keycode, const LircKey &lircKey, unsigned repeat, bool release);
+
+		/**
+		 * The KEY_* code of a LIRC name, 0 if there is none
+		 */
+		static uint16_t code(const char *name, size_t len);
+};